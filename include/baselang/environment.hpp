@@ -3,6 +3,8 @@
 
 #include "stringable.hpp"
 #include "reffable.hpp"
+#include "pool.hpp"
+#include "symbol.hpp"
 
 #include "baselang/value.hpp"
 #include "baselang/types.hpp"
@@ -10,16 +12,127 @@
 
 #include <iostream>
 #include <cstddef>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// The number of bindings that an environment holds without allocating
+#define ENV_INLINE 6
+
+// The number of bindings beyond which variables are found by hashing
+#define ENV_INDEX 16
+
+/**
+ * The bindings of an environment. The first few are held within the
+ * environment itself, so that the frame of a typical call needs no
+ * memory of its own.
+ */
+class Bindings {
+    public:
+        typedef std::pair<Symbol, Val> binding;
+    private:
+        binding *xs;
+        int len = 0;
+        int cap = ENV_INLINE;
+        alignas(binding) char small[ENV_INLINE * sizeof(binding)];
+
+        void grow(int n) {
+            if (n <= cap) return;
+            if (n < 2 * cap) n = 2 * cap;
+
+            binding *ys = (binding*) ::operator new(n * sizeof(binding));
+            for (int i = 0; i < len; i++)
+                new (ys + i) binding(xs[i]);
+
+            if (xs != (binding*) small) ::operator delete(xs);
+            xs = ys;
+            cap = n;
+        }
+    public:
+        Bindings() : xs((binding*) small) {}
+        Bindings(const Bindings &B) : Bindings() { *this = B; }
+        ~Bindings() { if (xs != (binding*) small) ::operator delete(xs); }
+
+        Bindings& operator=(const Bindings &B) {
+            if (this != &B) {
+                grow(B.len);
+                for (int i = 0; i < B.len; i++)
+                    new (xs + i) binding(B.xs[i]);
+                len = B.len;
+            }
+            return *this;
+        }
+
+        int size() const { return len; }
+        bool empty() const { return !len; }
+
+        binding& operator[](int i) { return xs[i]; }
+        binding& back() { return xs[len - 1]; }
+        binding* begin() { return xs; }
+        binding* end() { return xs + len; }
+
+        void reserve(int n) { grow(n); }
+        void push_back(const binding &b) {
+            grow(len + 1);
+            new (xs + len++) binding(b);
+        }
+        void pop_back() { len--; }
+        void clear() { len = 0; }
+
+        /**
+         * Resizes the bindings, filling any new ones with a given binding.
+         */
+        void resize(int n, const binding &b) {
+            grow(n);
+            for (; len < n; len++)
+                new (xs + len) binding(b);
+            len = n;
+        }
+};
 
 // Interface for environments.
-class Environment : public Stringable, public Reffable {
+class Environment : public Stringable, public Reffable, public Pooled {
     protected:
         Environment* subenv;
 
-        // The majority of environments have subenvironments
-        std::unordered_map<std::string, Val> store;
+        // The bindings of the frame, indexed by the slots that the
+        // postprocessor assigns to variables. Unbound slots hold NULL.
+        Bindings store;
+
+        // The last slot to bind each variable, which is kept once a frame
+        // grows beyond ENV_INDEX bindings. It is discarded whenever a
+        // binding is removed, and rebuilt when it is next needed.
+        std::unordered_map<Symbol, int> *index = NULL;
+        void unindex() {
+            delete index;
+            index = NULL;
+        }
+
+        // Whether or not a variable was bound by name rather than by slot.
+        // Such a binding may shadow a variable of an enclosing frame.
+        bool dynamic = false;
+
+        /**
+         * Finds the binding of a variable within this frame.
+         * @param x The name of the variable.
+         * @return The slot holding the variable, or -1 if it is unbound.
+         */
+        int find(Symbol x);
+
+        // References to an environment are counted by every environment
+        // that it extends (see add_ref).
+        void shift(int d) {
+            this->Reffable::shift(d);
+            if (subenv) subenv->shift(d);
+        }
     public:
-        Environment(Environment *env = NULL);
+        /**
+         * Creates an environment that extends another.
+         * @param env The enclosing environment.
+         * @param size The number of slots that the frame is expected to need.
+         */
+        Environment(Environment *env = NULL, int size = 0);
         ~Environment();
         /**
          * Attempts to apply a variable name to an expression.
@@ -28,7 +141,46 @@ class Environment : public Stringable, public Reffable {
          *
          * @return The value of the given variable, or NULL if it was not found.
          */
-        virtual Val apply(std::string x);
+        virtual Val apply(Symbol x);
+
+        /**
+         * Looks up a variable that the postprocessor has resolved. If the
+         * variable is not where it was expected, it is found by name.
+         *
+         * @param x The variable to lookup.
+         * @param depth The number of environments to walk up, or -1.
+         * @param slot The slot of the variable in that environment.
+         *
+         * @return The value of the given variable, or NULL if it was not found.
+         */
+        Val apply(Symbol x, int depth, int slot) {
+            Environment *e = this;
+            int d = depth;
+            for (; d > 0 && e && !e->dynamic; d--)
+                e = e->subenv;
+
+            if (!d && e && slot < e->store.size()) {
+                auto &b = e->store[slot];
+                if (b.second && b.first == x)
+                    return b.second;
+            }
+
+            return apply(x);
+        }
+
+        /**
+         * Gathers the value that a slot of this environment binds.
+         *
+         * @param slot The slot of the variable.
+         * @param x The variable that the slot should hold.
+         *
+         * @return The value of the variable, or NULL if the slot does not hold it.
+         */
+        Val lookup(int slot, Symbol x) {
+            if (slot < 0 || slot >= store.size()) return NULL;
+            auto &b = store[slot];
+            return b.first == x ? b.second : NULL;
+        }
 
         /**
          * Reassigns the value of a variable.
@@ -38,9 +190,25 @@ class Environment : public Stringable, public Reffable {
          *
          * @return Zero if the value is successfully assigned, otherwise non-zero.
          */
-        int set(std::string, Val);
-        void rem(std::string);
+        int set(Symbol, Val);
+        void rem(Symbol);
+
+        /**
+         * Binds a variable to the slot that the postprocessor assigned it.
+         *
+         * @param slot The slot of the variable, or -1 to bind by name.
+         * @param x The name of the variable.
+         * @param v The value to assign to the variable.
+         */
+        void bind(int slot, Symbol x, Val v);
 
+        /**
+         * Removes a variable bound by bind.
+         *
+         * @param slot The slot of the variable, or -1 to remove by name.
+         * @param x The name of the variable.
+         */
+        void unbind(int slot, Symbol x);
         
         virtual void add_ref() {
             this->Reffable::add_ref();
@@ -52,6 +220,13 @@ class Environment : public Stringable, public Reffable {
             if (e) e->rem_ref();
         }
 
+        /**
+         * Visits the bound values. The enclosing environment is visited as
+         * well, though it counts the references to this one as its own.
+         */
+        void trace(ref_visitor f);
+        void clear_refs();
+
         Environment* clone();
 
         /**
@@ -60,7 +235,7 @@ class Environment : public Stringable, public Reffable {
          * @return The child environment.
          */
         Environment* subenvironment() { return subenv; }
-        std::unordered_map<std::string, Val>& get_store() { return store; }
+        Bindings& get_store() { return store; }
 
         std::string toString();
 };
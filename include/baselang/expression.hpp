@@ -3,6 +3,7 @@
 
 #include "baselang/value.hpp"
 #include "baselang/environment.hpp"
+#include "baselang/scope.hpp"
 #include "baselang/types.hpp"
 #include "stringable.hpp"
 
@@ -15,13 +16,47 @@ void throw_debug(std::string form, std::string mssg);
 
 #include <unordered_map>
 
+class Bytecode;
+
+/**
+ * The kinds of expressions. Each expression is tagged with its kind on
+ * construction, so that it can be identified without run-time type
+ * information.
+ */
+enum exp_kind {
+    // Primitives
+    EXP_FALSE, EXP_INT, EXP_REAL, EXP_STRING, EXP_TRUE, EXP_VOID,
+    // Binary operators
+    EXP_AND, EXP_OR, EXP_DIFF, EXP_DIV, EXP_COMPARE, EXP_EXPONENT,
+    EXP_DOT_PROD, EXP_MULT, EXP_SUM, EXP_MODULUS,
+    // Unary operators
+    EXP_MAGNITUDE, EXP_NORM, EXP_NOT,
+    // Data structures
+    EXP_ADT, EXP_DICT, EXP_LAMBDA, EXP_LIST, EXP_TUPLE,
+    EXP_DICT_ACCESS, EXP_LIST_ACCESS, EXP_LIST_ADD, EXP_LIST_REM,
+    EXP_LIST_SLICE, EXP_TUPLE_ACCESS,
+    // Everything else
+    EXP_ADT_DECLARATION, EXP_APPLY, EXP_CAST, EXP_DERIVATIVE, EXP_FOLD,
+    EXP_FOR, EXP_HAS, EXP_IF, EXP_IMPLEMENT, EXP_IMPORT, EXP_INPUT,
+    EXP_ISA, EXP_LET, EXP_MAP, EXP_PRINT, EXP_SEQUENCE, EXP_SET,
+    EXP_STD_MATH, EXP_SWITCH, EXP_THUNK, EXP_VAL, EXP_VAR, EXP_WHILE
+};
+
+// The size of the class of each kind of expression, for heap accounting
+extern const std::size_t exp_sizes[];
+
 // Interface for expressions.
 class Expression : public Stringable {
     public:
+        // The kind of the expression (see isExp)
+        const exp_kind kind;
+
+        Expression(exp_kind k) : kind(k) { heap_alloc(HEAP_EXP, exp_sizes[k]); }
+
         /**
          * The default behavior on deletion is to do nothing.
          */
-        virtual ~Expression() {}
+        virtual ~Expression() { heap_free(HEAP_EXP, exp_sizes[kind]); }
 
         /**
          * Given an environment, compute the value of the expression.
@@ -37,6 +72,46 @@ class Expression : public Stringable {
             return NULL;
         }
 
+        /**
+         * Computes the value of the expression as an immediate, so that
+         * numbers and booleans need not be allocated. The default is to
+         * defer to evaluate.
+         *
+         * @param env The environment under which the expression is to be computed.
+         *
+         * @return The outcome of the computation, which fails if the
+                    expression is non-computable under the given environment.
+         */
+        virtual Imm evaluate_imm(Env env);
+
+        /**
+         * Computes the value of the expression, possibly as a reference
+         * that is borrowed from the environment rather than owned. Such a
+         * reference is valid only until the environment is next modified,
+         * so it may only be requested where nothing else is evaluated
+         * before the value is used, or where the postprocessor has found
+         * that what is evaluated has no side effects. The default is to
+         * defer to evaluate_imm.
+         *
+         * @param env The environment under which the expression is to be computed.
+         *
+         * @return The outcome of the computation, which is released as an
+         *          immediate would be (see release).
+         */
+        virtual Imm evaluate_ref(Env env) { return evaluate_imm(env); }
+
+        /**
+         * Computes the value of an expression in tail position of a
+         * function body. A call that is made last may be deferred to the
+         * caller, so that tail recursion runs in constant stack space.
+         * The default is to defer to evaluate_imm.
+         *
+         * @param env The environment under which the expression is to be computed.
+         *
+         * @return The outcome of the computation, or a deferred call.
+         */
+        virtual Imm evaluate_tail(Env env) { return evaluate_imm(env); }
+
         virtual Type* typeOf(Tenv) {
             throw_err("type", "type of expression '" + toString() + "' cannot be computed because it is not implemented");
             return NULL;
@@ -58,10 +133,20 @@ class Expression : public Stringable {
         
         /**
          * Performs postprocessing on the expression to verify its safety.
+         * Variables are resolved to the slots that hold them at runtime.
+         * The default assumes that the expression has side effects.
          * @param vars The set of already defined variables.
          * @return Whether or not the expression is valid (ex: no re-declarations of vars)
          */
-        virtual bool postprocessor(HashMap<std::string, bool>* = new HashMap<std::string, bool>) { return true; };
+        virtual bool postprocessor(Scope *vars = new Scope) { vars->effect(); return true; };
+
+        /**
+         * Appends bytecode that computes the value of the expression.
+         * The default is to defer to the tree walking interpreter.
+         *
+         * @param code The bytecode to append to.
+         */
+        virtual void compile(Bytecode *code);
         
         /**
          * Creates a deep copy of the expression.
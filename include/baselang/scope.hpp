@@ -0,0 +1,189 @@
+#ifndef _BASELANG_SCOPE_HPP_
+#define _BASELANG_SCOPE_HPP_
+
+#include "symbol.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * A free variable of a lambda, along with its location where the lambda
+ * is created. The lambda's closure holds the variable at the index of
+ * the capture.
+ */
+struct Capture {
+    Symbol id;
+    int depth;
+    int slot;
+};
+
+/**
+ * The set of variables that are visible at some point in a program, as
+ * seen by the postprocessor. Each lambda introduces a new frame, and each
+ * variable is assigned a slot in the frame that defines it. At runtime,
+ * a variable can then be found by walking up some number of environments
+ * and indexing the slot, rather than by searching for its name.
+ *
+ * Lambdas capture only the variables that are free in them. A variable
+ * of an enclosing frame is found in the closure of the innermost lambda,
+ * at depth 1, and each lambda in between captures it in turn.
+ */
+class Scope {
+    private:
+        struct Frame {
+            // The slots of the variables that are currently visible
+            std::unordered_map<std::string, int> vars;
+            // The number of slots allocated so far
+            int size = 0;
+
+            // The name that the frame's lambda is bound to, if it is
+            // recursive, along with the number of calls made to it.
+            std::string self;
+            int calls = 0;
+
+            // Whether or not the frame is free of side effects, and only
+            // refers to its own variables.
+            bool pure = true;
+
+            // The free variables of the frame's lambda, and their indices
+            std::vector<Capture> captures;
+            std::unordered_map<std::string, int> captured;
+
+            // Whether or not the lambda may capture only its free variables.
+            // It is cleared if a captured variable is ever reassigned.
+            bool *flat = NULL;
+
+            // The variables that the frame has reassigned, along with the
+            // lambdas that would no longer see their values if they were.
+            std::unordered_set<std::string> assigned;
+            std::unordered_map<std::string, std::vector<bool*>> watchers;
+        };
+
+        std::vector<Frame> frames;
+
+        // Every lambda seen so far, and whether or not their environments
+        // may be inspected by name
+        std::vector<bool*> lambdas;
+        bool exposed = false;
+
+        // The number of calls and side effects recorded so far
+        int events = 0;
+
+        /**
+         * Finds the innermost frame that defines a variable.
+         * @return The index of the frame, or -1 if there is none.
+         */
+        int find(const std::string &x);
+    public:
+        Scope() : frames(1) {}
+
+        /**
+         * Enters a new frame, as is done by the body of a lambda.
+         * @param self The name that the lambda is recursively bound to.
+         * @param flat Set to whether or not the lambda may capture only
+         *             its free variables, which may change as the rest of
+         *             the program is processed.
+         */
+        void push(std::string self = "", bool *flat = NULL);
+
+        /**
+         * Leaves the innermost frame.
+         * @return The number of slots that the frame required.
+         */
+        int pop();
+
+        /**
+         * Determines whether or not a variable is visible.
+         * @param x The name of the variable.
+         * @return Whether or not any frame defines the variable.
+         */
+        bool hasKey(std::string x);
+
+        /**
+         * Defines a variable in the innermost frame.
+         * @param x The name of the variable.
+         * @return The slot of the variable.
+         */
+        int add(std::string x);
+
+        /**
+         * Removes a variable from the innermost frame, making it invisible.
+         * Its slot is not reused.
+         * @param x The name of the variable.
+         */
+        void remove(std::string x);
+
+        /**
+         * Resolves a variable to its location. A variable of an enclosing
+         * frame is captured by every lambda between it and the reference.
+         * @param x The name of the variable.
+         * @param depth Set to the number of frames between the innermost
+         *              frame and the one that defines the variable.
+         * @param slot Set to the slot of the variable in its frame.
+         * @return Whether or not the variable is visible.
+         */
+        bool lookup(std::string x, int &depth, int &slot);
+
+        /**
+         * Records a reference to a resolved variable. Frames that the
+         * variable is free in are no longer pure, unless the variable
+         * refers to the frame's own lambda.
+         * @param x The name of the variable.
+         */
+        void use(std::string x);
+
+        /**
+         * Records a call to a resolved variable. Frames are no longer pure
+         * unless the call is made to their own lambda.
+         * @param x The name of the variable.
+         */
+        void call(std::string x);
+
+        /**
+         * Records a side effect, which makes every frame impure.
+         */
+        void effect();
+
+        /**
+         * Records the reassignment of a variable by the innermost frame.
+         * Lambdas that captured the variable from it must instead capture
+         * their entire environment, so as to see the new value.
+         * @param x The name of the variable.
+         */
+        void assign(std::string x);
+
+        /**
+         * Records that the environments of lambdas may be inspected by
+         * name, as is done when differentiating them. Every lambda then
+         * captures its entire environment.
+         */
+        void expose();
+
+        /**
+         * Counts the calls and side effects recorded so far. An expression
+         * that does not change the count when it is processed cannot
+         * modify any environment when it is evaluated.
+         */
+        int effects() { return events; }
+
+        /**
+         * Determines whether or not the innermost frame is pure, as is
+         * required in order to memoize its lambda.
+         */
+        bool isPure() { return frames.back().pure; }
+
+        /**
+         * @return The number of calls that the innermost frame makes to
+         *         its own lambda.
+         */
+        int selfCalls() { return frames.back().calls; }
+
+        /**
+         * @return The free variables of the innermost frame's lambda.
+         */
+        const std::vector<Capture>& captures() { return frames.back().captures; }
+};
+
+#endif
@@ -9,8 +9,25 @@
 class TypeEnv;
 typedef TypeEnv* Tenv;
 
+/**
+ * The kinds of types. Subclasses of an intermediate class have consecutive
+ * kinds, so that membership can be tested as a range (see isType).
+ */
+enum type_kind {
+    TYPE_ADT,
+    TYPE_LAMBDA, TYPE_TUPLE, TYPE_SUM, TYPE_MULT, TYPE_DERIVATIVE,
+    TYPE_LIST,
+    TYPE_BOOL, TYPE_STRING, TYPE_VOID, TYPE_REAL, TYPE_INT,
+    TYPE_DICT,
+    TYPE_VAR
+};
+
 class Type : public Stringable {
     public:
+        // The kind of the type (see isType)
+        const type_kind kind;
+
+        Type(type_kind k) : kind(k) {}
         virtual ~Type() {}
 
         virtual Type* clone() = 0;
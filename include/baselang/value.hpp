@@ -3,14 +3,83 @@
 
 #include "stringable.hpp"
 #include "reffable.hpp"
+#include "heap.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * The types of integers and reals. They are int and float, unless the
+ * interpreter is built with WIDE_NUMBERS defined (make WIDE=1), in which
+ * case they are 64-bit integers and doubles.
+ */
+#ifdef WIDE_NUMBERS
+typedef int64_t integer_t;
+typedef double real_t;
+#else
+typedef int integer_t;
+typedef float real_t;
+#endif
+
+/**
+ * The kinds of values. Each value is tagged with its kind on construction,
+ * so that it can be identified without run-time type information.
+ */
+enum value_kind {
+    VAL_ADT, VAL_BOOL, VAL_DICT, VAL_INT, VAL_LAMBDA, VAL_LIST,
+    VAL_REAL, VAL_STRING, VAL_THUNK, VAL_TUPLE, VAL_VOID
+};
+
+// The size of the class of each kind of value, for heap accounting
+extern const std::size_t value_sizes[];
 
 class Value : public Stringable, public Reffable {
     public:
-        virtual ~Value() {}
+        // The kind of the value (see isVal)
+        const value_kind kind;
+
+        Value(value_kind k) : kind(k) {
+            // Values that hold others are tracked by the cycle collector
+            traced = k == VAL_ADT || k == VAL_DICT || k == VAL_LAMBDA
+                  || k == VAL_LIST || k == VAL_THUNK || k == VAL_TUPLE;
+            heap_alloc((heap_kind) k, value_sizes[k]);
+        }
+        virtual ~Value() { heap_free((heap_kind) kind, value_sizes[kind]); }
 
         virtual Value* clone() = 0;
         virtual int set(Value*) { return 1; };
 };
 typedef Value* Val;
 
+/**
+ * A value that is passed without being allocated on the heap. Numbers and
+ * booleans are held directly; any other value is held as a reference. A
+ * call in tail position may also be deferred to the caller (see
+ * resolve_tail).
+ */
+struct Imm {
+    enum imm_kind { FAIL, INT, REAL, BOOL, BOXED, TAIL } kind;
+
+    // Whether or not the reference is borrowed from the environment, in
+    // which case it is not released (see Expression::evaluate_ref). It is
+    // kept beside the kind so that an immediate fits in two registers.
+    bool borrowed = false;
+
+    union {
+        integer_t i;
+        real_t r;
+        bool b;
+        Val v;
+    };
+
+    Imm() : kind(FAIL), v(nullptr) {}
+    explicit Imm(integer_t x) : kind(INT), i(x) {}
+    explicit Imm(real_t x) : kind(REAL), r(x) {}
+    explicit Imm(bool x) : kind(BOOL), b(x) {}
+    explicit Imm(Val x) : kind(x ? BOXED : FAIL), v(x) {}
+
+    bool is_number() const { return kind == INT || kind == REAL; }
+    real_t real() const { return kind == INT ? i : r; }
+};
+
 #endif
@@ -1,6 +1,14 @@
 #ifndef _CONFIG_HPP_
 #define _CONFIG_HPP_
 
+/**
+ * The engines that are capable of executing a program.
+ */
+enum engine_kind {
+    ENGINE_AST, // Tree walking interpreter
+    ENGINE_VM   // Bytecode interpreter
+};
+
 /**
  * Defines a configuration object to be used by the interpreter.
  */
@@ -22,6 +30,27 @@ struct config {
     // Whether or not module caching will be used.
     bool module_caching = false;
 
+    // The engine used to execute programs.
+    engine_kind engine = ENGINE_AST;
+
+    // The maximum number of nested calls made by the bytecode interpreter.
+    unsigned max_depth = 1000000;
+
+    // The maximum number of results memoized for each pure function, or
+    // zero if memoization is disabled.
+    unsigned memo_size = 4096;
+
+    // The largest number of bytes that live objects may occupy, or zero if
+    // there is no limit (see heap_exceeded).
+    long max_heap = 0;
+
+    // Whether or not each evaluation allocates from an arena of its own.
+    bool arenas = false;
+
+    // The number of threads that large numeric kernels are divided among
+    // (see parallel_for).
+    unsigned threads = 1;
+
     // The arguments given to the program at runtime.
     char **argv = (char**) 0;
 };
@@ -20,7 +20,7 @@
  */
 template<typename T>
 inline bool isExp(const Exp t) {
-    return t && dynamic_cast<const T*>(t) != nullptr;
+    return t && t->kind == T::KIND;
 }
 
 /**
@@ -31,20 +31,25 @@ class AdtDeclarationExp : public Expression {
         // The name of the ADT class to define.
         std::string name;
         // The name of each definition 
-        std::string *ids;
+        Symbol *ids;
         // The argument types to each kind
         Type* **argss;
         
         Exp body;
+
+        // The slot that holds the ADT
+        int slot = -1;
     public:
-        AdtDeclarationExp(std::string nm, std::string* is, Type*** ass, Exp e)
-        : name(nm), ids(is), argss(ass), body(e) {}
+        static const exp_kind KIND = EXP_ADT_DECLARATION;
+
+        AdtDeclarationExp(std::string nm, Symbol* is, Type*** ass, Exp e)
+        : Expression(KIND), name(nm), ids(is), argss(ass), body(e) {}
         ~AdtDeclarationExp();
         
         Val evaluate(Env);
         Type* typeOf(Tenv);
 
-        bool postprocessor(HashMap<std::string,bool>*);
+        bool postprocessor(Scope*);
 
         Exp clone();
         std::string toString();
@@ -59,24 +64,39 @@ class SwitchExp : public Expression {
         Exp adt;
         
         // The different categories
-        std::string *names;
+        Symbol *names;
 
         // The given names
-        std::string **idss;
+        Symbol **idss;
         
         // The expressions to evaluate on successful matching
         Exp *bodies;
 
+        // For each case, the slot of its first argument
+        int *slots = NULL;
+
+        /**
+         * Evaluates the matching case with its arguments bound. In tail
+         * position, a deferred call is returned before the arguments are
+         * unbound, since it may yet need them.
+         */
+        Imm evaluate_scoped(Env env, bool tail);
+
     public:
-        SwitchExp(Exp a, std::string *nms, std::string **xs, Exp *ys)
-        : adt(a), names(nms), idss(xs), bodies(ys) {}
+
+        static const exp_kind KIND = EXP_SWITCH;
+
+        SwitchExp(Exp a, Symbol *nms, Symbol **xs, Exp *ys)
+        : Expression(KIND), adt(a), names(nms), idss(xs), bodies(ys) {}
         ~SwitchExp();
 
         Val evaluate(Env);
+        Imm evaluate_imm(Env env) { return evaluate_scoped(env, false); }
+        Imm evaluate_tail(Env env) { return evaluate_scoped(env, true); }
         Val derivativeOf(std::string, Env, Env);
         Type* typeOf(Tenv);
 
-        bool postprocessor(HashMap<std::string,bool>*);
+        bool postprocessor(Scope*);
 
         Exp clone();
         std::string toString();
@@ -91,15 +111,20 @@ class ApplyExp : public Expression {
     private:
         Exp op;
         Exp *args;
+        int argc;
     public:
+        static const exp_kind KIND = EXP_APPLY;
+
         ApplyExp(Exp, Exp*);
         ~ApplyExp();
 
         Val evaluate(Env);
+        Imm evaluate_tail(Env);
+        void compile(Bytecode*);
         Val derivativeOf(std::string, Env, Env);
         Type* typeOf(Tenv);
 
-        bool postprocessor(HashMap<std::string,bool> *vars);
+        bool postprocessor(Scope *vars);
         
         Exp clone();
         std::string toString();
@@ -113,7 +138,9 @@ class CastExp : public Expression {
         Type *type;
         Exp exp;
     public:
-        CastExp(Type *t, Exp e) : type(t), exp(e) {}
+        static const exp_kind KIND = EXP_CAST;
+
+        CastExp(Type *t, Exp e) : Expression(KIND), type(t), exp(e) {}
         ~CastExp() { delete exp; delete type; }
 
         Val evaluate(Env);
@@ -122,6 +149,8 @@ class CastExp : public Expression {
         Exp clone() { return new CastExp(type->clone(), exp->clone()); }
         std::string toString();
 
+        bool postprocessor(Scope *vars) { return exp->postprocessor(vars); }
+
         Exp optimize() { exp->optimize(); return this; }
 };
 
@@ -134,7 +163,9 @@ class DerivativeExp : public Expression {
         Exp func;
         std::string var;
     public:
-        DerivativeExp(Exp f, std::string s) : func(f), var(s) {}
+        static const exp_kind KIND = EXP_DERIVATIVE;
+
+        DerivativeExp(Exp f, std::string s) : Expression(KIND), func(f), var(s) {}
         ~DerivativeExp() { delete func; }
 
         Val evaluate(Env);
@@ -142,7 +173,9 @@ class DerivativeExp : public Expression {
 
         Type* typeOf(Tenv);
 
-        bool postprocessor(HashMap<std::string,bool> *vars) {
+        bool postprocessor(Scope *vars) {
+            // Differentiation looks up variables by name in closures
+            vars->expose();
             return func->postprocessor(vars);
         }
 
@@ -159,8 +192,10 @@ class FoldExp : public Expression {
         Exp func;
         Exp base;
     public:
+        static const exp_kind KIND = EXP_FOLD;
+
         FoldExp(Exp l, Exp f, Exp b)
-                : list(l), func(f), base(b) {}
+                : Expression(KIND), list(l), func(f), base(b) {}
         ~FoldExp() { delete list; delete func; delete base; }
         
         Val evaluate(Env);
@@ -170,7 +205,7 @@ class FoldExp : public Expression {
         Exp clone() { return new FoldExp(list->clone(), func->clone(), base->clone()); }
         std::string toString();
         
-        bool postprocessor(HashMap<std::string,bool> *vars);
+        bool postprocessor(Scope *vars);
 
         Exp optimize();
 };
@@ -183,18 +218,27 @@ class ForExp : public Expression {
         std::string id;
         Exp set;
         Exp body;
+
+        // The slot that holds the loop variable
+        int slot = -1;
     public:
-        ForExp(std::string x, Exp xs, Exp e) : id(x), set(xs), body(e) {}
+        static const exp_kind KIND = EXP_FOR;
+
+        ForExp(std::string x, Exp xs, Exp e) : Expression(KIND), id(x), set(xs), body(e) {}
         ~ForExp() { delete set; delete body; }
 
         Val evaluate(Env);
         Val derivativeOf(std::string, Env, Env);
         Type* typeOf(Tenv);
 
-        Exp clone() { return new ForExp(id, set->clone(), body->clone()); }
+        Exp clone() {
+            auto e = new ForExp(id, set->clone(), body->clone());
+            e->slot = slot;
+            return e;
+        }
         std::string toString();
 
-        bool postprocessor(HashMap<std::string,bool> *vars);
+        bool postprocessor(Scope *vars);
 
         Exp optimize();
 };
@@ -207,7 +251,9 @@ class HasExp : public Expression {
         Exp item;
         Exp set;
     public:
-        HasExp(Exp x, Exp l) : item(x), set(l) {}
+        static const exp_kind KIND = EXP_HAS;
+
+        HasExp(Exp x, Exp l) : Expression(KIND), item(x), set(l) {}
         ~HasExp() { delete item; delete set; }
 
         Val evaluate(Env);
@@ -215,7 +261,7 @@ class HasExp : public Expression {
 
         std::string toString();
 
-        bool postprocessor(HashMap<std::string,bool> *vars);
+        bool postprocessor(Scope *vars);
 
         Exp optimize() {
             item = item->optimize();
@@ -235,16 +281,23 @@ class IfExp : public Expression {
         Exp tExp;
         Exp fExp;
     public:
+        static const exp_kind KIND = EXP_IF;
+
         IfExp(Exp, Exp, Exp);
         ~IfExp() { delete cond; delete tExp; delete fExp; }
 
         Val evaluate(Env);
+        Imm evaluate_imm(Env);
+        Imm evaluate_tail(Env);
+        void compile(Bytecode*);
         Val derivativeOf(std::string, Env, Env);
         Type* typeOf(Tenv);
         
         Exp clone() { return new IfExp(cond->clone(), tExp->clone(), fExp->clone()); }
         std::string toString();
 
+        bool postprocessor(Scope *vars);
+
         Exp optimize();
 };
 
@@ -257,27 +310,32 @@ class ImportExp : public Expression {
         std::string module;
         std::string name;
         Exp exp;
+
+        // The slot that holds the module
+        int slot = -1;
     protected:
         // We will maintain a cache of previously imported modules
         // so that if a module is already loaded, it is not reloaded.
         static std::map<std::string, Val> module_cache;
     public:
+        static const exp_kind KIND = EXP_IMPORT;
+
         // import m
         ImportExp(std::string m, Exp e) : ImportExp(m, m, e) {}
         // import m as n
         ImportExp(std::string m, std::string n, Exp e)
-                : module(m), name(n), exp(e) {
+                : Expression(KIND), module(m), name(n), exp(e) {
                     // Default behavior: return the expression
                     if (!e) exp = new VarExp(m);
         }
         ~ImportExp() { delete exp; }
 
-        bool postprocessor(HashMap<std::string,bool> *vars) {
+        bool postprocessor(Scope *vars) {
             if (vars->hasKey(name)) {
                 throw_err("error", "redefinition of variable " + name + " is not permitted");
                 return NULL;
             } else {
-                vars->add(name, true);
+                slot = vars->add(name);
                 auto res = exp->postprocessor(vars);
                 vars->remove(name);
                 return res;
@@ -289,7 +347,11 @@ class ImportExp : public Expression {
 
         static void clear_cache();
 
-        Exp clone() { return new ImportExp(module, name, exp->clone()); }
+        Exp clone() {
+            auto e = new ImportExp(module, name, exp->clone());
+            e->slot = slot;
+            return e;
+        }
         std::string toString();
 };
 
@@ -298,7 +360,9 @@ class ImportExp : public Expression {
  */
 class InputExp : public Expression {
     public:
-        InputExp() {}
+        static const exp_kind KIND = EXP_INPUT;
+
+        InputExp() : Expression(KIND) {}
         
         Val evaluate(Env);
         Type* typeOf(Tenv) { return new StringType; }
@@ -317,7 +381,9 @@ class IsaExp : public Expression {
         Exp exp;
         Type *type;
     public:
-        IsaExp(Exp e, Type *t) : exp(e), type(t) {}
+        static const exp_kind KIND = EXP_ISA;
+
+        IsaExp(Exp e, Type *t) : Expression(KIND), exp(e), type(t) {}
         ~IsaExp() { delete exp; delete type; }
 
         Val evaluate(Env);
@@ -326,7 +392,7 @@ class IsaExp : public Expression {
         Exp clone() { return new IsaExp(exp->clone(), type->clone()); }
         std::string toString();
 
-        bool postprocessor(HashMap<std::string,bool> *vars);
+        bool postprocessor(Scope *vars);
 
         Exp optimize() { exp = exp->optimize(); return this; }
 };
@@ -336,30 +402,46 @@ class IsaExp : public Expression {
  */
 class LetExp : public Expression {
     private:
-        std::string *ids;
+        Symbol *ids;
         Exp *exps;
         Exp body;
 
         // For a given index, whether or not the value should handle recursion.
         bool *rec;
+
+        // The slot that holds each variable
+        int *slots = NULL;
+
+        /**
+         * Evaluates the body with the variables bound. In tail position,
+         * a deferred call is returned before the variables are unbound,
+         * since it may yet need them.
+         */
+        Imm evaluate_scoped(Env env, bool tail);
     public:
-        LetExp(std::string*, Exp*, Exp, bool* = NULL);
+        static const exp_kind KIND = EXP_LET;
+
+        LetExp(Symbol*, Exp*, Exp, bool* = NULL);
         ~LetExp() {
             for (int i = 0; exps[i]; i++) delete exps[i];
             delete[] exps;
             delete body;
             delete[] ids;
             delete[] rec;
+            delete[] slots;
         }
 
         Val evaluate(Env);
+        Imm evaluate_imm(Env env) { return evaluate_scoped(env, false); }
+        Imm evaluate_tail(Env env) { return evaluate_scoped(env, true); }
+        void compile(Bytecode*);
         Val derivativeOf(std::string, Env, Env); 
         Type* typeOf(Tenv);
         
         Exp clone();
         std::string toString();
 
-        bool postprocessor(HashMap<std::string,bool> *vars);
+        bool postprocessor(Scope *vars);
 
         Exp optimize();
 };
@@ -369,7 +451,9 @@ class LetExp : public Expression {
  */
 class MagnitudeExp : public UnaryOperatorExp {
     public:
-        using UnaryOperatorExp::UnaryOperatorExp;
+        static const exp_kind KIND = EXP_MAGNITUDE;
+
+        MagnitudeExp(Exp e) : UnaryOperatorExp(KIND, e) {}
 
         Exp clone() { return new MagnitudeExp(exp->clone()); }
         Type* typeOf(Tenv);
@@ -389,7 +473,9 @@ class MapExp : public Expression {
         Exp func;
         Exp list;
     public:
-        MapExp(Exp f, Exp l) : func(f), list(l) {}
+        static const exp_kind KIND = EXP_MAP;
+
+        MapExp(Exp f, Exp l) : Expression(KIND), func(f), list(l) {}
         ~MapExp() { delete func; delete list; }
         Exp clone() { return new MapExp(func->clone(), list->clone()); }
 
@@ -399,7 +485,11 @@ class MapExp : public Expression {
         
         std::string toString();
 
-        bool postprocessor(HashMap<std::string,bool> *vars) { return func->postprocessor(vars) && list->postprocessor(vars); }
+        bool postprocessor(Scope *vars) {
+            // The function is not known, so neither are its effects
+            vars->effect();
+            return func->postprocessor(vars) && list->postprocessor(vars);
+        }
 
         Exp optimize() { func = func->optimize(); list = list->optimize(); return this; }
 };
@@ -409,7 +499,9 @@ class MapExp : public Expression {
  */
 class NormExp : public UnaryOperatorExp {
     public:
-        using UnaryOperatorExp::UnaryOperatorExp;
+        static const exp_kind KIND = EXP_NORM;
+
+        NormExp(Exp e) : UnaryOperatorExp(KIND, e) {}
 
         Exp clone() { return new NormExp(exp->clone()); }
 
@@ -425,7 +517,9 @@ class NormExp : public UnaryOperatorExp {
  */
 class NotExp : public UnaryOperatorExp {
     public:
-        using UnaryOperatorExp::UnaryOperatorExp;
+        static const exp_kind KIND = EXP_NOT;
+
+        NotExp(Exp e) : UnaryOperatorExp(KIND, e) {}
 
         Val op(Val);
         Type* typeOf(Tenv);
@@ -444,19 +538,24 @@ class SequenceExp : public Expression {
     private:
         LinkedList<Exp> *seq;
     public:
-        SequenceExp() : seq(new LinkedList<Exp>) {}
-        SequenceExp(LinkedList<Exp>* es) : seq(es) {}
+        static const exp_kind KIND = EXP_SEQUENCE;
+
+        SequenceExp() : Expression(KIND), seq(new LinkedList<Exp>) {}
+        SequenceExp(LinkedList<Exp>* es) : Expression(KIND), seq(es) {}
         ~SequenceExp() { while (!seq->isEmpty()) delete seq->remove(0); delete seq; }
 
         LinkedList<Exp>* getSeq() { return seq; }
 
         Val evaluate(Env);
+        Imm evaluate_imm(Env);
+        Imm evaluate_tail(Env);
+        void compile(Bytecode*);
         Type* typeOf(Tenv);
         
         Exp clone();
         std::string toString();
 
-        bool postprocessor(HashMap<std::string,bool> *vars);
+        bool postprocessor(Scope *vars);
 
         Exp optimize();
 };
@@ -469,6 +568,8 @@ class SetExp : public Expression {
         Exp tgt;
         Exp exp;
     public:
+        static const exp_kind KIND = EXP_SET;
+
         SetExp(Exp, Exp);
         ~SetExp() {
             delete tgt;
@@ -476,12 +577,14 @@ class SetExp : public Expression {
         }
 
         Val evaluate(Env);
+        Imm evaluate_imm(Env);
+        void compile(Bytecode*);
         Type* typeOf(Tenv);
         
         Exp clone();
         std::string toString();
 
-        bool postprocessor(HashMap<std::string,bool> *vars);
+        bool postprocessor(Scope *vars);
 
         Exp optimize();
 };
@@ -494,7 +597,9 @@ class ThunkExp : public Expression {
     private:
         Exp exp;
     public:
-        ThunkExp(Exp e) : exp(e) {}
+        static const exp_kind KIND = EXP_THUNK;
+
+        ThunkExp(Exp e) : Expression(KIND), exp(e) {}
         ~ThunkExp() { delete exp; }
 
         Val evaluate(Env env) { env->add_ref(); return new Thunk(exp->clone(), env); }
@@ -503,7 +608,7 @@ class ThunkExp : public Expression {
 
         Type* typeOf(Tenv tenv) { return exp->typeOf(tenv); }
 
-        bool postprocessor(HashMap<std::string,bool> *vars);
+        bool postprocessor(Scope *vars);
 
         Exp optimize() { exp = exp->optimize(); return this; }
         Exp clone() { return new ThunkExp(exp->clone()); }
@@ -517,13 +622,17 @@ class ValExp : public Expression {
     private:
         Val val;
     public:
-        ValExp(Val v) : val(v) { val->add_ref(); }
+        static const exp_kind KIND = EXP_VAL;
+
+        ValExp(Val v) : Expression(KIND), val(v) { val->add_ref(); }
         ~ValExp() { val->rem_ref(); }
 
         Val evaluate(Env) { val->add_ref(); return val; }
 
         Exp clone() { return new ValExp(val); }
         std::string toString();
+
+        bool postprocessor(Scope*) { return true; }
 };
 
 /**
@@ -535,18 +644,22 @@ class WhileExp : public Expression {
         Exp body;
         bool alwaysEnter; /* If true, always enter for at least one iteration; do-while */
     public:
+        static const exp_kind KIND = EXP_WHILE;
+
         WhileExp(Exp c, Exp b, bool enter = false)
-                : cond(c), body(b), alwaysEnter(enter) {}
+                : Expression(KIND), cond(c), body(b), alwaysEnter(enter) {}
         ~WhileExp() { delete cond; delete body; }
 
         Val evaluate(Env);
+        Imm evaluate_imm(Env);
+        void compile(Bytecode*);
         Val derivativeOf(std::string, Env, Env);
         Type* typeOf(Tenv);
 
         Exp clone() { return new WhileExp(cond->clone(), body->clone(), alwaysEnter); }
         std::string toString();
 
-        bool postprocessor(HashMap<std::string,bool> *vars);
+        bool postprocessor(Scope *vars);
 
         Exp optimize();
 };
@@ -9,9 +9,11 @@
 class DictAccessExp : public Expression {
     private:
         Exp list;
-        std::string idx;
+        Symbol idx;
     public:
-        DictAccessExp(Exp x, std::string i) : list(x), idx(i) {}
+        static const exp_kind KIND = EXP_DICT_ACCESS;
+
+        DictAccessExp(Exp x, Symbol i) : Expression(KIND), list(x), idx(i) {}
         ~DictAccessExp() { delete list; }
 
         Val evaluate(Env);
@@ -21,8 +23,10 @@ class DictAccessExp : public Expression {
         Exp clone() { return new DictAccessExp(list->clone(), idx); }
         std::string toString();
 
+        bool postprocessor(Scope *vars) { return list->postprocessor(vars); }
+
         Exp getList() { return list; }
-        std::string getIdx() { return idx; }
+        Symbol getIdx() { return idx; }
 
         Exp optimize();
 };
@@ -34,8 +38,13 @@ class ListAccessExp : public Expression {
     private:
         Exp list;
         Exp idx;
+
+        // Whether or not the list may be borrowed while the index is found
+        bool borrow = false;
     public:
-        ListAccessExp(Exp x, Exp i) : list(x), idx(i) {}
+        static const exp_kind KIND = EXP_LIST_ACCESS;
+
+        ListAccessExp(Exp x, Exp i) : Expression(KIND), list(x), idx(i) {}
         ~ListAccessExp() { delete list; delete idx; }
 
         Val evaluate(Env);
@@ -45,6 +54,8 @@ class ListAccessExp : public Expression {
         Exp clone() { return new ListAccessExp(list->clone(), idx->clone()); }
         std::string toString();
 
+        bool postprocessor(Scope *vars);
+
         Exp getList() { return list; }
         Exp getIdx() { return idx; }
 
@@ -60,12 +71,16 @@ class ListAddExp : public Expression {
         Exp idx;
         Exp elem;
     public:
-        ListAddExp(Exp x, Exp i, Exp e) : list(x), idx(i), elem(e) {}
+        static const exp_kind KIND = EXP_LIST_ADD;
+
+        ListAddExp(Exp x, Exp i, Exp e) : Expression(KIND), list(x), idx(i), elem(e) {}
         ~ListAddExp() { delete list; delete idx; delete elem; }
         
         Type* typeOf(Tenv);
         Val evaluate(Env);
 
+        bool postprocessor(Scope *vars);
+
         Exp clone() { return new ListAddExp(list->clone(), idx->clone(), elem->clone()); }
         std::string toString();
 };
@@ -78,12 +93,16 @@ class ListRemExp : public Expression {
         Exp list;
         Exp idx;
     public:
-        ListRemExp(Exp x, Exp i) : list(x), idx(i) {}
+        static const exp_kind KIND = EXP_LIST_REM;
+
+        ListRemExp(Exp x, Exp i) : Expression(KIND), list(x), idx(i) {}
         ~ListRemExp() { delete list; delete idx; }
         
         Type* typeOf(Tenv);
         Val evaluate(Env);
 
+        bool postprocessor(Scope *vars);
+
         Exp clone() { return new ListRemExp(list->clone(), idx->clone()); }
         std::string toString();
 };
@@ -96,8 +115,13 @@ class ListSliceExp : public Expression {
         Exp list;
         Exp from;
         Exp to;
+
+        // Whether or not the list may be borrowed while the bounds are found
+        bool borrow = false;
     public:
-        ListSliceExp(Exp x, Exp i, Exp j) : list(x), from(i), to(j) {}
+        static const exp_kind KIND = EXP_LIST_SLICE;
+
+        ListSliceExp(Exp x, Exp i, Exp j) : Expression(KIND), list(x), from(i), to(j) {}
         ~ListSliceExp() { delete list; delete from; delete to; }
 
         Val evaluate(Env);
@@ -108,6 +132,8 @@ class ListSliceExp : public Expression {
             Exp t = to ? to->clone() : NULL;
             return new ListSliceExp(list->clone(), f, t); }
         std::string toString();
+
+        bool postprocessor(Scope *vars);
 };
 
 class TupleAccessExp : public Expression {
@@ -115,7 +141,9 @@ class TupleAccessExp : public Expression {
         Exp exp;
         bool idx;
     public:
-        TupleAccessExp(Exp exp, bool b) : exp(exp), idx(b) {}
+        static const exp_kind KIND = EXP_TUPLE_ACCESS;
+
+        TupleAccessExp(Exp exp, bool b) : Expression(KIND), exp(exp), idx(b) {}
         ~TupleAccessExp() { delete exp; }
 
         Val evaluate(Env);
@@ -124,6 +152,8 @@ class TupleAccessExp : public Expression {
 
         Exp clone() { return new TupleAccessExp(exp->clone(), idx); }
         std::string toString();
+
+        bool postprocessor(Scope *vars) { return exp->postprocessor(vars); }
 };
 
 #endif
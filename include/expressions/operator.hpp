@@ -10,29 +10,87 @@ class UnaryOperatorExp : public Expression {
     protected:
         Exp exp;
     public:
-        UnaryOperatorExp(Exp e) : exp(e) {}
+        UnaryOperatorExp(exp_kind k, Exp e) : Expression(k), exp(e) {}
         ~UnaryOperatorExp() { delete exp; }
 
         Val evaluate(Env env);
         virtual Val op(Val) = 0;
 
+        void compile(Bytecode*);
+
         virtual Exp optimize() { exp = exp->optimize(); return this; }
-        bool postprocessor(HashMap<std::string,bool> *vars);
+        bool postprocessor(Scope *vars);
 };
 
+class OperatorExp;
+
+/**
+ * A form of an operator that is specialized to some kinds of operands,
+ * as chosen by OperatorExp::specialize.
+ * @param e The node that the operator belongs to.
+ * @param a The left operand, whose kind is the one specialized on.
+ * @param b The right operand, whose kind is the one specialized on.
+ * @param c Set to the result, which may be a failure.
+ * @return Whether or not the operands pass the guard of the variant. If
+ *         not, the generic operator must be applied instead.
+ */
+typedef bool (*op_variant)(OperatorExp *e, Imm a, Imm b, Imm &c);
+
 class OperatorExp : public Expression {
     protected:
         Expression *left;
         Expression *right;
+
+        // Type feedback. Once the node has seen the same kinds of operands
+        // enough times in a row, it switches to a variant of the operator
+        // for them. If the guard of the variant ever fails, the node goes
+        // back to the generic operator for good.
+        op_variant variant = NULL;
+        Imm::imm_kind kinds[2] = {Imm::FAIL, Imm::FAIL};
+        int observed = 0;
+        bool generic = false;
+
+        // Whether or not the left operand may be borrowed, which is the case
+        // when the right one has no side effects (see Scope::effects)
+        bool borrow = false;
+
+        /**
+         * Chooses a variant of the operator for some operands.
+         * @param a The left operand.
+         * @param b The right operand.
+         * @return A variant for operands of the same kinds as these, or
+         *         NULL if the generic operator is as good as any.
+         */
+        virtual op_variant specialize(Imm, Imm) { return NULL; }
     public:
-        OperatorExp(Exp, Exp);
+        OperatorExp(exp_kind, Exp, Exp);
         ~OperatorExp();
         Val evaluate(Env);
+        Imm evaluate_imm(Env);
         
         virtual Val op(Val, Val) = 0;
 
-        bool postprocessor(HashMap<std::string,bool> *vars)
-                { return left->postprocessor(vars) && right->postprocessor(vars); }
+        /**
+         * Applies the operator to immediates. The default is to box them
+         * and defer to the operator on values.
+         * @param a The left operand, which is not a thunk.
+         * @param b The right operand, which is not a thunk.
+         * @return The result, whose kind is FAIL on failure.
+         */
+        virtual Imm op(Imm a, Imm b);
+
+        /**
+         * Applies the operator to immediates, through the variant that the
+         * node has specialized to if there is one.
+         * @param a The left operand, which is not a thunk.
+         * @param b The right operand, which is not a thunk.
+         * @return The result, whose kind is FAIL on failure.
+         */
+        Imm apply(Imm a, Imm b);
+
+        void compile(Bytecode*);
+
+        bool postprocessor(Scope *vars);
 
         Exp getLeft() { return left; }
         Exp getRight() { return right; }
@@ -44,8 +102,12 @@ class OperatorExp : public Expression {
  * Computes the boolean AND operation.
  */
 class AndExp : public OperatorExp {
+    protected:
+        op_variant specialize(Imm, Imm);
     public:
-        using OperatorExp::OperatorExp;
+        static const exp_kind KIND = EXP_AND;
+
+        AndExp(Exp l, Exp r) : OperatorExp(KIND, l, r) {}
         Val op(Val, Val);
         
         Val derivativeOf(std::string, Env, Env);
@@ -59,8 +121,12 @@ class AndExp : public OperatorExp {
  * Computes the boolean OR operation.
  */
 class OrExp : public OperatorExp {
+    protected:
+        op_variant specialize(Imm, Imm);
     public:
-        using OperatorExp::OperatorExp;
+        static const exp_kind KIND = EXP_OR;
+
+        OrExp(Exp l, Exp r) : OperatorExp(KIND, l, r) {}
         Val op(Val, Val);
         
         Val derivativeOf(std::string, Env, Env);
@@ -74,21 +140,31 @@ class OrExp : public OperatorExp {
  * Performs the subtraction (difference) operation on two expressions.
  */
 class DiffExp : public OperatorExp {
+    protected:
+        op_variant specialize(Imm, Imm);
     public:
-        using OperatorExp::OperatorExp;
+        static const exp_kind KIND = EXP_DIFF;
+
+        DiffExp(Exp l, Exp r) : OperatorExp(KIND, l, r) {}
 
         Val op(Val, Val);
         Val derivativeOf(std::string, Env, Env);
         Exp symb_diff(std::string);
         Type* typeOf(Tenv);
         
+        Imm op(Imm, Imm);
+
         Exp clone() { return new DiffExp(left->clone(), right->clone()); }
         std::string toString();
 };
 
 class DivExp : public OperatorExp {
+    protected:
+        op_variant specialize(Imm, Imm);
     public:
-        using OperatorExp::OperatorExp;
+        static const exp_kind KIND = EXP_DIV;
+
+        DivExp(Exp l, Exp r) : OperatorExp(KIND, l, r) {}
 
         Val op(Val, Val);
         Val derivativeOf(std::string, Env, Env);
@@ -96,6 +172,8 @@ class DivExp : public OperatorExp {
 
         Type* typeOf(Tenv);
         
+        Imm op(Imm, Imm);
+
         Exp clone() { return new DivExp(left->clone(), right->clone()); }
         std::string toString();
 
@@ -115,11 +193,18 @@ enum CompOp {
 class CompareExp : public OperatorExp {
     private:
         CompOp operation;
+
+        op_variant specialize(Imm, Imm);
     public:
-        CompareExp(Exp l, Expression *r, CompOp op) : OperatorExp(l, r) {
+        static const exp_kind KIND = EXP_COMPARE;
+
+        CompareExp(Exp l, Expression *r, CompOp op) : OperatorExp(KIND, l, r) {
             operation = op;
         }
         Val op(Val, Val);
+        Imm op(Imm, Imm);
+
+        CompOp getOperation() { return operation; }
 
         Type* typeOf(Tenv);
         
@@ -132,7 +217,9 @@ class CompareExp : public OperatorExp {
  */
 class ExponentExp : public OperatorExp {
     public:
-        using OperatorExp::OperatorExp;
+        static const exp_kind KIND = EXP_EXPONENT;
+
+        ExponentExp(Exp l, Exp r) : OperatorExp(KIND, l, r) {}
 
         Val op(Val, Val);
         Val derivativeOf(std::string, Env, Env);
@@ -144,7 +231,9 @@ class ExponentExp : public OperatorExp {
 
 class DotProdExp : public OperatorExp {
     public:
-        using OperatorExp::OperatorExp;
+        static const exp_kind KIND = EXP_DOT_PROD;
+
+        DotProdExp(Exp l, Exp r) : OperatorExp(KIND, l, r) {}
 
         Val op(Val, Val);
         
@@ -158,14 +247,20 @@ class DotProdExp : public OperatorExp {
  * Expression for multiplying numbers.
  */
 class MultExp : public OperatorExp {
+    protected:
+        op_variant specialize(Imm, Imm);
     public:
-        using OperatorExp::OperatorExp;
+        static const exp_kind KIND = EXP_MULT;
+
+        MultExp(Exp l, Exp r) : OperatorExp(KIND, l, r) {}
 
         Val op(Val, Val);
         Val derivativeOf(std::string, Env, Env);
 
         Type* typeOf(Tenv);
         
+        Imm op(Imm, Imm);
+
         Exp clone() { return new MultExp(left->clone(), right->clone()); }
         std::string toString();
 
@@ -176,8 +271,12 @@ class MultExp : public OperatorExp {
  * Expression for adding numbers.
  */
 class SumExp : public OperatorExp {
+    protected:
+        op_variant specialize(Imm, Imm);
     public:
-        using OperatorExp::OperatorExp;
+        static const exp_kind KIND = EXP_SUM;
+
+        SumExp(Exp l, Exp r) : OperatorExp(KIND, l, r) {}
 
         Val op(Val, Val);
         Val derivativeOf(std::string, Env, Env);
@@ -185,6 +284,8 @@ class SumExp : public OperatorExp {
 
         Type* typeOf(Tenv);
         
+        Imm op(Imm, Imm);
+
         Exp clone() { return new SumExp(left->clone(), right->clone()); }
         std::string toString();
 
@@ -195,8 +296,12 @@ class SumExp : public OperatorExp {
  * Expression for modulus.
  */
 class ModulusExp : public OperatorExp {
+    protected:
+        op_variant specialize(Imm, Imm);
     public:
-        using OperatorExp::OperatorExp;
+        static const exp_kind KIND = EXP_MODULUS;
+
+        ModulusExp(Exp l, Exp r) : OperatorExp(KIND, l, r) {}
 
         Val op(Val, Val);
         Val derivativeOf(std::string, Env, Env);
@@ -204,6 +309,8 @@ class ModulusExp : public OperatorExp {
 
         Type* typeOf(Tenv);
         
+        Imm op(Imm, Imm);
+
         Exp clone() { return new ModulusExp(left->clone(), right->clone()); }
         std::string toString();
 };
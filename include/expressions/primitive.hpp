@@ -11,7 +11,12 @@
 
 class PrimitiveExp : public Expression {
     public:
+        PrimitiveExp(exp_kind k) : Expression(k) {}
+
         Exp optimize();
+        void compile(Bytecode*);
+
+        bool postprocessor(Scope*) { return true; }
 };
 
 /**
@@ -19,11 +24,13 @@ class PrimitiveExp : public Expression {
  */
 class AdtExp : public Expression {
     private:
-        std::string name, kind;
+        Symbol name, kind;
         Exp *args;
     public:
-        AdtExp(std::string n, std::string k, Exp *xs)
-        : name(n), kind(k), args(xs) {}
+        static const exp_kind KIND = EXP_ADT;
+
+        AdtExp(Symbol n, Symbol k, Exp *xs)
+        : Expression(KIND), name(n), kind(k), args(xs) {}
         ~AdtExp() {
             for (int i = 0; args[i]; i++)
                 delete args[i];
@@ -37,7 +44,7 @@ class AdtExp : public Expression {
         Exp clone();
         std::string toString();
 
-        bool postprocessor(HashMap<std::string,bool> *vars);
+        bool postprocessor(Scope *vars);
 };
 
 /**
@@ -48,8 +55,10 @@ class DictExp : public Expression {
         LinkedList<std::string> *keys;
         LinkedList<Exp> *vals;
     public:
-        DictExp() : keys(new LinkedList<std::string>), vals(new LinkedList<Exp>) {}
-        DictExp(LinkedList<std::string> *ks, LinkedList<Exp> *vs) : keys(ks), vals(vs) {}
+        static const exp_kind KIND = EXP_DICT;
+
+        DictExp() : Expression(KIND), keys(new LinkedList<std::string>), vals(new LinkedList<Exp>) {}
+        DictExp(LinkedList<std::string> *ks, LinkedList<Exp> *vs) : Expression(KIND), keys(ks), vals(vs) {}
         DictExp(std::initializer_list<std::pair<std::string, Exp>>);
         
         ~DictExp() {
@@ -65,7 +74,7 @@ class DictExp : public Expression {
         Exp clone();
         std::string toString();
 
-        bool postprocessor(HashMap<std::string,bool> *vars) {
+        bool postprocessor(Scope *vars) {
             auto it = vals->iterator();
             auto res = true;
             while (res && it->hasNext())
@@ -82,8 +91,11 @@ class DictExp : public Expression {
  */
 class FalseExp : public PrimitiveExp {
     public:
-        FalseExp() {}
+        static const exp_kind KIND = EXP_FALSE;
+
+        FalseExp() : PrimitiveExp(KIND) {}
         Val evaluate(Env);
+        Imm evaluate_imm(Env) { return Imm(false); }
         Type* typeOf(Tenv tenv);
         
         Exp clone() { return new FalseExp(); }
@@ -92,20 +104,30 @@ class FalseExp : public PrimitiveExp {
 };
 
 /**
- * Denotes a member of the set of 32 bit unsigned integers.
+ * Denotes an integer (see integer_t).
  */
 class IntExp : public PrimitiveExp {
     private:
-        int val;
+        integer_t val;
+
+        // The value of the literal, which every evaluation shares
+        IntVal *value;
+
+        IntExp(integer_t v, IntVal *x) : PrimitiveExp(KIND), val(v), value(x) { x->add_ref(); }
     public:
-        IntExp(int = 0);
-        Val evaluate(Env);
+        static const exp_kind KIND = EXP_INT;
+
+        IntExp(integer_t = 0);
+        ~IntExp() { value->rem_ref(); }
+
+        Val evaluate(Env) { value->add_ref(); return value; }
+        Imm evaluate_imm(Env) { return Imm(val); }
         Type* typeOf(Tenv tenv);
         Val derivativeOf(std::string, Env, Env);
 
-        int get() { return val; }
+        integer_t get() { return val; }
         
-        Exp clone() { return new IntExp(val); }
+        Exp clone() { return new IntExp(val, value); }
         std::string toString();
 };
 
@@ -114,21 +136,38 @@ class IntExp : public PrimitiveExp {
  */
 class LambdaExp : public Expression {
     private:
-        std::string *xs;
+        Symbol *xs;
         Exp exp;
+
+        // The name that the lambda is recursively bound to, if any
+        std::string name;
+        // Whether or not applications of the lambda may be memoized, and
+        // the number of slots in its frame, as determined by the
+        // postprocessor.
+        bool memo = false;
+        int frame = 0;
+
+        // The free variables of the lambda, and whether or not its
+        // closures may capture only them rather than their environment.
+        std::vector<Capture> captures;
+        bool flat = false;
     public:
-        LambdaExp(std::string*, Exp);
+        static const exp_kind KIND = EXP_LAMBDA;
+
+        LambdaExp(Symbol*, Exp);
         ~LambdaExp() { delete[] xs; delete exp; }
         Val evaluate(Env);
         Val derivativeOf(std::string, Env, Env);
         Type* typeOf(Tenv);
 
-        std::string *getXs() { return xs; }
+        Symbol *getXs() { return xs; }
+
+        void setName(std::string x) { name = x; }
         
         Exp clone();
         std::string toString();
 
-        bool postprocessor(HashMap<std::string,bool> *vars);
+        bool postprocessor(Scope *vars);
 
         Exp optimize() { exp = exp->optimize(); return this; }
 };
@@ -138,6 +177,8 @@ class LambdaExp : public Expression {
  */
 class ListExp : public Expression, public ArrayList<Exp> {
     public:
+        static const exp_kind KIND = EXP_LIST;
+
         ListExp();
         ListExp(Exp*);
         ListExp(List<Exp>* l);
@@ -151,7 +192,7 @@ class ListExp : public Expression, public ArrayList<Exp> {
         Exp clone();
         std::string toString();
 
-        bool postprocessor(HashMap<std::string,bool> *vars) {
+        bool postprocessor(Scope *vars) {
             auto res = true;
             for (int i = 0; i < size(); i++) {
                 res = get(i)->postprocessor(vars);
@@ -163,18 +204,28 @@ class ListExp : public Expression, public ArrayList<Exp> {
 };
 
 /**
- * Expression that represents a 32-bit floating point real number.
+ * Expression that represents a real number (see real_t).
  */
 class RealExp : public PrimitiveExp {
     private:
-        float val;
+        real_t val;
+
+        // The value of the literal, which every evaluation shares
+        RealVal *value;
+
+        RealExp(real_t v, RealVal *x) : PrimitiveExp(KIND), val(v), value(x) { x->add_ref(); }
     public:
-        RealExp(float = 0);
-        Val evaluate(Env);
+        static const exp_kind KIND = EXP_REAL;
+
+        RealExp(real_t = 0);
+        ~RealExp() { value->rem_ref(); }
+
+        Val evaluate(Env) { value->add_ref(); return value; }
+        Imm evaluate_imm(Env) { return Imm(val); }
         Type* typeOf(Tenv tenv);
         Val derivativeOf(std::string, Env, Env);
         
-        Exp clone() { return new RealExp(val); }
+        Exp clone() { return new RealExp(val, value); }
         std::string toString();
 
 };
@@ -185,13 +236,21 @@ class RealExp : public PrimitiveExp {
 class StringExp : public PrimitiveExp {
     private:
         std::string val;
+
+        // The value of the literal, which every evaluation shares
+        StringVal *value;
+
+        StringExp(std::string v, StringVal *x) : PrimitiveExp(KIND), val(v), value(x) { x->add_ref(); }
     public:
-        StringExp(std::string s) : val(s) {}
+        static const exp_kind KIND = EXP_STRING;
 
-        Val evaluate(Env) { return new StringVal(val); }
+        StringExp(std::string s);
+        ~StringExp() { value->rem_ref(); }
+
+        Val evaluate(Env) { value->add_ref(); return value; }
         Type* typeOf(Tenv) { return new StringType; }
 
-        Exp clone() { return new StringExp(val); }
+        Exp clone() { return new StringExp(val, value); }
         std::string toString();
 
 };
@@ -201,8 +260,11 @@ class StringExp : public PrimitiveExp {
  */
 class TrueExp : public PrimitiveExp {
     public:
-        TrueExp() {}
+        static const exp_kind KIND = EXP_TRUE;
+
+        TrueExp() : PrimitiveExp(KIND) {}
         Val evaluate(Env);
+        Imm evaluate_imm(Env) { return Imm(true); }
         Type* typeOf(Tenv tenv);
         
         Exp clone() { return new TrueExp(); }
@@ -218,7 +280,9 @@ class TupleExp : public Expression {
         Exp left;
         Exp right;
     public:
-        TupleExp(Exp l, Exp r) : left(l), right(r) {}
+        static const exp_kind KIND = EXP_TUPLE;
+
+        TupleExp(Exp l, Exp r) : Expression(KIND), left(l), right(r) {}
         ~TupleExp() { delete left; delete right; }
 
         Val evaluate(Env);
@@ -228,7 +292,7 @@ class TupleExp : public Expression {
 
         Exp clone() { return new TupleExp(left->clone(), right->clone()); }
 
-        bool postprocessor(HashMap<std::string,bool> *vars) {
+        bool postprocessor(Scope *vars) {
             return left->postprocessor(vars) && right->postprocessor(vars);
         }
 
@@ -238,24 +302,41 @@ class TupleExp : public Expression {
 // Get the value of a variable
 class VarExp : public Expression {
     private:
-        std::string id;
+        Symbol id;
+
+        // The location of the variable, as resolved by the postprocessor
+        int depth;
+        int slot;
     public:
-        VarExp(std::string s) : id(s) {}
+        static const exp_kind KIND = EXP_VAR;
+
+        VarExp(Symbol s, int d = -1, int k = -1) : Expression(KIND), id(s), depth(d), slot(k) {}
 
         Val evaluate(Env env);
+        Imm evaluate_imm(Env env);
+        Imm evaluate_ref(Env env);
         Type* typeOf(Tenv tenv);
+
+        void compile(Bytecode*);
         
-        Exp clone() { return new VarExp(id); }
+        Exp clone() { return new VarExp(id, depth, slot); }
         std::string toString();
 
         Val derivativeOf(std::string, Env, Env);
 
-        bool postprocessor(HashMap<std::string,bool> *vars) {
-            if (vars->hasKey(id)) return true;
+        bool postprocessor(Scope *vars) {
+            if (vars->lookup(id, depth, slot)) {
+                vars->use(id);
+                return true;
+            }
             throw_err("", "undefined reference to variable " + id);
             return false;
         }
 
+        Symbol getId() { return id; }
+        int getDepth() { return depth; }
+        int getSlot() { return slot; }
+
         /**
          * Constant propagation will trivially replace the variable if
          * the variable name matches.
@@ -264,9 +345,11 @@ class VarExp : public Expression {
 
 class VoidExp : public PrimitiveExp {
     public:
-        VoidExp() {}
+        static const exp_kind KIND = EXP_VOID;
+
+        VoidExp() : PrimitiveExp(KIND) {}
 
-        Val evaluate(Env) { return new VoidVal; }
+        Val evaluate(Env) { return VoidVal::of(); }
         Type* typeOf(Tenv) { return new VoidType; }
 
         std::string toString() { return "void"; }
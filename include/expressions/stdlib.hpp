@@ -8,11 +8,14 @@ class PrintExp : public Expression {
     private:
         Exp *args;
     public:
-        PrintExp(Exp *l) : args(l) {}
+        static const exp_kind KIND = EXP_PRINT;
+
+        PrintExp(Exp *l) : Expression(KIND), args(l) {}
         ~PrintExp() { for (int i = 0; args[i]; i++) delete args[i]; delete[] args; }
 
         Val evaluate(Env);
         Type* typeOf(Tenv);
+        bool postprocessor(Scope *vars);
 
         Exp clone();
         std::string toString();
@@ -25,6 +28,8 @@ class PrintExp : public Expression {
  */
 class StdMathExp : public Expression {
     public:
+        static const exp_kind KIND = EXP_STD_MATH;
+
         enum MathFn {
             // Trig
             SIN, COS, TAN,
@@ -42,7 +47,7 @@ class StdMathExp : public Expression {
         MathFn fn;
     public:
         
-        StdMathExp(MathFn f, Exp x) : e(x), fn(f) {}
+        StdMathExp(MathFn f, Exp x) : Expression(KIND), e(x), fn(f) {}
         ~StdMathExp() { delete e; }
 
         Val evaluate(Env);
@@ -50,6 +55,7 @@ class StdMathExp : public Expression {
         Exp symb_diff(std::string);
 
         Type* typeOf(Tenv);
+        bool postprocessor(Scope *vars) { return e->postprocessor(vars); }
         
         Exp clone() { return new StdMathExp(fn, e->clone()); }
         std::string toString();
@@ -70,7 +76,9 @@ class ImplementExp : public Expression {
         Type *type;
         std::string name = "";
     public:
-        ImplementExp(Val (*fn)(Env), Type *t = NULL) : f(fn), type(t) {}
+        static const exp_kind KIND = EXP_IMPLEMENT;
+
+        ImplementExp(Val (*fn)(Env), Type *t = NULL) : Expression(KIND), f(fn), type(t) {}
 
         Exp clone() {
             return (new ImplementExp(f, type ? type->clone() : NULL))
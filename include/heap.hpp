@@ -0,0 +1,92 @@
+#ifndef _HEAP_HPP_
+#define _HEAP_HPP_
+
+#include "config.hpp"
+
+#include <cstddef>
+#include <string>
+
+/**
+ * The kinds of objects whose memory is accounted for. Values come first,
+ * in the same order as their kinds (see value_kind).
+ */
+enum heap_kind {
+    HEAP_ADT, HEAP_BOOL, HEAP_DICT, HEAP_INT, HEAP_LAMBDA, HEAP_LIST,
+    HEAP_REAL, HEAP_STRING, HEAP_THUNK, HEAP_TUPLE, HEAP_VOID,
+    HEAP_ENV, // Environments
+    HEAP_EXP, // Nodes of syntax trees
+    HEAP_KINDS
+};
+
+/**
+ * The number of live objects of a kind, and the bytes that they occupy,
+ * including any storage that they manage, such as the elements of a list.
+ */
+struct heap_usage {
+    long objects = 0;
+    long bytes = 0;
+};
+
+extern heap_usage heap_kinds[HEAP_KINDS];
+extern long heap_bytes;
+extern long heap_peak;
+
+/**
+ * Records the creation of an object.
+ * @param k The kind of the object.
+ * @param n The size of the object.
+ */
+inline void heap_alloc(heap_kind k, std::size_t n) {
+    heap_kinds[k].objects++;
+    heap_kinds[k].bytes += n;
+    if ((heap_bytes += n) > heap_peak)
+        heap_peak = heap_bytes;
+}
+
+/**
+ * Records the destruction of an object.
+ * @param k The kind of the object.
+ * @param n The size of the object.
+ */
+inline void heap_free(heap_kind k, std::size_t n) {
+    heap_kinds[k].objects--;
+    heap_kinds[k].bytes -= n;
+    heap_bytes -= n;
+}
+
+/**
+ * Records a change in the storage that objects of a kind manage, such as
+ * the elements of a list or the characters of a string.
+ * @param k The kind of the objects.
+ * @param n The number of bytes gained, or lost if negative.
+ */
+inline void heap_resize(heap_kind k, long n) {
+    heap_kinds[k].bytes += n;
+    if ((heap_bytes += n) > heap_peak)
+        heap_peak = heap_bytes;
+}
+
+/**
+ * Reports that live objects occupy more memory than is permitted.
+ */
+void heap_error();
+
+/**
+ * Determines whether or not live objects occupy more memory than the
+ * configuration permits (see config::max_heap), reporting an error if
+ * they do. Evaluation fails once the limit is exceeded.
+ * @return Whether or not the limit is exceeded.
+ */
+inline bool heap_exceeded() {
+    if (!configuration.max_heap || heap_bytes <= configuration.max_heap)
+        return false;
+    heap_error();
+    return true;
+}
+
+/**
+ * @return A summary of the live objects of each kind.
+ */
+std::string heap_stats();
+
+#endif
@@ -26,4 +26,103 @@ inline Val unpack_thunk(Val v) {
     return v;
 }
 
+/**
+ * Makes the calls that tail positions have deferred, in constant stack
+ * space, until a result is found.
+ * @param x The result of evaluating an expression in tail position.
+ * @return The final result, which is not a deferred call.
+ */
+Imm resolve_tail(Imm x);
+
+/**
+ * Determines whether or not the native stack is nearly exhausted by the
+ * calls that the tree walker has nested, reporting an error if it is.
+ * Calls fail once it is, rather than overflowing the stack.
+ * @return Whether or not the stack is exhausted.
+ */
+bool stack_exceeded();
+
+/**
+ * Places an immediate on the heap.
+ * @param x An immediate, whose reference is transferred to the result.
+ * @return The value of the immediate, or NULL on failure.
+ */
+inline Val box(Imm x) {
+    switch (x.kind) {
+        case Imm::INT: return IntVal::of(x.i);
+        case Imm::REAL: return new RealVal(x.r);
+        case Imm::BOOL: return BoolVal::of(x.b);
+        case Imm::BOXED:
+            if (x.borrowed) x.v->add_ref();
+            return x.v;
+        default: return NULL;
+    }
+}
+
+/**
+ * Converts a value to an immediate, unpacking it if it is a thunk.
+ * @param v Some value, whose reference is transferred to the result.
+ * @return An immediate that holds a number or boolean directly if possible.
+ */
+inline Imm unbox(Val v) {
+    v = unpack_thunk(v);
+
+    if (!v) return Imm();
+
+    Imm x;
+    switch (v->kind) {
+        case VAL_INT: x = Imm(((IntVal*) v)->get()); break;
+        case VAL_REAL: x = Imm(((RealVal*) v)->get()); break;
+        case VAL_BOOL: x = Imm(((BoolVal*) v)->get()); break;
+        default: return Imm(v);
+    }
+
+    v->rem_ref();
+    return x;
+}
+inline Imm unbox(Imm x) {
+    // Borrowed values are never numbers or thunks
+    return x.kind == Imm::BOXED && !x.borrowed ? unbox(x.v) : x;
+}
+
+/**
+ * Converts an operand to an immediate, as unbox does, while another
+ * operand is held. Forcing a thunk may have side effects, so a borrowed
+ * reference to the held operand is taken over before a thunk is unpacked.
+ * @param x The operand, whose reference is transferred to the result.
+ * @param held The operand that was evaluated before it.
+ */
+inline Imm unbox(Imm x, Imm &held) {
+    if (x.kind == Imm::BOXED && held.borrowed && isVal<Thunk>(x.v)) {
+        held.v->add_ref();
+        held.borrowed = false;
+    }
+    return unbox(x);
+}
+
+/**
+ * Drops the reference held by an immediate, if any.
+ */
+inline void release(Imm x) {
+    if (x.kind == Imm::BOXED && !x.borrowed) x.v->rem_ref();
+}
+
+/**
+ * Stores an immediate into a value of the same kind, in place.
+ * @param v A value that no one else holds a reference to.
+ * @param x The immediate to store.
+ * @return Whether or not the value could be overwritten.
+ */
+inline bool assign(Val v, Imm x) {
+    if (x.kind == Imm::INT && isVal<IntVal>(v))
+        ((IntVal*) v)->assign(x.i);
+    else if (x.kind == Imm::REAL && isVal<RealVal>(v))
+        ((RealVal*) v)->assign(x.r);
+    else if (x.kind == Imm::BOOL && isVal<BoolVal>(v))
+        ((BoolVal*) v)->assign(x.b);
+    else
+        return false;
+    return true;
+}
+
 #endif
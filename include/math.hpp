@@ -35,9 +35,11 @@ Val pow(Val, Val);
 /**
  * Determines whether or not a given value is a matrix.
  * @param v The value to check
- * @return The dimensions if a matrix, NULL otherwise.
+ * @param rows Set to the number of rows of a matrix.
+ * @param cols Set to the number of columns of a matrix.
+ * @return Whether or not the value is a matrix.
  */
-int* is_matrix(Val v);
+bool is_matrix(Val v, int &rows, int &cols);
 
 int is_square_matrix(Val v);
 
@@ -48,6 +50,37 @@ int is_square_matrix(Val v);
  */
 int is_vector(Val v);
 
+/**
+ * Copies the numbers of a matrix into rows of reals.
+ * @param list A matrix of numbers (see is_matrix).
+ * @param cols The length of each row, which may leave zeroed room after
+ *              the columns of the matrix.
+ * @return The rows, each of which is an array of the given length.
+ */
+real_t** extract_matrix(ListVal *list, int cols);
+
+/**
+ * Adds or subtracts two tensors of numbers of the same shape, on their
+ * numbers directly (see Tensor::of).
+ * @param a The left hand list.
+ * @param b The right hand list.
+ * @return The result, or NULL if the lists are not such tensors, in which
+ *          case nothing is reported.
+ */
+Val tensor_add(ListVal *a, ListVal *b);
+Val tensor_sub(ListVal *a, ListVal *b);
+
+/**
+ * Multiplies an m by k matrix with a k by n matrix, both stored by rows,
+ * summing the products for each entry in order, as repeated addition
+ * would. The kernel is blocked for the cache and vectorized for the
+ * extensions that the processor supports.
+ * @param zero Whether the sums start from zero, as they do in a dot
+ *             product, or from the first product.
+ */
+void gemm(const integer_t *a, const integer_t *b, integer_t *c, int m, int k, int n, bool zero);
+void gemm(const real_t *a, const real_t *b, real_t *c, int m, int k, int n, bool zero);
+
 /**
  * Computes the sum of two values.
  * @param a The left hand value.
@@ -0,0 +1,23 @@
+#ifndef _PARALLEL_HPP_
+#define _PARALLEL_HPP_
+
+#include <functional>
+
+/**
+ * Divides the indices [0, n) into ranges, one for each thread that the
+ * configuration permits (see config::threads), and calls a function on
+ * each range from a shared pool of threads, waiting until every call has
+ * returned. Small jobs are run on the calling thread alone.
+ *
+ * Each index belongs to exactly one range, so a function that computes
+ * its results index by index gives the same results however many threads
+ * there are. The function must not create or release values, since the
+ * heap is not shared safely between threads.
+ *
+ * @param n The number of indices.
+ * @param grain The fewest indices that are worth giving to a thread.
+ * @param f The function, which is called with each range [i, j).
+ */
+void parallel_for(int n, int grain, const std::function<void(int, int)> &f);
+
+#endif
@@ -140,6 +140,22 @@ inline T* store_in_list(std::list<T> vals, T null) {
     return lst;
 }
 
+/**
+ * Interns a list of identifiers.
+ * @param ids The identifiers.
+ * @return A plain list of symbols followed by the empty symbol.
+ */
+inline Symbol* store_in_symbols(std::list<std::string> ids) {
+    Symbol *lst = new Symbol[ids.size()+1];
+
+    int i = 0;
+    for (auto it = ids.begin(); it != ids.end(); it++, i++) {
+        lst[i] = *it;
+    }
+
+    return lst;
+}
+
 /**
  * Frees all of the elements in a list.
  * @param vals A list of freeable values.
@@ -0,0 +1,64 @@
+#ifndef _POOL_HPP_
+#define _POOL_HPP_
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Allocates memory for a small object. Objects are grouped into size
+ * classes, each of which keeps a free list of blocks carved out of large
+ * slabs. Larger objects are given to the general-purpose allocator.
+ *
+ * @param n The number of bytes to allocate.
+ *
+ * @return The memory, which must be released by pool_free.
+ */
+void* pool_alloc(std::size_t n);
+
+/**
+ * Releases memory allocated by pool_alloc.
+ *
+ * @param p The memory to release.
+ * @param n The number of bytes that were requested.
+ */
+void pool_free(void *p, std::size_t n);
+
+/**
+ * Mixin for classes whose instances are allocated from the pool. Such
+ * classes are expected to be created and destroyed at high rates.
+ */
+class Pooled {
+    public:
+        static void* operator new(std::size_t n) { return pool_alloc(n); }
+        static void operator delete(void *p, std::size_t n) { pool_free(p, n); }
+};
+
+struct PoolHeap;
+
+/**
+ * An arena for the short-lived objects of an evaluation. While an arena
+ * exists, pooled objects are allocated from slabs of its own. When it is
+ * destroyed, the slabs that no longer hold any objects are returned to
+ * the system, and the rest are handed over to the shared pool. Arenas
+ * may be nested, in which case the innermost one is used.
+ */
+class PoolArena {
+    private:
+        PoolHeap *heap;
+        PoolHeap *prev;
+    public:
+        PoolArena();
+        ~PoolArena();
+};
+
+/**
+ * @return The number of bytes that the pool has ever allocated.
+ */
+unsigned long pool_allocated();
+
+/**
+ * @return A summary of the allocations made by the pool so far.
+ */
+std::string pool_stats();
+
+#endif
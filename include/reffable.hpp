@@ -3,17 +3,54 @@
 
 #include "config.hpp"
 
+#include <string>
+
+class Reffable;
+
+/**
+ * Called on each object that another refers to (see Reffable::trace).
+ * @param x The object that is referred to.
+ * @param counted Whether or not the reference is counted by x itself,
+ *                rather than implied by the references to the holder.
+ */
+typedef void (*ref_visitor)(Reffable *x, bool counted);
+
 /**
  * A custom implementation of a unique pointer scheme that will handle
  * garbage collection as long as it is handled correctly.
+ *
+ * Reference counting cannot free objects that refer to each other, such
+ * as a recursive function and the environment that binds it. Objects that
+ * hold references are therefore tracked by a cycle collector, which runs
+ * at safe points of the program (see collect_cycles).
  */
 class Reffable {
     private:
         // Initially, the object will be unique.
         int refs = 1;
 
+        // The state of the object in the cycle collector, and its index in
+        // the buffer of candidate roots, if any.
+        unsigned char color = 0;
+        int root = -1;
+
+        // Whether the object is a constant (see freeze)
+        bool frozen = false;
+
+        friend class CycleCollector;
+    protected:
+        // Whether or not the object may hold references to others, and so
+        // may be part of a cycle.
+        bool traced = false;
+
+        /**
+         * Adjusts the reference count of the object, along with those of
+         * any objects that count references to it as their own.
+         * @param d The change in the number of references.
+         */
+        virtual void shift(int d) { refs += d; }
     public:
-        virtual ~Reffable() {}
+        virtual ~Reffable();
 
         /**
          * Increments the reference count of the object.
@@ -31,6 +68,54 @@ class Reffable {
          * will be automatically garbage collected.
          */
         virtual void rem_ref();
+
+        /**
+         * Determines whether or not the holder of a reference is the only
+         * one, in which case it may modify the object in place.
+         */
+        bool is_unique() { return refs == 1 && !frozen; }
+
+        /**
+         * Marks the object as a constant, which may be shared by any number
+         * of holders and is never modified in place.
+         */
+        void freeze() { frozen = true; }
+        bool is_frozen() { return frozen; }
+
+        /**
+         * Visits each object that the object holds a reference to.
+         * @param f The visitor.
+         */
+        virtual void trace(ref_visitor f) { (void) f; }
+
+        /**
+         * Drops every reference that the object holds, as is done to free
+         * a cycle of garbage.
+         */
+        virtual void clear_refs() {}
 };
 
+/**
+ * Frees the cycles of objects that are no longer reachable, by trial
+ * deletion over the objects whose reference counts have dropped without
+ * reaching zero. Objects must only be referred to by counted references
+ * or by objects that trace them when it is called.
+ */
+void collect_cycles();
+
+/**
+ * Collects cycles if enough memory has been allocated since the last
+ * collection, or if the heap limit has been exceeded. It is called where
+ * the program holds no uncounted references, such as between the
+ * iterations of a loop.
+ * @return Whether or not the program may continue, which it may not if
+ *          the heap limit is still exceeded (see heap_exceeded).
+ */
+bool gc_safepoint();
+
+/**
+ * @return A summary of the work done by the cycle collector so far.
+ */
+std::string gc_stats();
+
 #endif
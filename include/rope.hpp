@@ -0,0 +1,83 @@
+#ifndef _ROPE_HPP_
+#define _ROPE_HPP_
+
+#include "baselang/value.hpp"
+#include "pool.hpp"
+
+#include <vector>
+
+/**
+ * A node of a persistent sequence of values. Leaves hold short runs of
+ * values, and branches join two sequences, balanced by height as in an AVL
+ * tree. Nodes are never modified once they are built, so a sequence that
+ * is sliced from, joined with or modified from another shares most of its
+ * nodes with it.
+ *
+ * Each node holds a reference to its children, and each leaf to its
+ * values. The functions below never take ownership of their arguments, and
+ * give back a new reference to their result.
+ */
+class RopeNode : public Reffable, public Pooled {
+    public:
+        // The number of values in the sequence, and the height of the tree
+        int size;
+        int height;
+
+        // The children of a branch, or the values of a leaf
+        RopeNode *left = NULL;
+        RopeNode *right = NULL;
+        std::vector<Val> xs;
+
+        /**
+         * Creates a branch, which takes over the references to its
+         * children.
+         */
+        RopeNode(RopeNode *l, RopeNode *r);
+
+        /**
+         * Creates a leaf, which adds a reference to each of its values.
+         */
+        RopeNode(const Val *vs, int n);
+        ~RopeNode();
+
+        bool is_leaf() { return height == 0; }
+
+        void trace(ref_visitor);
+        void clear_refs();
+};
+
+/**
+ * Builds a balanced sequence from an array.
+ * @param vs The values.
+ * @param n The number of values.
+ * @return The sequence, or NULL if it is empty.
+ */
+RopeNode* rope_build(const Val *vs, int n);
+
+/**
+ * Appends the values of a sequence to a vector, adding a reference to each.
+ */
+void rope_flatten(RopeNode *t, std::vector<Val>& out);
+
+Val rope_get(RopeNode *t, int idx);
+RopeNode* rope_set(RopeNode *t, int idx, Val v);
+RopeNode* rope_insert(RopeNode *t, int idx, Val v);
+
+/**
+ * @return The sequence without the value at the given index, or NULL if
+ *          it is empty.
+ */
+RopeNode* rope_remove(RopeNode *t, int idx);
+
+/**
+ * Joins two sequences, either of which may be NULL.
+ */
+RopeNode* rope_concat(RopeNode *a, RopeNode *b);
+
+/**
+ * @return The values at indices [i, j) of a sequence, or NULL if there
+ *          are none.
+ */
+RopeNode* rope_slice(RopeNode *t, int i, int j);
+
+#endif
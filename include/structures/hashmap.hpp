@@ -69,6 +69,11 @@ class HashMap : public Map<K, V> {
 
         int size() { return N; }
 
+        /**
+         * @return The size of the table, in bytes.
+         */
+        std::size_t bytes() { return arrlen * sizeof(slot); }
+
         Iterator<std::string> *iterator() { return new Miterator(this); }
 };
 
@@ -137,6 +142,7 @@ inline void HashMap<K,V>::add(K key, V val) {
         // The table must be expanded. We expand by the Golden Ratio
         // because this will allow the freed block to be reused should
         // another realloc attempt to use it.
+        int oldlen = arrlen;
         slot *newarr = new slot[(arrlen *= 2)];
         for (int i = 0; i < arrlen; i++) newarr[i].filled = false;
         
@@ -144,9 +150,11 @@ inline void HashMap<K,V>::add(K key, V val) {
         slot *tmp = arr;
         arr = newarr;
         
-        // Move all of the blocks over
-        for (int i = 0; i < N; i++) {
-            add(tmp[i].key, tmp[i].val);
+        // Move all of the blocks over, counting them again as they go.
+        N = 0;
+        for (int i = 0; i < oldlen; i++) {
+            if (tmp[i].filled)
+                add(tmp[i].key, tmp[i].val);
         }
         
         // Use the new array.
@@ -182,8 +190,10 @@ inline void HashMap<K,V>::set(K key, V val) {
         if (idx >= arrlen) idx = 0;
         
         // If we found the slot, return.
-        if (arr[idx].filled && arr[idx].key == key)
+        if (arr[idx].filled && arr[idx].key == key) {
             arr[idx].val = val;
+            return;
+        }
     }
     
     // The element does not exist.
@@ -0,0 +1,65 @@
+#ifndef _SYMBOL_HPP_
+#define _SYMBOL_HPP_
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <utility>
+
+/**
+ * An interned string, such as the name of a variable or the key of a
+ * dictionary. Every symbol with the same text refers to the same copy of
+ * it, which lives for the rest of the program, so symbols are compared by
+ * address rather than by their contents. The hash of the text is computed
+ * once, when it is interned.
+ */
+class Symbol {
+    private:
+        const std::pair<const std::string, std::size_t> *entry;
+    public:
+        /**
+         * Creates the empty symbol.
+         */
+        Symbol();
+
+        /**
+         * Interns a string.
+         */
+        Symbol(const std::string &s);
+        Symbol(const char *s);
+
+        const std::string& str() const { return entry->first; }
+        operator const std::string&() const { return entry->first; }
+
+        bool empty() const { return entry->first.empty(); }
+        std::size_t length() const { return entry->first.length(); }
+
+        friend bool operator==(const Symbol &a, const Symbol &b) { return a.entry == b.entry; }
+        friend bool operator!=(const Symbol &a, const Symbol &b) { return a.entry != b.entry; }
+
+        // Comparisons to text that is not interned compare the contents
+        friend bool operator==(const Symbol &a, const char *b) { return a.entry->first == b; }
+        friend bool operator!=(const Symbol &a, const char *b) { return a.entry->first != b; }
+        friend bool operator==(const char *a, const Symbol &b) { return a == b.entry->first; }
+        friend bool operator!=(const char *a, const Symbol &b) { return a != b.entry->first; }
+        friend bool operator==(const Symbol &a, const std::string &b) { return a.entry->first == b; }
+        friend bool operator!=(const Symbol &a, const std::string &b) { return a.entry->first != b; }
+        friend bool operator==(const std::string &a, const Symbol &b) { return a == b.entry->first; }
+        friend bool operator!=(const std::string &a, const Symbol &b) { return a != b.entry->first; }
+
+        std::size_t hash() const { return entry->second; }
+};
+
+inline std::string operator+(const std::string &a, const Symbol &b) { return a + b.str(); }
+inline std::string operator+(const Symbol &a, const std::string &b) { return a.str() + b; }
+inline std::string operator+(const char *a, const Symbol &b) { return a + b.str(); }
+inline std::string operator+(const Symbol &a, const char *b) { return a.str() + b; }
+
+namespace std {
+    template<>
+    struct hash<Symbol> {
+        size_t operator()(const Symbol &s) const { return s.hash(); }
+    };
+}
+
+#endif
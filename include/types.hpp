@@ -7,9 +7,15 @@
 #include <initializer_list>
 #include <utility>
 
+/**
+ * Determines whether or not a type is of a given class.
+ * @param t The type, which may be NULL.
+ * @return Whether or not the kind of the type is T::KIND, or any of the
+ *         kinds of T's subclasses.
+ */
 template<typename T>
 inline bool isType(const Type* t) {
-    return t && dynamic_cast<const T*>(t) != nullptr;
+    return t && t->kind == T::KIND;
 }
 
 inline bool val_is_integer(Val v) {
@@ -19,7 +25,7 @@ inline bool val_is_real(Val v) {
     return isVal<RealVal>(v);
 }
 inline bool val_is_number(Val v) {
-    return val_is_integer(v) || val_is_real(v);
+    return v && (v->kind == VAL_INT || v->kind == VAL_REAL);
 }
 
 
@@ -61,10 +67,12 @@ class AlgebraicDataType : public Type {
         // The composite types of each ADT
         Type* **argss;
     public:
+        static const type_kind KIND = TYPE_ADT;
+
         AlgebraicDataType(std::string nm, std::string *ks, Type ***vs)
-        : name(nm), kinds(ks), argss(vs) {}
+        : Type(KIND), name(nm), kinds(ks), argss(vs) {}
         AlgebraicDataType(std::string nm)
-        : name(nm), kinds(NULL), argss(NULL) {}
+        : Type(KIND), name(nm), kinds(NULL), argss(NULL) {}
         ~AlgebraicDataType();
         
         // Getters
@@ -92,7 +100,7 @@ class PairType : public Type {
         Type *left;
         Type *right;
     public:
-        PairType(Type *a, Type *b) : left(a), right(b) {}
+        PairType(type_kind k, Type *a, Type *b) : Type(k), left(a), right(b) {}
         ~PairType() { delete left; delete right; }
 
         Type* getLeft() { return left; }
@@ -110,8 +118,10 @@ class LambdaType : public PairType {
     private:
         std::string id;
     public:
+        static const type_kind KIND = TYPE_LAMBDA;
+
         LambdaType(std::string s, Type *a, Type *b)
-            : PairType(a,b), id(s) {}
+            : PairType(KIND, a, b), id(s) {}
         LambdaType(Type *a, Type *b) : LambdaType("", a, b) {}
 
         Type* clone() { return new LambdaType(id, left->clone(), right->clone()); }
@@ -132,7 +142,9 @@ class ListType : public Type {
     private:
         Type *type;
     public:
-        ListType(Type *t) : type(t) {}
+        static const type_kind KIND = TYPE_LIST;
+
+        ListType(Type *t) : Type(KIND), type(t) {}
         ~ListType() { delete type; }
         Type* clone() { return new ListType(type->clone()); }
         Type* subtype() { return type; }
@@ -153,7 +165,9 @@ class ListType : public Type {
  */
 class TupleType : public PairType {
     public:
-        using PairType::PairType;
+        static const type_kind KIND = TYPE_TUPLE;
+
+        TupleType(Type *a, Type *b) : PairType(KIND, a, b) {}
 
         Type* clone() { return new TupleType(left->clone(), right->clone()); }
         Type* unify(Type*, Tenv);
@@ -169,7 +183,9 @@ class TupleType : public PairType {
  */
 class SumType : public PairType {
     public:
-        using PairType::PairType;
+        static const type_kind KIND = TYPE_SUM;
+
+        SumType(Type *a, Type *b) : PairType(KIND, a, b) {}
         Type* clone() { return new SumType(left->clone(), right->clone()); }
         Type* unify(Type*, Tenv);
         Type* simplify(Tenv tenv);
@@ -184,7 +200,9 @@ class SumType : public PairType {
  */
 class MultType : public PairType {
     public:
-        using PairType::PairType;
+        static const type_kind KIND = TYPE_MULT;
+
+        MultType(Type *a, Type *b) : PairType(KIND, a, b) {}
         Type* clone() { return new MultType(left->clone(), right->clone()); }
         Type* unify(Type*, Tenv);
         Type* simplify(Tenv tenv);
@@ -199,7 +217,9 @@ class MultType : public PairType {
  */
 class DerivativeType : public PairType {
     public:
-        using PairType::PairType;
+        static const type_kind KIND = TYPE_DERIVATIVE;
+
+        DerivativeType(Type *a, Type *b) : PairType(KIND, a, b) {}
         Type* clone() { return new DerivativeType(left->clone(), right->clone()); }
         Type* unify(Type*, Tenv);
         Type* simplify(Tenv);
@@ -209,16 +229,32 @@ class DerivativeType : public PairType {
 };
 
 // Primitive types
-class PrimitiveType : public Type {};
+class PrimitiveType : public Type {
+    public:
+        PrimitiveType(type_kind k) : Type(k) {}
+};
+template<>
+inline bool isType<PrimitiveType>(const Type* t) {
+    return t && t->kind >= TYPE_BOOL && t->kind <= TYPE_INT;
+}
+
 class BoolType : public PrimitiveType {
     public:
+        static const type_kind KIND = TYPE_BOOL;
+
+        BoolType() : PrimitiveType(KIND) {}
         Type* clone() { return new BoolType; }
         Type* unify(Type*, Tenv);
         bool equals(Type*, Tenv);
         std::string toString() { return "B"; }
 };
 class RealType : public PrimitiveType {
+    protected:
+        RealType(type_kind k) : PrimitiveType(k) {}
     public:
+        static const type_kind KIND = TYPE_REAL;
+
+        RealType() : PrimitiveType(KIND) {}
         virtual Type* clone() { return new RealType; }
         virtual Type* unify(Type*, Tenv);
         bool equals(Type*, Tenv);
@@ -226,13 +262,26 @@ class RealType : public PrimitiveType {
 };
 class IntType : public RealType {
     public:
+        static const type_kind KIND = TYPE_INT;
+
+        IntType() : RealType(KIND) {}
         Type* clone() { return new IntType; }
         Type* unify(Type*, Tenv);
         bool equals(Type*, Tenv);
         std::string toString() { return "Z"; }
 };
+
+// Integers are also reals
+template<>
+inline bool isType<RealType>(const Type* t) {
+    return t && (t->kind == TYPE_REAL || t->kind == TYPE_INT);
+}
+
 class StringType : public PrimitiveType {
     public:
+        static const type_kind KIND = TYPE_STRING;
+
+        StringType() : PrimitiveType(KIND) {}
         Type* clone() { return new StringType; }
         Type* unify(Type*, Tenv);
         bool equals(Type*, Tenv);
@@ -240,7 +289,9 @@ class StringType : public PrimitiveType {
 };
 class VoidType : public PrimitiveType {
     public:
-        VoidType() {}
+        static const type_kind KIND = TYPE_VOID;
+
+        VoidType() : PrimitiveType(KIND) {}
         Type* clone() { return new VoidType; }
         Type* unify(Type*, Tenv);
         bool equals(Type*, Tenv);
@@ -252,8 +303,10 @@ class DictType : public Type {
     private:
         HashMap<std::string, Type*> *types;
     public:
-        DictType() { types = new HashMap<std::string, Type*>; }
-        DictType(HashMap<std::string, Type*> *ts) : types(ts) {}
+        static const type_kind KIND = TYPE_DICT;
+
+        DictType() : Type(KIND) { types = new HashMap<std::string, Type*>; }
+        DictType(HashMap<std::string, Type*> *ts) : Type(KIND), types(ts) {}
         DictType(std::initializer_list<std::pair<std::string, Type*>>);
         ~DictType() {
             auto it = types->iterator();
@@ -280,7 +333,9 @@ class VarType : public Type {
     private:
         std::string name;
     public:
-        VarType(std::string v) : name(v) {}
+        static const type_kind KIND = TYPE_VAR;
+
+        VarType(std::string v) : Type(KIND), name(v) {}
         Type* clone() { return new VarType(name); }
         Type* unify(Type*, Tenv);
         Type* simplify(Tenv tenv);
@@ -4,14 +4,27 @@
 #include "baselang/value.hpp"
 #include "baselang/expression.hpp"
 #include "baselang/environment.hpp"
+#include "pool.hpp"
+#include "rope.hpp"
+#include "symbol.hpp"
 
 #include "structures/hashmap.hpp"
 
+#include <unordered_map>
+#include <vector>
+
+class Bytecode;
+
 bool is_zero_val(Val e);
 
+/**
+ * Determines whether or not a value is of a given class.
+ * @param t The value, which may be NULL.
+ * @return Whether or not the kind of the value is T::KIND.
+ */
 template<typename T>
 inline bool isVal(const Val t) {
-    return t && dynamic_cast<const T*>(t) != nullptr;
+    return t && t->kind == T::KIND;
 }
 
 /**
@@ -20,20 +33,25 @@ inline bool isVal(const Val t) {
 class AdtVal : public Value {
     private:
         // Typing identifiers used to properly identify the ADT
-        std::string type; // The global type of ADT.
-        std::string kind; // The specific kind of ADT.
+        Symbol type; // The global type of ADT.
+        Symbol kind; // The specific kind of ADT.
 
         Val *args; // The parameters given to create the ADT.
     public:
-        AdtVal(std::string t, std::string k, Val *xs)
-        : type(t), kind(k), args(xs) {}
+        static const value_kind KIND = VAL_ADT;
+
+        AdtVal(Symbol t, Symbol k, Val *xs)
+        : Value(KIND), type(t), kind(k), args(xs) {}
         ~AdtVal();
 
+        void trace(ref_visitor);
+        void clear_refs();
+
         int set(Val);
 
         // Getters
-        std::string getType() { return type; }
-        std::string getKind() { return kind; }
+        Symbol getType() { return type; }
+        Symbol getKind() { return kind; }
         Val* getArgs() { return args; }
 
         std::string toString();
@@ -43,43 +61,168 @@ class AdtVal : public Value {
 /**
  * A boolean value.
  */
-class BoolVal : public Value {
+class BoolVal : public Value, public Pooled {
     private:
         bool val;
     public:
+        static const value_kind KIND = VAL_BOOL;
+
         BoolVal(bool = 0);
+
+        /**
+         * @return A new reference to the shared constant true or false.
+         */
+        static BoolVal* of(bool);
+
         bool get();
         std::string toString();
         BoolVal* clone() { return new BoolVal(val); }
         int set(Val);
+
+        // Overwrites the value in place; see Reffable::is_unique
+        void assign(bool b) { val = b; }
+};
+
+/**
+ * The entries of a dictionary, which are shared between copies of the
+ * dictionary until one of them is modified. The store holds a reference
+ * to each value.
+ */
+class DictStore : public Reffable {
+    public:
+        HashMap<Symbol, Val> map;
+
+        // The bytes of storage charged to the heap (see account)
+        long charged = 0;
+
+        DictStore() { traced = true; account(); }
+        ~DictStore();
+
+        /**
+         * Charges the storage of the entries to the heap, as it has
+         * grown or shrunk since it was last charged.
+         */
+        void account();
+
+        void trace(ref_visitor);
+        void clear_refs();
 };
 
 /**
  * Defines a dictionary of values.
  */
-class DictVal : public Value, public HashMap<std::string, Val> {
+class DictVal : public Value, public Map<Symbol, Val> {
+    private:
+        DictStore *store;
+
+        DictVal(DictStore *s) : Value(KIND), store(s) {}
+
+        /**
+         * Gives the dictionary a store of its own, so that it may be
+         * modified without affecting its copies.
+         */
+        void detach();
     public:
-        using HashMap::HashMap;
+        static const value_kind KIND = VAL_DICT;
+
+        DictVal() : Value(KIND), store(new DictStore) {}
         DictVal(std::initializer_list<std::pair<std::string, Val>>);
 
-        ~DictVal();
+        ~DictVal() { store->rem_ref(); }
+
+        void trace(ref_visitor f) { f(store, true); }
+        void clear_refs();
+
+        Val get(Symbol k) { return store->map.get(k); }
+        Val remove(Symbol k) { detach(); return store->map.remove(k); }
+
+        void add(Symbol k, Val v) { detach(); store->map.add(k, v); store->account(); }
+        void set(Symbol k, Val v) { detach(); store->map.set(k, v); store->account(); }
+
+        bool hasKey(Symbol k) { return store->map.hasKey(k); }
+        int size() { return store->map.size(); }
+
+        Iterator<std::string>* iterator() { return store->map.iterator(); }
 
+        /**
+         * Copies the dictionary in constant time, by sharing its store.
+         */
         DictVal* clone();
         int set(Val);
-        using HashMap::set;
 
         std::string toString();
 };
 
-class IntVal : public Value {
+class IntVal : public Value, public Pooled {
     private:
-        int val;
+        integer_t val;
     public:
-        IntVal(int = 0);
-        int get();
+        static const value_kind KIND = VAL_INT;
+
+        IntVal(integer_t = 0);
+
+        /**
+         * @return A new reference to a shared constant if the integer is
+         *          small, or else a new integer.
+         */
+        static IntVal* of(integer_t);
+
+        integer_t get();
         std::string toString();
         IntVal* clone() { return new IntVal(val); }
         int set(Val);
+
+        // Overwrites the value in place; see Reffable::is_unique
+        void assign(integer_t i) { val = i; }
+};
+
+// The most arguments that a memoized application may have
+#define MEMO_ARGS 4
+
+/**
+ * The arguments of a memoized application, as the kind and the raw bits of
+ * each of up to MEMO_ARGS numbers and booleans.
+ */
+struct MemoKey {
+    // Two bits for the kind of each argument, which are never both zero
+    unsigned kinds = 0;
+    uint64_t bits[MEMO_ARGS];
+
+    bool operator==(const MemoKey &k) const;
+    std::size_t hash() const;
+};
+
+/**
+ * The results of the memoized applications of a function. Each key has
+ * one slot that it may occupy, and a result displaces any other that
+ * occupies its slot, so that the cache never has to be emptied. The
+ * table grows as it fills, up to configuration.memo_size slots.
+ */
+class MemoCache {
+    private:
+        struct Entry {
+            MemoKey key;
+            Imm res;
+        };
+
+        Entry *slots;
+        std::size_t size;
+        std::size_t used = 0;
+
+        /**
+         * Doubles the number of slots, moving the results over.
+         */
+        void grow();
+    public:
+        // The number of lookups made, and how many of them were found
+        unsigned long lookups = 0;
+        unsigned long hits = 0;
+
+        MemoCache();
+        ~MemoCache() { delete[] slots; }
+
+        bool find(const MemoKey &key, Imm &res);
+        void insert(const MemoKey &key, Imm res);
 };
 
 /**
@@ -87,48 +230,366 @@ class IntVal : public Value {
  */
 class LambdaVal : public Value {
     private:
-        std::string *xs;
+        Symbol *xs;
         Expression *exp;
+
+        // The number of parameters, and the number of slots in the frame
+        // of an application (see Scope::pop).
+        int argc;
+        int frame = 0;
         Env env;
+
+        // Bytecode compiled from the body, if the VM has requested it.
+        Bytecode *code = NULL;
+
+        // Results of previous applications, keyed on their arguments,
+        // for functions that are known to be pure.
+        bool memo = false;
+        MemoCache *cache = NULL;
+
+        // The free variables of the body, if the function captures only
+        // them rather than the environment it is created in.
+        bool flat = false;
+        std::vector<Capture> captures;
     public:
-        LambdaVal(std::string*, Exp, Env = NULL);
+        static const value_kind KIND = VAL_LAMBDA;
+
+        // The number of memoized applications that were found and not
+        // found in the caches of every function.
+        static unsigned long memo_hits;
+        static unsigned long memo_misses;
+
+        LambdaVal(Symbol*, Exp, Env = NULL);
         ~LambdaVal();
+
+        void trace(ref_visitor f) { if (env) f(env, true); }
+        void clear_refs();
         std::string toString();
         Val apply(Value **xs, Env e = NULL);
+
+        /**
+         * Applies the function without making a call in tail position of
+         * its body; such a call is left for the caller to make.
+         * @param xs The arguments, terminated by NULL.
+         * @param e The environment to evaluate under, if not the closure's.
+         * @return The result, which may be a deferred call.
+         */
+        Imm call(Value **xs, Env e = NULL);
+
+        /**
+         * Applies the function as call does, but without verifying that
+         * the correct number of arguments is given.
+         */
+        Imm enter(Value **xs, Env e = NULL);
+
+        /**
+         * Determines whether or not an application of the function to
+         * the closure's environment is memoized (see setMemo).
+         * @param xs The arguments, terminated by NULL.
+         * @param key Set to the key that the result is remembered under.
+         */
+        bool memoizes(Value **xs, MemoKey &key);
+
+        /**
+         * Determines whether or not an application is memoized, as above,
+         * given one immediate for each parameter.
+         */
+        bool memoizes(Imm *xs, MemoKey &key);
+
+        /**
+         * Finds the result of a previous memoized application. The
+         * function stops memoizing if too few results are ever found.
+         * @return Whether or not the result was found.
+         */
+        bool recall(const MemoKey &key, Imm &res);
+
+        /**
+         * Remembers the result of a memoized application, if it is a
+         * number or boolean.
+         */
+        void remember(const MemoKey &key, Imm res);
+
         LambdaVal* clone();
         int set(Val);
 
-        std::string* getArgs() { return xs; }
+        Symbol* getArgs() { return xs; }
+        int arity() { return argc; }
+
+        int getFrame() { return frame; }
+        void setFrame(int n) { frame = n; }
 
         Expression* getBody() { return exp; }
+
+        Bytecode* getCode();
+
+        /**
+         * Enables or disables memoization of applications of the function.
+         * Only applications to at most MEMO_ARGS numbers and booleans are
+         * memoized, and only results that are numbers or booleans.
+         */
+        void setMemo(bool b) { memo = b; }
+        bool getMemo() { return memo; }
+        
+        /**
+         * Restricts the closure to a set of free variables, which are
+         * captured from the current environment.
+         * @param xs The free variables of the body (see Scope::lookup).
+         */
+        void setCaptures(const std::vector<Capture> &xs);
+
+        /**
+         * Builds the closure of a function within an environment.
+         * @param env The environment that the function is created in.
+         * @param xs The free variables to capture, or NULL to capture
+         *           the entire environment.
+         * @return A new reference to a closure, which is a copy of the
+         *         free variables when all of them are bound, and is the
+         *         environment itself otherwise.
+         */
+        static Env capture(Env env, const std::vector<Capture> *xs);
         
         Env getEnv() { return env; }
         void setEnv(Env);
 };
 
+class ListVal;
+
 /**
- * Represents a list of values.
+ * The numbers of a vector, matrix or higher tensor, held contiguously in
+ * row-major order. Every number is of the same kind, so that the tensor
+ * prints as the nested lists of values that it stands for would.
+ */
+struct Tensor {
+    // The length of each dimension, outermost first
+    std::vector<int> shape;
+
+    // The numbers, which are reals if real is set and integers otherwise
+    bool real = false;
+    std::vector<integer_t> ints;
+    std::vector<real_t> reals;
+
+    int rank() const { return shape.size(); }
+    int length() const { return real ? reals.size() : ints.size(); }
+    real_t at(int i) const { return real ? reals[i] : ints[i]; }
+
+    /**
+     * Finds the numbers of a list that is a tensor.
+     * @param L The list.
+     * @param tmp A tensor to pack the numbers into if the list is not
+     *            dense already.
+     * @return The tensor of the list if it is dense, tmp if the list
+     *          could be packed into it, or NULL if it is not rectangular
+     *          or does not hold numbers of one kind.
+     */
+    static Tensor* of(ListVal *L, Tensor &tmp);
+};
+
+/**
+ * The elements of a list, which are shared between copies of the list
+ * until one of them is modified. The store holds a reference to each
+ * element.
+ *
+ * Elements are held in an array, unless the list has been sliced, joined
+ * or modified in the middle while large, in which case they are held in a
+ * persistent tree (see RopeNode) so that doing so again takes logarithmic
+ * time.
+ *
+ * A list of numbers of one kind, or of such lists of the same shape, is
+ * dense, and holds its numbers in a tensor instead. The array then holds
+ * NULL in place of any element that has not yet been asked for. The
+ * numbers of a vector are boxed one by one as they are read, while those
+ * of a higher tensor are unpacked into rows all at once, since the rows
+ * may then be modified.
  */
-class ListVal : public Value, public ArrayList<Val> {
+class ListStore : public Reffable {
     public:
-        using ArrayList::ArrayList;
-        ~ListVal();
+        std::vector<Val> xs;
+        RopeNode *tree = NULL;
+        Tensor *dense = NULL;
+
+        // The bytes of storage charged to the heap (see account)
+        long charged = 0;
+
+        ListStore() { traced = true; }
+        ~ListStore();
+
+        /**
+         * Charges the storage of the array and the tensor to the heap, as
+         * it has grown or shrunk since it was last charged. The nodes of
+         * a tree are charged by themselves, since they may be shared.
+         */
+        void account();
+
+        /**
+         * Boxes the element at an index of a dense vector, or unpacks a
+         * higher tensor.
+         */
+        Val element(int idx);
+
+        /**
+         * Replaces the tensor with the values that it holds, if the list
+         * is dense.
+         */
+        void unpack();
+
+        /**
+         * Moves the elements from the array into a tree, if they are not
+         * there already.
+         */
+        void to_rope();
+
+        void trace(ref_visitor);
+        void clear_refs();
+};
+
+/**
+ * The structure of a list, as far as operations on vectors and matrices
+ * are concerned.
+ */
+struct ListShape {
+    // 1 for a non-empty vector of numbers, 2 for a matrix of them (a
+    // non-empty list of such vectors of one length), and 0 otherwise
+    int rank = 0;
+
+    // The length of a vector, or the rows and columns of a matrix
+    int rows = 0;
+    int cols = 0;
+
+    // Whether any of the numbers are integers, and whether any are reals
+    bool ints = false;
+    bool reals = false;
+
+    // The number of lists nested at the start of the list, counting
+    // itself, as found by following the first element of each
+    int depth = 1;
+};
 
+/**
+ * Represents a list of values.
+ */
+class ListVal : public Value, public List<Val> {
+    private:
+        ListStore *store;
+
+        // The structure of the list, and the count of modifications (see
+        // modified) at which it was found, or 0 if it is not known
+        ListShape known;
+        unsigned long known_at = 0;
+
+        // Whether or not the known structure of another list depends on
+        // this one, as it does for the rows of a matrix
+        bool in_shape = false;
+
+        ListVal(ListStore *s) : Value(KIND), store(s) { s->account(); }
+
+        /**
+         * Gives the list a store of its own, so that it may be modified
+         * without affecting its copies.
+         */
+        void detach();
+
+        /**
+         * Forgets the structure of the list, along with that of any list
+         * that depends on it.
+         */
+        void modified();
+
+        class LViterator : public Iterator<Val> {
+            private:
+                int idx = 0;
+                ListVal *list;
+            public:
+                LViterator(ListVal *lst) : list(lst) {}
+
+                bool hasNext() { return idx < list->size(); }
+                Val next() { return list->get(idx++); }
+        };
+    public:
+        static const value_kind KIND = VAL_LIST;
+
+        ListVal() : Value(KIND), store(new ListStore) {}
+
+        /**
+         * Creates a list of values. The list is dense if they are numbers
+         * of one kind, or dense lists of the same shape that nothing else
+         * holds.
+         * @param xs The values, which the list takes ownership of along
+         *           with the array itself.
+         * @param n The number of values.
+         */
+        ListVal(Val *xs, int n);
+
+        /**
+         * Creates a dense list, which takes ownership of a tensor.
+         */
+        ListVal(Tensor *t);
+        ~ListVal() { store->rem_ref(); }
+
+        void trace(ref_visitor f) { f(store, true); }
+        void clear_refs();
+
+        Val get(int);
+        Val remove(int);
+
+        void add(int, Val);
+        void set(int, Val);
+
+        /**
+         * Makes room for a number of elements, so that appending them does
+         * not reallocate the list.
+         */
+        void reserve(int n);
+
+        int size() { return store->tree ? store->tree->size : store->xs.size(); }
+        bool isEmpty() { return size() == 0; }
+
+        /**
+         * @return The numbers of the list if it is dense, or NULL.
+         */
+        Tensor* tensor() { return store->dense; }
+
+        /**
+         * Finds the structure of the list. It is remembered until the list
+         * or any list that it was found from is modified, so it is found
+         * again in constant time.
+         */
+        const ListShape& shape();
+
+        /**
+         * Slices the list, sharing its elements.
+         * @return A list of the elements at indices [i, j).
+         */
+        ListVal* slice(int i, int j);
+
+        /**
+         * Joins two lists, sharing their elements.
+         */
+        static ListVal* concat(ListVal *a, ListVal *b);
+
+        Iterator<Val>* iterator() { return new LViterator(this); }
+
+        /**
+         * Copies the list in constant time, by sharing its store.
+         */
         ListVal* clone();
         int set(Val);
-        using ArrayList<Val>::set;
 
         std::string toString();
 };
 
-class RealVal : public Value {
+class RealVal : public Value, public Pooled {
     private:
-        float val;
+        real_t val;
     public:
-        RealVal(float = 0);
-        float get();
+        static const value_kind KIND = VAL_REAL;
+
+        RealVal(real_t = 0);
+        real_t get();
         int set(Val);
 
+        // Overwrites the value in place; see Reffable::is_unique
+        void assign(real_t r) { val = r; }
+
         std::string toString();
         RealVal* clone() { return new RealVal(val); }
 };
@@ -137,7 +598,11 @@ class StringVal : public Value {
     private:
         std::string val;
     public:
-        StringVal(std::string s) : val(s) {}
+        static const value_kind KIND = VAL_STRING;
+
+        // The characters are charged to the heap along with the value
+        StringVal(std::string s) : Value(KIND), val(s) { heap_resize(HEAP_STRING, val.capacity()); }
+        ~StringVal() { heap_resize(HEAP_STRING, -(long) val.capacity()); }
 
         std::string get() { return val; }
         int set(Val);
@@ -157,8 +622,16 @@ class Thunk : public Value {
         Env env;
         Val val;
     public:
-        Thunk(Exp ex, Env en, Val v = NULL) : exp(ex), env(en), val(v) {}
+        static const value_kind KIND = VAL_THUNK;
+
+        Thunk(Exp ex, Env en, Val v = NULL) : Value(KIND), exp(ex), env(en), val(v) {}
         ~Thunk() { delete exp; if (val) val->rem_ref(); if (env) env->rem_ref(); }
+
+        void trace(ref_visitor f) {
+            if (val) f(val, true);
+            if (env) f(env, true);
+        }
+        void clear_refs();
         
         Val get(Env e = NULL);
         int set(Val);
@@ -167,13 +640,18 @@ class Thunk : public Value {
         Thunk* clone() { if (val) val->add_ref(); return new Thunk(exp->clone(), env->clone(), val); }
 };
 
-class TupleVal : public Value {
+class TupleVal : public Value, public Pooled {
     private:
         Val left;
         Val right;
     public:
-        TupleVal(Val l, Val r) : left(l), right(r) {}
-        ~TupleVal() { left->rem_ref(); right->rem_ref(); }
+        static const value_kind KIND = VAL_TUPLE;
+
+        TupleVal(Val l, Val r) : Value(KIND), left(l), right(r) {}
+        ~TupleVal() { if (left) left->rem_ref(); if (right) right->rem_ref(); }
+
+        void trace(ref_visitor f) { f(left, true); f(right, true); }
+        void clear_refs();
 
         Val& getLeft() { return left; }
         Val& getRight() { return right; }
@@ -186,8 +664,17 @@ class TupleVal : public Value {
 /**
  * Defines the void value, which represents nothing.
  */
-class VoidVal : public Value {
+class VoidVal : public Value, public Pooled {
     public:
+        static const value_kind KIND = VAL_VOID;
+
+        VoidVal() : Value(KIND) {}
+
+        /**
+         * @return A new reference to the shared constant void.
+         */
+        static VoidVal* of();
+
         std::string toString() { return "void"; }
         VoidVal* clone() { return new VoidVal; }
         int set(Val v) { return isVal<VoidVal>(v); }
@@ -0,0 +1,181 @@
+#ifndef _VM_HPP_
+#define _VM_HPP_
+
+#include "baselang/expression.hpp"
+#include "baselang/environment.hpp"
+#include "baselang/value.hpp"
+#include "stringable.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * The operations understood by the bytecode interpreter. Each operation
+ * acts upon an operand stack of immediates (see Imm).
+ *
+ * The body of a function keeps its frame on the operand stack when it
+ * can, in which case its variables are addressed by slot through the
+ * local operations, and each of those refers to variable b for its name.
+ */
+enum Opcode {
+    OP_CONST,        // Push constant a
+    OP_LOAD,         // Push the value of variable a
+    OP_STORE,        // Assign the top of the stack to variable a (popping it if b)
+    OP_BIND,         // Pop a value and bind a copy of it to variable a
+    OP_UNBIND,       // Remove the binding of variable a
+    OP_REC,          // Close the lambda bound to variable a over the environment
+    OP_LOCAL,        // Push local a
+    OP_SET_LOCAL,    // Assign the top of the stack to local a
+    OP_POP_LOCAL,    // Pop a value and assign it to local a
+    OP_BIND_LOCAL,   // Pop a value and bind a copy of it to local a
+    OP_UNBIND_LOCAL, // Remove the binding of local a
+    OP_POP,          // Discard the top of the stack
+    OP_UNARY,        // Apply unary operator node a to the top of the stack
+    OP_BINARY,       // Apply binary operator node a (see Arith b) to the top two values
+    OP_BINARY_CONST, // Apply binary operator node a (see Arith b) to the top and constant c
+    OP_JUMP,         // Jump to instruction a
+    OP_BRANCH,       // Pop a boolean (condition node b) and jump to a if false
+    OP_CALL,         // Call a function with a arguments (call node b)
+    OP_TAIL,         // Call a function in place of the current one, as OP_CALL
+    OP_EVAL,         // Evaluate node a with the tree walking interpreter
+    OP_RETURN        // Return the top of the stack
+};
+
+/**
+ * The operations on integers that binary operators perform, which the
+ * interpreter applies without the operator when both operands are integers.
+ */
+enum Arith {
+    ARITH_NONE, ARITH_ADD, ARITH_SUB, ARITH_MUL,
+    ARITH_EQ, ARITH_NEQ, ARITH_GT, ARITH_LT, ARITH_LEQ, ARITH_GEQ
+};
+
+struct Instruction {
+    Opcode op;
+    int a;
+    int b;
+    int c;
+};
+
+/**
+ * A variable referred to by the bytecode, along with the location that
+ * the postprocessor resolved it to (see Environment::apply).
+ */
+struct Variable {
+    Symbol id;
+    int depth;
+    int slot;
+};
+
+/**
+ * A compiled sequence of instructions, along with the constants,
+ * variables, and expressions that the instructions refer to.
+ * Expressions referred to by the bytecode are not owned by it, and
+ * must outlive it.
+ */
+class Bytecode : public Stringable {
+    private:
+        std::vector<Instruction> code;
+        std::vector<Imm> consts;
+        std::vector<Variable> vars;
+        std::vector<Exp> nodes;
+
+        // The height of the operand stack after the last instruction,
+        // counting the results of both arms of a branch, and the greatest
+        // such height, which bounds the operands that the code needs.
+        int height = 0;
+        int max_height = 0;
+
+        // The most recent target of a forward jump
+        int label = -1;
+
+        // The number of slots in the frame of a function body, when the
+        // frame is kept on the operand stack, or -1 when it is kept in an
+        // environment. The frame must be an environment if the code
+        // evaluates expressions or binds variables that are not in a slot.
+        int frame;
+        bool spilled = false;
+    public:
+        Bytecode(int frame = -1) : frame(frame) {}
+        ~Bytecode();
+
+        /**
+         * Appends an instruction to the bytecode.
+         * @return The index of the instruction.
+         */
+        int emit(Opcode op, int a = 0, int b = 0, int c = 0);
+
+        /**
+         * Redirects the jump at a given index to the next instruction
+         * to be emitted.
+         */
+        void patch(int idx) { label = code[idx].a = code.size(); }
+
+        /**
+         * Terminates the bytecode with a return, and turns the calls and
+         * jumps that lead directly to it into tail calls and returns.
+         * @param scoped Whether or not the bytecode is the body of a
+         *               function, whose bindings are discarded on return.
+         */
+        void finish(bool scoped);
+
+        // Registration of operands. Each returns the operand's index.
+        // Constants are shared by every execution, so they must not be
+        // modified (see Reffable::freeze).
+        int constant(Val);
+        int variable(Symbol, int depth = -1, int slot = -1);
+        int node(Exp);
+
+        // Accessors used by the interpreter.
+        const Instruction* instructions() { return code.data(); }
+        Imm get_const(int i) { return consts[i]; }
+        const Variable& get_variable(int i) { return vars[i]; }
+        Exp get_node(int i) { return nodes[i]; }
+
+        int size() { return code.size(); }
+        int locals() { return frame; }
+        bool needs_env() { return spilled; }
+
+        // The operands that an activation needs, including its frame and
+        // the function that it applies
+        int stack_size() { return max_height + frame + 1; }
+
+        std::string toString();
+};
+
+/**
+ * Compiles an expression into bytecode. The expression must outlive
+ * the bytecode that is generated from it.
+ * @param exp A postprocessed expression.
+ * @return The bytecode for the expression, terminated by a return.
+ */
+Bytecode* compile(Exp exp);
+
+/**
+ * Compiles the body of a function, keeping the frame of each application
+ * on the operand stack rather than in an environment if possible.
+ * @param exp The postprocessed body.
+ * @param frame The number of slots in the frame (see Scope::pop).
+ * @return The bytecode for the body, terminated by a return.
+ */
+Bytecode* compile(Exp exp, int frame);
+
+/**
+ * Executes a block of bytecode under a given environment. Functions that
+ * are called by the bytecode are executed on an explicit stack of frames,
+ * which is limited by configuration.max_depth rather than the native stack.
+ * @param code The bytecode to execute.
+ * @param env The environment under which to execute.
+ * @return The result of the computation, or NULL on failure.
+ */
+Val vm_execute(Bytecode *code, Env env);
+
+/**
+ * Compiles and executes an expression using the bytecode interpreter.
+ * @param exp The expression to evaluate.
+ * @param env The environment under which to evaluate.
+ * @return The result of the computation, or NULL on failure.
+ */
+Val vm_run(Exp exp, Env env);
+
+#endif
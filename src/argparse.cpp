@@ -7,6 +7,8 @@
 #include <map>
 #include <vector>
 #include <iostream>
+#include <cctype>
+#include <cstdlib>
 
 std::vector<cmdline_arg> args;
 
@@ -31,6 +33,17 @@ void init_cmdline_args() {
         execute(prog);
         exit(0);
     }, "Runs the given program directly from the command line.", true));
+    add(cmdline_arg("engine", 0, [](char *a) {
+        std::string engine = a ? a : "";
+        if (engine == "ast")
+            configuration.engine = ENGINE_AST;
+        else if (engine == "vm")
+            configuration.engine = ENGINE_VM;
+        else {
+            std::cerr << "unknown engine '" << engine << "' (expected 'ast' or 'vm')\n";
+            exit(1);
+        }
+    }, "Selects the execution engine: 'ast' (tree walker, default) or 'vm' (bytecode).", true));
     add(cmdline_arg("help", 'h', [](char *a) {
         (void) a;
 
@@ -57,6 +70,41 @@ void init_cmdline_args() {
         }
         exit(0);
     }, "Displays this information."));
+    add(cmdline_arg("max-depth", 0, [](char *a) {
+        int n = a ? atoi(a) : 0;
+        if (n <= 0) {
+            std::cerr << "invalid maximum depth '" << (a ? a : "") << "' (expected a positive integer)\n";
+            exit(1);
+        }
+        configuration.max_depth = n;
+    }, "Limits the number of nested calls made by the bytecode interpreter (default: 1000000).", true));
+    add(cmdline_arg("max-heap", 0, [](char *a) {
+        // The size may be given in kibibytes, mebibytes or gibibytes
+        char *end = NULL;
+        long n = a ? strtol(a, &end, 10) : 0;
+        if (end && *end && !end[1]) {
+            std::string units = "KMG";
+            size_t i = units.find(toupper(*end));
+            if (i != std::string::npos) {
+                n <<= 10 * (i + 1);
+                end++;
+            }
+        }
+
+        if (n <= 0 || !end || *end) {
+            std::cerr << "invalid maximum heap size '" << (a ? a : "") << "' (expected a positive number of bytes, optionally followed by K, M or G)\n";
+            exit(1);
+        }
+        configuration.max_heap = n;
+    }, "Limits the memory occupied by live objects, in bytes or with a suffix of K, M or G; evaluation fails once it is exceeded (default: no limit).", true));
+    add(cmdline_arg("memo-size", 0, [](char *a) {
+        int n = a ? atoi(a) : -1;
+        if (n < 0) {
+            std::cerr << "invalid memo size '" << (a ? a : "") << "' (expected a non-negative integer)\n";
+            exit(1);
+        }
+        configuration.memo_size = n;
+    }, "Limits the number of results memoized for each pure function; 0 disables memoization (default: 4096).", true));
     add(cmdline_arg("optimize", 'O', [](char *a) {
         (void) a;
         configuration.optimization = true;
@@ -67,6 +115,18 @@ void init_cmdline_args() {
         int n = test();
         exit(n);
     }, "Runs built-in unit tests."));
+    add(cmdline_arg("threads", 0, [](char *a) {
+        int n = a ? atoi(a) : 0;
+        if (n <= 0) {
+            std::cerr << "invalid number of threads '" << (a ? a : "") << "' (expected a positive integer)\n";
+            exit(1);
+        }
+        configuration.threads = n;
+    }, "Divides large operations on matrices and vectors among the given number of threads (default: 1).", true));
+    add(cmdline_arg("use-arenas", 0, [](char *a) {
+        (void) a;
+        configuration.arenas = true;
+    }, "Enables allocating the temporaries of each evaluation from an arena."));
     add(cmdline_arg("use-module-caching", 0, [](char *a) {
         (void) a;
         configuration.module_caching = true;
@@ -75,6 +135,10 @@ void init_cmdline_args() {
         (void) a;
         configuration.types = configuration.werror ? 2 : 1;
     }, "Enables the type system."));
+    add(cmdline_arg("verbose", 0, [](char *a) {
+        (void) a;
+        configuration.verbosity = true;
+    }, "Enables printing of debug information and runtime statistics."));
     add(cmdline_arg("version", 'v', [](char *a) {
         (void) a;
         print_version();
@@ -97,12 +161,22 @@ std::string parse_cmdline_args(char *argv[]) {
         cmdline_arg arg;
         if (argv[i][0] == '-') {
             if (argv[i][1] == '-') {
-                // Parse a long form argument
+                // Parse a long form argument, which may be given as --name=value
                 std::string nm(&argv[i][2]);
+                char *val = NULL;
+                if (nm.find('=') != std::string::npos) {
+                    val = &argv[i][2 + nm.find('=') + 1];
+                    nm = nm.substr(0, nm.find('='));
+                }
+
                 auto it = long_args.find(nm);
-                if (it == long_args.end()) {
+                if (it == long_args.end() || (val && !it->second.has_arg)) {
                     std::cerr << argv[0] << ": unexpected argument '" << nm << "'\n";
                     exit(1);
+                } else if (val) {
+                    // The argument has already been given
+                    it->second(val);
+                    continue;
                 } else
                     arg = it->second;
             } else {
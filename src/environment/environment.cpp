@@ -9,47 +9,135 @@
 
 using namespace std;
 
-Environment::Environment(Env env) {
+Environment::Environment(Env env, int size) {
     subenv = env;
     if (env) env->add_ref();
+    if (size) store.reserve(size);
+    traced = true;
+    heap_alloc(HEAP_ENV, sizeof(Environment));
 }
 Environment::~Environment() {
     //std::cout << "deleting env " << this << " (" << *this << ")\n";
-    for (auto it : store) {
+    for (auto &it : store) {
         Val v = it.second;
-        store[it.first] = NULL;
-        v->rem_ref();
+        it.second = NULL;
+        if (v) v->rem_ref();
+    }
+    delete index;
+    heap_free(HEAP_ENV, sizeof(Environment));
+}
+
+int Environment::find(Symbol x) {
+    if (store.size() > ENV_INDEX) {
+        if (!index) {
+            index = new unordered_map<Symbol, int>;
+            for (int i = 0; i < store.size(); i++)
+                if (store[i].second)
+                    (*index)[store[i].first] = i;
+        }
+
+        auto it = index->find(x);
+        return it == index->end() ? -1 : it->second;
     }
+
+    for (int i = store.size() - 1; i >= 0; i--)
+        if (store[i].second && store[i].first == x)
+            return i;
+    return -1;
 }
 
-Val Environment::apply(string x) {
-    if (store.find(x) != store.end())
-        return store[x];
+Val Environment::apply(Symbol x) {
+    int i = find(x);
+    if (i >= 0)
+        return store[i].second;
     else
         return subenv ? subenv->apply(x) : NULL;
 }
 
-int Environment::set(string x, Val v) {
+int Environment::set(Symbol x, Val v) {
     if (!v) return 1;
-
-    // Remove the reference if necessary
-    if (store.find(x) != store.end())
-        store[x]->rem_ref();
-    // Set the new value in the store
-    store[x] = v;
     v->add_ref();
 
+    int i = find(x);
+    if (i >= 0) {
+        // Replace the existing binding
+        store[i].second->rem_ref();
+        store[i].second = v;
+    } else {
+        // The variable is new to this frame, and may hide another
+        store.push_back({x, v});
+        dynamic = true;
+        if (index) (*index)[x] = store.size() - 1;
+    }
+
     return 0;
 }
 
-void Environment::rem(string x) {
-    if (apply(x)) {
+void Environment::rem(Symbol x) {
+    int i = find(x);
+    if (i >= 0) {
         // If the slot is filled, we clear it
-        store[x]->rem_ref();
-        store.erase(x);
+        store[i].second->rem_ref();
+        store[i].second = NULL;
+        unindex();
+
+        // Drop unused slots from the end
+        while (!store.empty() && !store.back().second)
+            store.pop_back();
     }
 }
 
+void Environment::bind(int slot, Symbol x, Val v) {
+    if (slot < 0) {
+        set(x, v);
+        return;
+    } else if (slot >= store.size())
+        store.resize(slot + 1, {Symbol(), NULL});
+
+    v->add_ref();
+
+    // Variables bound by name must not hide the new binding
+    if (dynamic) {
+        int i = find(x);
+        if (i >= 0 && i != slot) {
+            store[i].second->rem_ref();
+            store[i].second = NULL;
+            unindex();
+        }
+    }
+
+    auto &b = store[slot];
+    if (b.second && b.first != x) {
+        // The slot was claimed by a variable bound by name, so we move it
+        auto tmp = b;
+        b.second = NULL;
+        store.push_back(tmp);
+        unindex();
+    } else if (b.second)
+        b.second->rem_ref();
+
+    auto &c = store[slot];
+    if (c.first != x) c.first = x;
+    c.second = v;
+
+    if (index) {
+        // A later slot binding the same variable still hides this one
+        auto it = index->find(x);
+        if (it == index->end() || it->second < slot)
+            (*index)[x] = slot;
+    }
+}
+
+void Environment::unbind(int slot, Symbol x) {
+    if (slot >= 0 && slot < store.size()
+            && store[slot].second && store[slot].first == x) {
+        store[slot].second->rem_ref();
+        store[slot].second = NULL;
+        unindex();
+    } else
+        rem(x);
+}
+
 /*
 ~ExtendEnv() {
     //std::cout << "deleting env " << this << " (" << *this << ")\n";
@@ -60,11 +148,28 @@ void Environment::rem(string x) {
     }
 }*/
 
+void Environment::trace(ref_visitor f) {
+    for (auto &it : store)
+        if (it.second) f(it.second, true);
+    if (subenv) f(subenv, false);
+}
+
+void Environment::clear_refs() {
+    for (auto &it : store) {
+        Val v = it.second;
+        it.second = NULL;
+        if (v) v->rem_ref();
+    }
+    store.clear();
+    unindex();
+}
+
 Env Environment::clone() {
     Env env = new Environment(subenv ? subenv->clone() : NULL);
-    for (auto it : store) {
-        env->store[it.first] = it.second;
-    }
+    env->store = store;
+    env->dynamic = dynamic;
+    for (auto &it : env->store)
+        if (it.second) it.second->add_ref();
 
     return env;
 }
@@ -0,0 +1,116 @@
+#include "baselang/scope.hpp"
+
+using namespace std;
+
+void Scope::push(string self, bool *flat) {
+    frames.push_back(Frame());
+    frames.back().self = self;
+    frames.back().flat = flat;
+
+    if (flat) {
+        *flat = !exposed;
+        lambdas.push_back(flat);
+    }
+}
+
+int Scope::pop() {
+    int n = frames.back().size;
+    frames.pop_back();
+    return n;
+}
+
+int Scope::find(const string &x) {
+    // Inner frames shadow outer ones
+    for (int i = frames.size() - 1; i >= 0; i--)
+        if (frames[i].vars.find(x) != frames[i].vars.end())
+            return i;
+    return -1;
+}
+
+bool Scope::hasKey(string x) {
+    return find(x) >= 0;
+}
+
+int Scope::add(string x) {
+    Frame &F = frames.back();
+    return F.vars[x] = F.size++;
+}
+
+void Scope::remove(string x) {
+    frames.back().vars.erase(x);
+}
+
+bool Scope::lookup(string x, int &depth, int &slot) {
+    int i = find(x);
+    if (i < 0) return false;
+
+    depth = 0;
+    slot = frames[i].vars[x];
+
+    // Each lambda captures the variable from the one that encloses it
+    for (int j = i + 1; j < (int) frames.size(); j++) {
+        Frame &F = frames[j];
+        auto it = F.captured.find(x);
+        if (it == F.captured.end()) {
+            F.captures.push_back({x, depth, slot});
+            it = F.captured.emplace(x, F.captures.size() - 1).first;
+
+            // The lambda would not see the variable being reassigned by
+            // any of the frames that enclose it
+            for (int k = i; k < j && F.flat; k++) {
+                frames[k].watchers[x].push_back(F.flat);
+                if (frames[k].assigned.count(x))
+                    *F.flat = false;
+            }
+        }
+
+        depth = 1;
+        slot = it->second;
+    }
+
+    return true;
+}
+
+void Scope::use(string x) {
+    // The lambda directly within the definition may refer to itself
+    int i = find(x);
+    for (int j = i + 1; i >= 0 && j < (int) frames.size(); j++) {
+        Frame &F = frames[j];
+        if (j != i + 1 || x != F.self)
+            F.pure = false;
+    }
+}
+
+void Scope::call(string x) {
+    events++;
+
+    int i = find(x);
+    for (int j = 0; j < (int) frames.size(); j++) {
+        Frame &F = frames[j];
+        if (i >= 0 && j == i + 1 && x == F.self)
+            F.calls++;
+        else
+            F.pure = false;
+    }
+}
+
+void Scope::effect() {
+    events++;
+    for (auto &F : frames)
+        F.pure = false;
+}
+
+void Scope::assign(string x) {
+    events++;
+
+    Frame &F = frames.back();
+    F.assigned.insert(x);
+    for (bool *flat : F.watchers[x])
+        *flat = false;
+}
+
+void Scope::expose() {
+    exposed = true;
+    for (bool *flat : lambdas)
+        *flat = false;
+}
@@ -3,8 +3,7 @@
 using namespace std;
 
 Exp ApplyExp::clone() {
-    int i;
-    for (i = 0; args[i]; i++);
+    int i = argc;
 
     Exp *a = new Exp[i+1];
     a[i] = NULL;
@@ -40,12 +39,18 @@ Exp LambdaExp::clone() {
     int i;
     for (i = 0; xs[i] != ""; i++);
     
-    string *ids = new string[i+1];
+    Symbol *ids = new Symbol[i+1];
     ids[i] = "";
     while (i--)
         ids[i] = xs[i];
 
-    return new LambdaExp(ids, exp->clone());
+    LambdaExp *res = new LambdaExp(ids, exp->clone());
+    res->name = name;
+    res->memo = memo;
+    res->frame = frame;
+    res->captures = captures;
+    res->flat = flat;
+    return res;
 
 }
 
@@ -53,16 +58,20 @@ Exp LetExp::clone() {
     int argc;
     for (argc = 0; exps[argc]; argc++);
     
-    string *ps = new string[argc+1];
+    Symbol *ps = new Symbol[argc+1];
     Exp *es = new Exp[argc+1];
     ps[argc] = "";
     es[argc] = NULL;
+    LetExp *e = new LetExp(ps, es, body->clone());
+
+    if (slots) e->slots = new int[argc];
     while (argc--) {
         ps[argc] = ids[argc];
         es[argc] = exps[argc]->clone();
+        if (slots) e->slots[argc] = slots[argc];
     }
 
-    return new LetExp(ps, es, body->clone());
+    return e;
 
 }
 
@@ -7,6 +7,31 @@
 
 using namespace std;
 
+const size_t exp_sizes[] = {
+    // Primitives
+    sizeof(FalseExp), sizeof(IntExp), sizeof(RealExp), sizeof(StringExp),
+    sizeof(TrueExp), sizeof(VoidExp),
+    // Binary operators
+    sizeof(AndExp), sizeof(OrExp), sizeof(DiffExp), sizeof(DivExp),
+    sizeof(CompareExp), sizeof(ExponentExp), sizeof(DotProdExp),
+    sizeof(MultExp), sizeof(SumExp), sizeof(ModulusExp),
+    // Unary operators
+    sizeof(MagnitudeExp), sizeof(NormExp), sizeof(NotExp),
+    // Data structures
+    sizeof(AdtExp), sizeof(DictExp), sizeof(LambdaExp), sizeof(ListExp),
+    sizeof(TupleExp), sizeof(DictAccessExp), sizeof(ListAccessExp),
+    sizeof(ListAddExp), sizeof(ListRemExp), sizeof(ListSliceExp),
+    sizeof(TupleAccessExp),
+    // Everything else
+    sizeof(AdtDeclarationExp), sizeof(ApplyExp), sizeof(CastExp),
+    sizeof(DerivativeExp), sizeof(FoldExp), sizeof(ForExp), sizeof(HasExp),
+    sizeof(IfExp), sizeof(ImplementExp), sizeof(ImportExp),
+    sizeof(InputExp), sizeof(IsaExp), sizeof(LetExp), sizeof(MapExp),
+    sizeof(PrintExp), sizeof(SequenceExp), sizeof(SetExp),
+    sizeof(StdMathExp), sizeof(SwitchExp), sizeof(ThunkExp), sizeof(ValExp),
+    sizeof(VarExp), sizeof(WhileExp)
+};
+
 
 void throw_warning(string form, string mssg) {
     if (configuration.werror) throw_err(form, mssg);
@@ -53,7 +78,7 @@ Exp AdtDeclarationExp::clone() {
     int i;
     for (i = 0; argss[i]; i++);
     
-    string *xs = new string[i+1];
+    Symbol *xs = new Symbol[i+1];
     Type* **ass = new Type**[i+1];
     xs[i] = ""; ass[i] = NULL;
 
@@ -66,7 +91,9 @@ Exp AdtDeclarationExp::clone() {
         while (j--) ass[i][j] = argss[i][j]->clone();
     }
     
-    return new AdtDeclarationExp(name, xs, ass, body->clone());
+    auto e = new AdtDeclarationExp(name, xs, ass, body->clone());
+    e->slot = slot;
+    return e;
 }
 
 
@@ -80,13 +107,15 @@ SwitchExp::~SwitchExp() {
     delete[] bodies;
     delete[] idss;
     delete[] names;
+    delete[] slots;
 }
 Exp SwitchExp::clone() {
     int i; for (i = 0; bodies[i]; i++);
 
+    auto ks = slots ? new int[i] : NULL;
     auto bs = new Exp[i+1];
-    auto ns = new string[i+1];
-    auto iss = new string*[i+1];
+    auto ns = new Symbol[i+1];
+    auto iss = new Symbol*[i+1];
     bs[i] = NULL;
     ns[i] = "";
     iss[i] = NULL;
@@ -94,19 +123,23 @@ Exp SwitchExp::clone() {
     while (i--) {
         bs[i] = bodies[i]->clone();
         ns[i] = names[i];
+        if (ks) ks[i] = slots[i];
 
         int j; for (j = 0; idss[i][j] != ""; j++);
-        iss[i] = new string[j+1];
+        iss[i] = new Symbol[j+1];
         iss[i][j] = "";
         while (j--) iss[i][j] = idss[i][j];
     }
     
-    return new SwitchExp(adt->clone(), ns, iss, bs);
+    auto e = new SwitchExp(adt->clone(), ns, iss, bs);
+    e->slots = ks;
+    return e;
 }
 
-ApplyExp::ApplyExp(Exp f, Exp *xs) {
+ApplyExp::ApplyExp(Exp f, Exp *xs) : Expression(KIND) {
     op = f;
     args = xs;
+    for (argc = 0; args[argc]; argc++);
 }
 ApplyExp::~ApplyExp() {
     for (int i = 0; args[i]; i++)
@@ -122,35 +155,39 @@ DictExp::DictExp(std::initializer_list<std::pair<std::string, Exp>> es) : DictEx
     }
 }
 
-IfExp::IfExp(Exp b, Exp t, Exp f) {
+IfExp::IfExp(Exp b, Exp t, Exp f) : Expression(KIND) {
     cond = b;
     tExp = t;
     fExp = f;
 }
 
-IntExp::IntExp(int n) { val = n; }
+IntExp::IntExp(integer_t n) : PrimitiveExp(KIND) {
+    val = n;
+    value = IntVal::of(n);
+    value->freeze();
+}
 
 // Expression for generating lambdas.
-LambdaExp::LambdaExp(string *ids, Exp rator) {
+LambdaExp::LambdaExp(Symbol *ids, Exp rator) : Expression(KIND) {
     xs = ids;
     exp = rator;
 }
 
-LetExp::LetExp(string *vs, Exp *xs, Exp y, bool *r) {
+LetExp::LetExp(Symbol *vs, Exp *xs, Exp y, bool *r) : Expression(KIND) {
     ids = vs;
     exps = xs;
     body = y;
     rec = r;
 }
 
-ListExp::ListExp() {}
+ListExp::ListExp() : Expression(KIND) {}
 
 ListExp::ListExp(Exp* exps) : ListExp::ListExp() {
     for (int i = 0; exps[i]; i++)
         add(i, exps[i]);
 }
 
-ListExp::ListExp(List<Exp> *list) {
+ListExp::ListExp(List<Exp> *list) : Expression(KIND) {
     while (list->size())
         add(size(), list->remove(0));
     delete list;
@@ -171,12 +208,22 @@ void ImportExp::clear_cache() {
     module_cache.clear();
 }
 
-OperatorExp::OperatorExp(Exp a, Exp b) {
+OperatorExp::OperatorExp(exp_kind k, Exp a, Exp b) : Expression(k) {
     left = a;
     right = b;
 }
 
-RealExp::RealExp(float n) { val = n; }
+RealExp::RealExp(real_t n) : PrimitiveExp(KIND) {
+    val = n;
+    value = new RealVal(n);
+    value->freeze();
+}
+
+StringExp::StringExp(string s) : PrimitiveExp(KIND) {
+    val = s;
+    value = new StringVal(s);
+    value->freeze();
+}
 
 Exp SequenceExp::clone() {
     auto es = new LinkedList<Exp>;
@@ -190,7 +237,7 @@ Exp SequenceExp::clone() {
 
 }
 
-SetExp::SetExp(Exp xs, Exp vs) {
+SetExp::SetExp(Exp xs, Exp vs) : Expression(KIND) {
     tgt = xs;
     exp = vs;
 }
@@ -6,17 +6,143 @@
 
 #include <string>
 #include <cmath>
+#include <functional>
 
 #include "math.hpp"
+#include "interp.hpp"
 
 using namespace std;
 
+/**
+ * Decides a comparison between two operands of the same type.
+ */
+template<typename T>
+inline bool compare(CompOp operation, T A, T B) {
+    switch (operation) {
+        case EQ:
+            return A == B;
+        case NEQ:
+            return A != B;
+        case GT:
+            return A > B;
+        case LT:
+            return A < B;
+        case GEQ:
+            return A >= B;
+        case LEQ:
+            return A <= B;
+        default:
+            return false;
+    }
+}
+
 
 OperatorExp::~OperatorExp() {
     delete left;
     delete right;
 }
 
+Imm OperatorExp::op(Imm a, Imm b) {
+    Val x = a.kind == Imm::BOXED ? a.v : box(a);
+    Val y = b.kind == Imm::BOXED ? b.v : box(b);
+
+    Val z = op(x, y);
+
+    if (a.kind != Imm::BOXED) x->rem_ref();
+    if (b.kind != Imm::BOXED) y->rem_ref();
+
+    return unbox(z);
+}
+
+// The number of times in a row that a node must see the same kinds of
+// operands before it specializes to them.
+#define SPECIALIZE_AFTER 2
+
+Imm OperatorExp::apply(Imm a, Imm b) {
+    Imm c;
+    bool same = a.kind == kinds[0] && b.kind == kinds[1];
+
+    if (variant) {
+        if (same && variant(this, a, b, c))
+            return c;
+        
+        // The guard failed, so the node deoptimizes
+        variant = NULL;
+        generic = true;
+    } else if (!generic) {
+        if (!same) {
+            kinds[0] = a.kind;
+            kinds[1] = b.kind;
+            observed = 0;
+        }
+        
+        if (++observed >= SPECIALIZE_AFTER) {
+            variant = specialize(a, b);
+            generic = !variant;
+        }
+    }
+
+    return op(a, b);
+}
+
+/**
+ * Determines whether or not an immediate holds a list.
+ */
+inline bool imm_is_list(Imm x) {
+    return x.kind == Imm::BOXED && isVal<ListVal>(x.v);
+}
+
+/**
+ * Applies an operator elementwise to lists of equal length, as is done by
+ * the variants of addition and subtraction on lists.
+ * @param a The left operand.
+ * @param b The right operand.
+ * @param c Set to the result.
+ * @param g The operator on elements other than numbers.
+ * @param t The operator on tensors of numbers (see tensor_add).
+ * @return Whether or not the operands are lists of equal length.
+ */
+template<template<typename> class F>
+static bool elementwise(Imm a, Imm b, Imm &c, Val (*g)(Val, Val), Val (*t)(ListVal*, ListVal*)) {
+    if (!imm_is_list(a) || !imm_is_list(b))
+        return false;
+
+    ListVal *A = (ListVal*) a.v;
+    ListVal *B = (ListVal*) b.v;
+
+    if (Val v = t(A, B)) {
+        c = Imm(v);
+        return true;
+    }
+
+    int n = A->size();
+    if (n != B->size())
+        return false;
+
+    Val *xs = new Val[n];
+    for (int i = 0; i < n; i++) {
+        Val x = A->get(i);
+        Val y = B->get(i);
+
+        // Numbers are computed directly, and anything else generically
+        if (isVal<IntVal>(x) && isVal<IntVal>(y))
+            xs[i] = new IntVal(F<integer_t>()(((IntVal*) x)->get(), ((IntVal*) y)->get()));
+        else if (val_is_number(x) && val_is_number(y)) {
+            real_t u = isVal<IntVal>(x) ? ((IntVal*) x)->get() : ((RealVal*) x)->get();
+            real_t v = isVal<IntVal>(y) ? ((IntVal*) y)->get() : ((RealVal*) y)->get();
+            xs[i] = new RealVal(F<real_t>()(u, v));
+        } else if (!(xs[i] = g(x, y))) {
+            while (i--) xs[i]->rem_ref();
+            delete[] xs;
+            c = Imm();
+            return true;
+        }
+    }
+
+    c = Imm((Val) new ListVal(xs, n));
+    return true;
+}
+
 // Expression for adding stuff
 Val AndExp::op(Val a, Val b) {
     
@@ -30,9 +156,14 @@ Val AndExp::op(Val a, Val b) {
     
     // Compute the result
     auto z = x && y;
-    return new BoolVal(z);
+    return BoolVal::of(z);
 
 }
+op_variant AndExp::specialize(Imm a, Imm b) {
+    if (a.kind == Imm::BOOL && b.kind == Imm::BOOL)
+        return [](OperatorExp*, Imm a, Imm b, Imm &c) { c = Imm(a.b && b.b); return true; };
+    return NULL;
+}
 
 // Expression for adding stuff
 Val OrExp::op(Val a, Val b) {
@@ -47,14 +178,38 @@ Val OrExp::op(Val a, Val b) {
     
     // Compute the result
     auto z = x || y;
-    return new BoolVal(z);
+    return BoolVal::of(z);
 
 }
+op_variant OrExp::specialize(Imm a, Imm b) {
+    if (a.kind == Imm::BOOL && b.kind == Imm::BOOL)
+        return [](OperatorExp*, Imm a, Imm b, Imm &c) { c = Imm(a.b || b.b); return true; };
+    return NULL;
+}
 
 // Expression for multiplying studd
 Val DiffExp::op(Val a, Val b) {
     return sub(a, b);
 }
+Imm DiffExp::op(Imm a, Imm b) {
+    if (a.kind == Imm::INT && b.kind == Imm::INT)
+        return Imm(a.i - b.i);
+    else if (a.is_number() && b.is_number())
+        return Imm(a.real() - b.real());
+    else
+        return OperatorExp::op(a, b);
+}
+op_variant DiffExp::specialize(Imm a, Imm b) {
+    if (a.kind == Imm::INT && b.kind == Imm::INT)
+        return [](OperatorExp*, Imm a, Imm b, Imm &c) { c = Imm(a.i - b.i); return true; };
+    else if (a.is_number() && b.is_number())
+        return [](OperatorExp*, Imm a, Imm b, Imm &c) { c = Imm(a.real() - b.real()); return true; };
+    else if (imm_is_list(a) && imm_is_list(b))
+        return [](OperatorExp*, Imm a, Imm b, Imm &c) {
+            return elementwise<minus>(a, b, c, sub, tensor_sub);
+        };
+    return NULL;
+}
 
 Val ExponentExp::op(Val a, Val b) {
     return pow(a, b);
@@ -64,10 +219,37 @@ Val ExponentExp::op(Val a, Val b) {
 Val DivExp::op(Val a, Val b) {
     return div(a, b);
 }
+Imm DivExp::op(Imm a, Imm b) {
+    if (a.kind == Imm::INT && b.kind == Imm::INT) {
+        if (!b.i) {
+            throw_err("runtime", "division by zero (see: '" + toString() + "')");
+            return Imm();
+        }
+        return Imm(a.i / b.i);
+    } else if (a.is_number() && b.is_number())
+        return Imm(a.real() / b.real());
+    else
+        return OperatorExp::op(a, b);
+}
+op_variant DivExp::specialize(Imm a, Imm b) {
+    // Division by zero is left to the generic operator to report
+    if (a.kind == Imm::INT && b.kind == Imm::INT)
+        return [](OperatorExp*, Imm a, Imm b, Imm &c) {
+            if (!b.i) return false;
+            c = Imm(a.i / b.i);
+            return true;
+        };
+    else if (a.is_number() && b.is_number())
+        return [](OperatorExp*, Imm a, Imm b, Imm &c) { c = Imm(a.real() / b.real()); return true; };
+    return NULL;
+}
 
 Val CompareExp::op(Val a, Val b) {  
 
-    if ((val_is_number(a) && val_is_number(b))) {
+    if (val_is_integer(a) && val_is_integer(b))
+        // Integers are compared exactly
+        return BoolVal::of(compare(operation, ((IntVal*) a)->get(), ((IntVal*) b)->get()));
+    else if ((val_is_number(a) && val_is_number(b))) {
         auto A =
             isVal<IntVal>(a)
             ? ((IntVal*) a)->get() :
@@ -80,19 +262,19 @@ Val CompareExp::op(Val a, Val b) {
 
         switch (operation) {
             case EQ:
-                return new BoolVal(A == B);
+                return BoolVal::of(A == B);
             case NEQ:
-                return new BoolVal(A != B);
+                return BoolVal::of(A != B);
             case GT:
-                return new BoolVal(A > B);
+                return BoolVal::of(A > B);
             case LT:
-                return new BoolVal(A < B);
+                return BoolVal::of(A < B);
             case GEQ:
-                return new BoolVal(A >= B);
+                return BoolVal::of(A >= B);
             case LEQ:
-                return new BoolVal(A <= B);
+                return BoolVal::of(A <= B);
             default:
-                return new BoolVal(false);
+                return BoolVal::of(false);
         }
     } else if (val_is_bool(a) && val_is_bool(b)) {
         auto A = ((BoolVal*) a)->get();
@@ -100,47 +282,102 @@ Val CompareExp::op(Val a, Val b) {
 
         switch (operation) {
             case EQ:
-                return new BoolVal(A == B);
+                return BoolVal::of(A == B);
             case NEQ:
-                return new BoolVal(A != B);
+                return BoolVal::of(A != B);
             default:
-                return new BoolVal(false);
+                return BoolVal::of(false);
         }
     } else if (isVal<VoidVal>(a) && isVal<VoidVal>(b))
-        return new BoolVal(operation == CompOp::EQ);
+        return BoolVal::of(operation == CompOp::EQ);
     else if (val_is_string(a) && val_is_string(b)) {
         string A = a->toString();
         string B = b->toString();
 
         switch (operation) {
             case EQ:
-                return new BoolVal(A == B);
+                return BoolVal::of(A == B);
             case NEQ:
-                return new BoolVal(A != B);
+                return BoolVal::of(A != B);
             case GT:
-                return new BoolVal(A > B);
+                return BoolVal::of(A > B);
             case LT:
-                return new BoolVal(A < B);
+                return BoolVal::of(A < B);
             case GEQ:
-                return new BoolVal(A >= B);
+                return BoolVal::of(A >= B);
             case LEQ:
-                return new BoolVal(A <= B);
+                return BoolVal::of(A <= B);
             default:
-                return new BoolVal(false);
+                return BoolVal::of(false);
         }
     } else
-        return new BoolVal(false);
+        return BoolVal::of(false);
+}
+Imm CompareExp::op(Imm a, Imm b) {
+    if (a.kind == Imm::INT && b.kind == Imm::INT)
+        return Imm(compare(operation, a.i, b.i));
+    else if (a.is_number() && b.is_number())
+        return Imm(compare(operation, a.real(), b.real()));
+    else if (a.kind == Imm::BOOL && b.kind == Imm::BOOL)
+        return Imm((operation == EQ || operation == NEQ) && compare(operation, a.b, b.b));
+    else
+        return OperatorExp::op(a, b);
+}
+op_variant CompareExp::specialize(Imm a, Imm b) {
+    if (a.kind == Imm::INT && b.kind == Imm::INT)
+        return [](OperatorExp *e, Imm a, Imm b, Imm &c) {
+            c = Imm(compare(((CompareExp*) e)->operation, a.i, b.i));
+            return true;
+        };
+    else if (a.is_number() && b.is_number())
+        return [](OperatorExp *e, Imm a, Imm b, Imm &c) {
+            c = Imm(compare(((CompareExp*) e)->operation, a.real(), b.real()));
+            return true;
+        };
+    return NULL;
 }
 
 // Expression for multiplying studd
 Val MultExp::op(Val a, Val b) {
     return mult(a, b);
 }
+Imm MultExp::op(Imm a, Imm b) {
+    if (a.kind == Imm::INT && b.kind == Imm::INT)
+        return Imm(a.i * b.i);
+    else if (a.is_number() && b.is_number())
+        return Imm(a.real() * b.real());
+    else
+        return OperatorExp::op(a, b);
+}
+op_variant MultExp::specialize(Imm a, Imm b) {
+    if (a.kind == Imm::INT && b.kind == Imm::INT)
+        return [](OperatorExp*, Imm a, Imm b, Imm &c) { c = Imm(a.i * b.i); return true; };
+    else if (a.is_number() && b.is_number())
+        return [](OperatorExp*, Imm a, Imm b, Imm &c) { c = Imm(a.real() * b.real()); return true; };
+    return NULL;
+}
 
 // Expression for adding stuff
 Val SumExp::op(Val a, Val b) {
     return add(a, b);
 }
+Imm SumExp::op(Imm a, Imm b) {
+    if (a.kind == Imm::INT && b.kind == Imm::INT)
+        return Imm(a.i + b.i);
+    else if (a.is_number() && b.is_number())
+        return Imm(a.real() + b.real());
+    else
+        return OperatorExp::op(a, b);
+}
+op_variant SumExp::specialize(Imm a, Imm b) {
+    if (a.kind == Imm::INT && b.kind == Imm::INT)
+        return [](OperatorExp*, Imm a, Imm b, Imm &c) { c = Imm(a.i + b.i); return true; };
+    else if (a.is_number() && b.is_number())
+        return [](OperatorExp*, Imm a, Imm b, Imm &c) { c = Imm(a.real() + b.real()); return true; };
+    else if (imm_is_list(a) && imm_is_list(b))
+        return [](OperatorExp*, Imm a, Imm b, Imm &c) { return elementwise<plus>(a, b, c, add, tensor_add); };
+    return NULL;
+}
 
 Val DotProdExp::op(Val a, Val b) {
     return dot(a,b);
@@ -151,6 +388,11 @@ Val ModulusExp::op(Val a, Val b) {
         auto x = ((IntVal*) a)->get();
         auto y = ((IntVal*) b)->get();
 
+        if (!y) {
+            throw_err("runtime", "modulus by zero");
+            return NULL;
+        }
+
         return new IntVal(x % y);
 
     } else if (val_is_number(a) && val_is_number(b)) {
@@ -172,4 +414,25 @@ Val ModulusExp::op(Val a, Val b) {
         return NULL;
     }
 }
-
+Imm ModulusExp::op(Imm a, Imm b) {
+    if (a.kind == Imm::INT && b.kind == Imm::INT) {
+        if (!b.i) {
+            throw_err("runtime", "modulus by zero (see: '" + toString() + "')");
+            return Imm();
+        }
+        return Imm(a.i % b.i);
+    } else if (a.is_number() && b.is_number())
+        return Imm((real_t) fmod(a.real(), b.real()));
+    else
+        return OperatorExp::op(a, b);
+}
+op_variant ModulusExp::specialize(Imm a, Imm b) {
+    // Modulus by zero is left to the generic operator to report
+    if (a.kind == Imm::INT && b.kind == Imm::INT)
+        return [](OperatorExp*, Imm a, Imm b, Imm &c) {
+            if (!b.i) return false;
+            c = Imm(a.i % b.i);
+            return true;
+        };
+    return NULL;
+}
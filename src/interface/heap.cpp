@@ -0,0 +1,33 @@
+#include "heap.hpp"
+
+#include "baselang/expression.hpp"
+
+using namespace std;
+
+heap_usage heap_kinds[HEAP_KINDS];
+long heap_bytes = 0;
+long heap_peak = 0;
+
+static const char *heap_names[HEAP_KINDS] = {
+    "adt", "bool", "dict", "int", "lambda", "list",
+    "real", "string", "thunk", "tuple", "void",
+    "environment", "expression"
+};
+
+void heap_error() {
+    throw_err("runtime", "heap limit of " + to_string(configuration.max_heap)
+            + " bytes exceeded (" + to_string(heap_bytes) + " bytes live)");
+}
+
+string heap_stats() {
+    string s = to_string(heap_bytes) + " bytes live, "
+             + to_string(heap_peak) + " bytes at peak";
+
+    for (int k = 0; k < HEAP_KINDS; k++)
+        if (heap_kinds[k].objects)
+            s += string(", ") + heap_names[k] + ": "
+               + to_string(heap_kinds[k].objects) + " ("
+               + to_string(heap_kinds[k].bytes) + " bytes)";
+
+    return s;
+}
@@ -0,0 +1,107 @@
+#include "parallel.hpp"
+#include "config.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+/**
+ * The threads that help the main thread, and the job that they share.
+ * Ranges of the job are claimed in order until none remain.
+ */
+struct Pool {
+    mutex lock;
+    condition_variable wake;
+    condition_variable done;
+
+    // The number of threads started, and how many have yet to finish the
+    // current job
+    unsigned workers = 0;
+    unsigned busy = 0;
+
+    // Counts the jobs, so that a thread can tell when a new one is posted
+    unsigned long job = 0;
+
+    const function<void(int, int)> *f = NULL;
+    int n = 0;
+    int size = 0;
+    int ranges = 0;
+    atomic<int> next;
+};
+
+// Whether or not the current thread is working on a job, in which case
+// any job that it starts is run in place
+static thread_local bool in_job = false;
+
+static Pool& pool() {
+    static Pool *p = new Pool;
+    return *p;
+}
+
+static void claim(Pool &p) {
+    int r;
+    while ((r = p.next.fetch_add(1)) < p.ranges) {
+        int i = r * p.size;
+        int j = i + p.size < p.n ? i + p.size : p.n;
+        (*p.f)(i, j);
+    }
+}
+
+static void work(Pool *p) {
+    in_job = true;
+
+    unsigned long seen = 0;
+    unique_lock<mutex> l(p->lock);
+    while (true) {
+        p->wake.wait(l, [&]() { return p->job != seen; });
+        seen = p->job;
+
+        l.unlock();
+        claim(*p);
+        l.lock();
+
+        if (--p->busy == 0)
+            p->done.notify_one();
+    }
+}
+
+void parallel_for(int n, int grain, const function<void(int, int)> &f) {
+    if (n <= 0) return;
+
+    unsigned ranges = n / (grain > 0 ? grain : 1);
+    if (ranges > configuration.threads)
+        ranges = configuration.threads;
+
+    if (ranges <= 1 || in_job) {
+        f(0, n);
+        return;
+    }
+
+    Pool &p = pool();
+    unique_lock<mutex> l(p.lock);
+
+    // Threads are started on demand, and live as long as the program
+    for (; p.workers < ranges - 1; p.workers++)
+        thread(work, &p).detach();
+
+    p.f = &f;
+    p.n = n;
+    p.size = (n + ranges - 1) / ranges;
+    p.ranges = (n + p.size - 1) / p.size;
+    p.next = 0;
+    p.busy = p.workers;
+    p.job++;
+
+    l.unlock();
+    p.wake.notify_all();
+
+    in_job = true;
+    claim(p);
+    in_job = false;
+
+    l.lock();
+    p.done.wait(l, [&]() { return p.busy == 0; });
+}
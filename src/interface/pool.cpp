@@ -0,0 +1,172 @@
+#include "pool.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+// Blocks are allocated in multiples of the grain, up to a limit beyond
+// which the general-purpose allocator is used.
+#define POOL_GRAIN 16
+#define POOL_CLASSES 16
+#define POOL_LIMIT (POOL_GRAIN * POOL_CLASSES)
+
+// Slabs are aligned to their size, so that the slab of a block is found
+// by masking its address.
+#define SLAB_SIZE (64 * 1024)
+
+struct Block {
+    Block *next;
+};
+
+struct Slab {
+    PoolHeap *owner;
+    Slab *next;
+
+    // The size class of the blocks, and the number of them in use
+    int cls;
+    int live;
+};
+
+struct PoolHeap {
+    Block *free[POOL_CLASSES] = {};
+    Slab *slabs = NULL;
+};
+
+// The blocks of a slab begin after its header
+static const size_t SLAB_HEADER = (sizeof(Slab) + POOL_GRAIN - 1) / POOL_GRAIN * POOL_GRAIN;
+
+static PoolHeap shared;
+static PoolHeap *current = &shared;
+
+// Statistics
+static unsigned long n_allocs = 0;
+static unsigned long n_frees = 0;
+static unsigned long n_large = 0;
+static unsigned long n_slabs = 0;
+static unsigned long n_released = 0;
+static unsigned long n_bytes = 0;
+
+static inline Slab* slab_of(void *p) {
+    return (Slab*) ((uintptr_t) p & ~(uintptr_t) (SLAB_SIZE - 1));
+}
+
+/**
+ * Adds a slab to a heap, whose blocks fill the free list of a size class.
+ */
+static bool grow(PoolHeap *H, int cls) {
+    void *mem;
+    if (posix_memalign(&mem, SLAB_SIZE, SLAB_SIZE))
+        return false;
+
+    Slab *S = (Slab*) mem;
+    S->owner = H;
+    S->next = H->slabs;
+    S->cls = cls;
+    S->live = 0;
+    H->slabs = S;
+
+    size_t size = (cls + 1) * POOL_GRAIN;
+    char *end = (char*) mem + SLAB_SIZE;
+    for (char *p = (char*) mem + SLAB_HEADER; p + size <= end; p += size) {
+        Block *b = (Block*) p;
+        b->next = H->free[cls];
+        H->free[cls] = b;
+    }
+
+    n_slabs++;
+    return true;
+}
+
+void* pool_alloc(size_t n) {
+    n_bytes += n;
+    if (n > POOL_LIMIT) {
+        n_large++;
+        return ::operator new(n);
+    }
+
+    int cls = n ? (n - 1) / POOL_GRAIN : 0;
+    PoolHeap *H = current;
+
+    if (!H->free[cls] && !grow(H, cls))
+        throw bad_alloc();
+
+    Block *b = H->free[cls];
+    H->free[cls] = b->next;
+    slab_of(b)->live++;
+
+    n_allocs++;
+    return b;
+}
+
+void pool_free(void *p, size_t n) {
+    if (!p) return;
+    else if (n > POOL_LIMIT) {
+        ::operator delete(p);
+        return;
+    }
+
+    // The block returns to the heap that owns its slab
+    Slab *S = slab_of(p);
+    Block *b = (Block*) p;
+    b->next = S->owner->free[S->cls];
+    S->owner->free[S->cls] = b;
+    S->live--;
+
+    n_frees++;
+}
+
+PoolArena::PoolArena() {
+    heap = new PoolHeap;
+    prev = current;
+    current = heap;
+}
+
+PoolArena::~PoolArena() {
+    current = prev;
+
+    // Free blocks of empty slabs are dropped, and the rest are given to
+    // the enclosing heap
+    for (int c = 0; c < POOL_CLASSES; c++) {
+        Block *b = heap->free[c];
+        while (b) {
+            Block *next = b->next;
+            if (slab_of(b)->live) {
+                b->next = prev->free[c];
+                prev->free[c] = b;
+            }
+            b = next;
+        }
+    }
+
+    Slab *S = heap->slabs;
+    while (S) {
+        Slab *next = S->next;
+        if (S->live) {
+            S->owner = prev;
+            S->next = prev->slabs;
+            prev->slabs = S;
+        } else {
+            free(S);
+            n_slabs--;
+            n_released++;
+        }
+        S = next;
+    }
+
+    delete heap;
+}
+
+unsigned long pool_allocated() {
+    return n_bytes;
+}
+
+string pool_stats() {
+    return to_string(n_allocs) + " allocations, "
+         + to_string(n_frees) + " frees, "
+         + to_string(n_large) + " large allocations, "
+         + to_string(n_slabs) + " slabs ("
+         + to_string(n_slabs * SLAB_SIZE / 1024) + " KiB), "
+         + to_string(n_released) + " slabs released by arenas";
+}
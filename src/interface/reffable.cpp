@@ -1,10 +1,35 @@
 #include "reffable.hpp"
 
 #include "stringable.hpp"
+#include "pool.hpp"
+#include "heap.hpp"
 
 #include <iostream>
+#include <vector>
 using namespace std;
 
+// Collections are made once this many bytes have been allocated since the
+// last one, or once this many candidate roots have been found.
+#define GC_INTERVAL (4 << 20)
+#define GC_MAX_ROOTS 65536
+
+// The colors of objects during a collection. Objects are black outside of
+// a collection.
+enum gc_color { GC_BLACK = 0, GC_GRAY, GC_WHITE };
+
+// Objects whose reference counts dropped without reaching zero, which may
+// be part of a cycle of garbage. Freed objects leave a NULL behind.
+static vector<Reffable*> roots;
+
+// Statistics
+static unsigned long n_collections = 0;
+static unsigned long n_freed = 0;
+static unsigned long last_collection = 0;
+
+Reffable::~Reffable() {
+    if (root >= 0) roots[root] = NULL;
+}
+
 void Reffable::add_ref() {
     ++refs;
 }
@@ -16,6 +41,157 @@ void Reffable::rem_ref() {
         return;
     } else if (--refs == 0) {
         delete this;
+    } else if (traced && root < 0) {
+        // The object may now only be referred to by a cycle
+        root = roots.size();
+        roots.push_back(this);
     }
 }
 
+/**
+ * Trial deletion, as described by Bacon and Rajan. The references held
+ * within the subgraph reachable from the candidate roots are subtracted
+ * from the reference counts. Objects that are still referred to, and
+ * those that they refer to, are live; the rest are garbage.
+ */
+class CycleCollector {
+    private:
+        // Objects that are yet to be visited or scanned, and those that
+        // were found to be garbage
+        static vector<Reffable*> pending;
+        static vector<Reffable*> scanning;
+        static vector<Reffable*> garbage;
+
+        static void gray(Reffable *x, bool counted) {
+            if (counted) x->shift(-1);
+            if (x->color != GC_GRAY) {
+                x->color = GC_GRAY;
+                pending.push_back(x);
+            }
+        }
+
+        static void black(Reffable *x, bool counted) {
+            if (counted) x->shift(1);
+            if (x->color != GC_BLACK) {
+                x->color = GC_BLACK;
+                pending.push_back(x);
+            }
+        }
+
+        static void scan(Reffable *x, bool) {
+            scanning.push_back(x);
+        }
+
+        static void white(Reffable *x, bool) {
+            if (x->color == GC_WHITE) {
+                x->color = GC_BLACK;
+                garbage.push_back(x);
+                pending.push_back(x);
+            }
+        }
+
+        static void restore(Reffable *x, bool counted) {
+            if (counted) x->shift(1);
+        }
+
+        /**
+         * Visits the objects reachable from one by a visitor, which adds
+         * the objects that are yet to be visited to the pending list.
+         */
+        static void visit(Reffable *x, ref_visitor f) {
+            pending.push_back(x);
+            while (!pending.empty()) {
+                Reffable *y = pending.back();
+                pending.pop_back();
+                y->trace(f);
+            }
+        }
+
+        /**
+         * Marks the objects that are reachable from one as live, and
+         * restores the references that they hold.
+         */
+        static void scan_black(Reffable *x) {
+            x->color = GC_BLACK;
+            visit(x, black);
+        }
+    public:
+        static void collect() {
+            vector<Reffable*> candidates;
+            for (Reffable *r : roots)
+                if (r) {
+                    r->root = -1;
+                    candidates.push_back(r);
+                }
+            roots.clear();
+
+            // Subtract the internal references
+            for (Reffable *r : candidates)
+                if (r->color != GC_GRAY) {
+                    r->color = GC_GRAY;
+                    visit(r, gray);
+                }
+
+            // Whatever is still referred to is live
+            for (Reffable *r : candidates) {
+                scanning.push_back(r);
+                while (!scanning.empty()) {
+                    Reffable *x = scanning.back();
+                    scanning.pop_back();
+
+                    if (x->color != GC_GRAY)
+                        continue;
+                    else if (x->refs > 0)
+                        scan_black(x);
+                    else {
+                        x->color = GC_WHITE;
+                        x->trace(scan);
+                    }
+                }
+            }
+
+            // The rest is garbage
+            for (Reffable *r : candidates)
+                if (r->color == GC_WHITE) {
+                    r->color = GC_BLACK;
+                    garbage.push_back(r);
+                    visit(r, white);
+                }
+
+            // The garbage is freed by ordinary reference counting. Its
+            // references are restored, so that each is dropped once. Every
+            // object is kept alive until all of them have been cleared.
+            vector<Reffable*> objs;
+            objs.swap(garbage);
+            for (Reffable *x : objs) x->trace(restore);
+            for (Reffable *x : objs) x->add_ref();
+            for (Reffable *x : objs) x->clear_refs();
+            for (Reffable *x : objs) x->rem_ref();
+
+            n_collections++;
+            n_freed += objs.size();
+        }
+};
+
+vector<Reffable*> CycleCollector::pending;
+vector<Reffable*> CycleCollector::scanning;
+vector<Reffable*> CycleCollector::garbage;
+
+void collect_cycles() {
+    if (!roots.empty())
+        CycleCollector::collect();
+    last_collection = pool_allocated();
+}
+
+bool gc_safepoint() {
+    bool over = configuration.max_heap && heap_bytes > configuration.max_heap;
+    if (over || pool_allocated() - last_collection >= GC_INTERVAL
+            || roots.size() >= GC_MAX_ROOTS)
+        collect_cycles();
+    return !heap_exceeded();
+}
+
+string gc_stats() {
+    return to_string(n_collections) + " collections, "
+         + to_string(n_freed) + " objects freed from cycles";
+}
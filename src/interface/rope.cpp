@@ -0,0 +1,265 @@
+#include "rope.hpp"
+#include "heap.hpp"
+
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+// The largest number of values held by a leaf
+#define ROPE_LEAF 32
+
+/**
+ * @return The bytes that a node occupies, which are charged to the heap as
+ *          storage of lists.
+ */
+static inline long node_bytes(RopeNode *t) {
+    return sizeof(RopeNode) + (t->is_leaf() ? t->size * sizeof(Val) : 0);
+}
+
+RopeNode::RopeNode(RopeNode *l, RopeNode *r) : left(l), right(r) {
+    traced = true;
+    size = l->size + r->size;
+    height = 1 + (l->height > r->height ? l->height : r->height);
+    heap_resize(HEAP_LIST, node_bytes(this));
+}
+
+RopeNode::RopeNode(const Val *vs, int n) : xs(vs, vs + n) {
+    traced = true;
+    size = n;
+    height = 0;
+    for (Val v : xs) v->add_ref();
+    heap_resize(HEAP_LIST, node_bytes(this));
+}
+
+RopeNode::~RopeNode() {
+    clear_refs();
+    heap_resize(HEAP_LIST, -node_bytes(this));
+}
+
+void RopeNode::trace(ref_visitor f) {
+    if (left) f(left, true);
+    if (right) f(right, true);
+    for (Val v : xs) f(v, true);
+}
+
+void RopeNode::clear_refs() {
+    if (left) left->rem_ref();
+    if (right) right->rem_ref();
+    left = right = NULL;
+
+    vector<Val> vs;
+    vs.swap(xs);
+    for (Val v : vs) v->rem_ref();
+}
+
+static inline RopeNode* share(RopeNode *t) {
+    if (t) t->add_ref();
+    return t;
+}
+
+/**
+ * Joins two trees whose heights differ by at most two, rotating them if
+ * they differ by two. The references to both trees are taken over.
+ */
+static RopeNode* balance(RopeNode *a, RopeNode *b) {
+    RopeNode *res;
+
+    if (a->height > b->height + 1) {
+        RopeNode *x = a->right;
+        if (a->left->height >= x->height)
+            res = new RopeNode(share(a->left), new RopeNode(share(x), b));
+        else
+            res = new RopeNode(
+                    new RopeNode(share(a->left), share(x->left)),
+                    new RopeNode(share(x->right), b));
+        a->rem_ref();
+    } else if (b->height > a->height + 1) {
+        RopeNode *x = b->left;
+        if (b->right->height >= x->height)
+            res = new RopeNode(new RopeNode(a, share(x)), share(b->right));
+        else
+            res = new RopeNode(
+                    new RopeNode(a, share(x->left)),
+                    new RopeNode(share(x->right), share(b->right)));
+        b->rem_ref();
+    } else
+        res = new RopeNode(a, b);
+
+    return res;
+}
+
+static RopeNode* build(const Val *vs, int n) {
+    if (n <= ROPE_LEAF)
+        return new RopeNode(vs, n);
+
+    // Split on a leaf boundary, so that the leaves are full
+    int leaves = (n + ROPE_LEAF - 1) / ROPE_LEAF;
+    int m = leaves / 2 * ROPE_LEAF;
+
+    return new RopeNode(build(vs, m), build(vs + m, n - m));
+}
+
+RopeNode* rope_build(const Val *vs, int n) {
+    return n > 0 ? build(vs, n) : NULL;
+}
+
+void rope_flatten(RopeNode *t, vector<Val>& out) {
+    if (!t) return;
+    else if (t->is_leaf()) {
+        for (Val v : t->xs) {
+            v->add_ref();
+            out.push_back(v);
+        }
+    } else {
+        rope_flatten(t->left, out);
+        rope_flatten(t->right, out);
+    }
+}
+
+Val rope_get(RopeNode *t, int idx) {
+    if (!t || idx < 0 || idx >= t->size)
+        throw std::out_of_range(std::to_string(idx));
+
+    while (!t->is_leaf()) {
+        if (idx < t->left->size)
+            t = t->left;
+        else {
+            idx -= t->left->size;
+            t = t->right;
+        }
+    }
+
+    return t->xs[idx];
+}
+
+RopeNode* rope_set(RopeNode *t, int idx, Val v) {
+    if (!t || idx < 0 || idx >= t->size)
+        throw std::out_of_range(std::to_string(idx));
+
+    if (t->is_leaf()) {
+        RopeNode *res = new RopeNode(t->xs.data(), t->size);
+        res->xs[idx]->rem_ref();
+        res->xs[idx] = v;
+        v->add_ref();
+        return res;
+    } else if (idx < t->left->size)
+        return new RopeNode(rope_set(t->left, idx, v), share(t->right));
+    else
+        return new RopeNode(share(t->left),
+                rope_set(t->right, idx - t->left->size, v));
+}
+
+RopeNode* rope_insert(RopeNode *t, int idx, Val v) {
+    if (!t && idx == 0)
+        return new RopeNode(&v, 1);
+    else if (!t || idx < 0 || idx > t->size)
+        throw std::out_of_range(std::to_string(idx));
+
+    if (t->is_leaf()) {
+        vector<Val> vs(t->xs);
+        vs.insert(vs.begin() + idx, v);
+
+        if (t->size < ROPE_LEAF)
+            return new RopeNode(vs.data(), vs.size());
+
+        // The leaf is full, so it is split in two
+        int m = vs.size() / 2;
+        return new RopeNode(
+                new RopeNode(vs.data(), m),
+                new RopeNode(vs.data() + m, vs.size() - m));
+    } else if (idx <= t->left->size)
+        return balance(rope_insert(t->left, idx, v), share(t->right));
+    else
+        return balance(share(t->left),
+                rope_insert(t->right, idx - t->left->size, v));
+}
+
+/**
+ * Joins two sequences, taking over the references to both.
+ */
+static RopeNode* join(RopeNode *a, RopeNode *b) {
+    if (!a || !b)
+        return a ? a : b;
+    else if (a->is_leaf() && b->is_leaf() && a->size + b->size <= ROPE_LEAF) {
+        // Small leaves are merged
+        vector<Val> vs(a->xs);
+        vs.insert(vs.end(), b->xs.begin(), b->xs.end());
+        a->rem_ref();
+        b->rem_ref();
+        return new RopeNode(vs.data(), vs.size());
+    } else if (a->height > b->height + 1) {
+        // Join b to the right spine of a
+        RopeNode *l = share(a->left);
+        RopeNode *r = join(share(a->right), b);
+        a->rem_ref();
+        return balance(l, r);
+    } else if (b->height > a->height + 1) {
+        // Join a to the left spine of b
+        RopeNode *l = join(a, share(b->left));
+        RopeNode *r = share(b->right);
+        b->rem_ref();
+        return balance(l, r);
+    } else
+        return new RopeNode(a, b);
+}
+
+RopeNode* rope_remove(RopeNode *t, int idx) {
+    if (!t || idx < 0 || idx >= t->size)
+        throw std::out_of_range(std::to_string(idx));
+
+    if (t->is_leaf()) {
+        if (t->size == 1)
+            return NULL;
+
+        vector<Val> vs(t->xs);
+        vs.erase(vs.begin() + idx);
+        return new RopeNode(vs.data(), vs.size());
+    } else if (idx < t->left->size)
+        return join(rope_remove(t->left, idx), share(t->right));
+    else
+        return join(share(t->left),
+                rope_remove(t->right, idx - t->left->size));
+}
+
+RopeNode* rope_concat(RopeNode *a, RopeNode *b) {
+    return join(share(a), share(b));
+}
+
+/**
+ * Splits a sequence in two at an index.
+ */
+static void split(RopeNode *t, int idx, RopeNode*& a, RopeNode*& b) {
+    if (idx <= 0) {
+        a = NULL;
+        b = share(t);
+    } else if (idx >= t->size) {
+        a = share(t);
+        b = NULL;
+    } else if (t->is_leaf()) {
+        a = new RopeNode(t->xs.data(), idx);
+        b = new RopeNode(t->xs.data() + idx, t->size - idx);
+    } else if (idx < t->left->size) {
+        RopeNode *x;
+        split(t->left, idx, a, x);
+        b = join(x, share(t->right));
+    } else {
+        RopeNode *x;
+        split(t->right, idx - t->left->size, x, b);
+        a = join(share(t->left), x);
+    }
+}
+
+RopeNode* rope_slice(RopeNode *t, int i, int j) {
+    if (!t || i >= j) return NULL;
+
+    RopeNode *a, *b, *c, *d;
+    split(t, j, a, b);
+    if (b) b->rem_ref();
+
+    split(a, i, c, d);
+    a->rem_ref();
+    if (c) c->rem_ref();
+
+    return d;
+}
@@ -344,8 +344,9 @@ string Environment::toString() {
     for (auto it : store) {
         auto id = it.first;
         auto ref = it.second;
+        if (!ref) continue;
 
-        s += id += " := ";
+        s += id + " := ";
 
         if (isVal<LambdaVal>(ref))
             s += "λ";
@@ -433,7 +434,34 @@ string LambdaVal::toString() {
 
     return s;
 }
+/**
+ * Prints the numbers of a tensor as the nested lists that it stands for.
+ * @param t The tensor.
+ * @param d The depth of the list to print.
+ * @param i The index of the next number, which is advanced past the list.
+ */
+static string tensor_string(Tensor *t, int d, int &i) {
+    string s = "[";
+
+    for (int k = 0; k < t->shape[d]; k++) {
+        if (k) s += ", ";
+        if (d+1 < t->rank())
+            s += tensor_string(t, d+1, i);
+        else if (t->real)
+            s += to_string(t->reals[i++]);
+        else
+            s += to_string(t->ints[i++]);
+    }
+
+    s += "]";
+    return s;
+}
 string ListVal::toString() {
+    if (Tensor *t = tensor()) {
+        int i = 0;
+        return tensor_string(t, 0, i);
+    }
+
     string s = "[";
 
     for (int i = 0; i < size(); i++) {
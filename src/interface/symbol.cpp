@@ -0,0 +1,30 @@
+#include "symbol.hpp"
+
+#include <unordered_map>
+
+using namespace std;
+
+typedef pair<const string, size_t> entry_t;
+
+// The text of every symbol, along with its hash. Elements of the map are
+// never moved, so the symbols may point into it.
+static unordered_map<string, size_t>& symbols() {
+    static unordered_map<string, size_t> *table = new unordered_map<string, size_t>;
+    return *table;
+}
+
+static const entry_t* intern(const string &s) {
+    auto &table = symbols();
+    auto it = table.find(s);
+    if (it == table.end())
+        it = table.insert({s, std::hash<string>{}(s)}).first;
+    return &*it;
+}
+
+Symbol::Symbol() {
+    static const entry_t *empty = intern("");
+    entry = empty;
+}
+
+Symbol::Symbol(const string &s) : entry(intern(s)) {}
+Symbol::Symbol(const char *s) : entry(intern(s)) {}
@@ -15,9 +15,13 @@
 
 #include "stdlib.hpp"
 
+#include "vm.hpp"
+
 #include <cstring>
 #include <cstdlib>
 
+#include <sys/resource.h>
+
 // For math stuff
 #include <cmath>
 #include "math.hpp"
@@ -33,7 +37,7 @@ Val run(string program) {
         throw_debug("postprocessor", "performing verification of '" + exp->toString() + "'");
         
         // Perform postprocessing on the program.
-        HashMap<std::string,bool> *vardta = new HashMap<std::string,bool>;
+        Scope *vardta = new Scope;
         bool valid = exp->postprocessor(vardta);
         delete vardta;
         
@@ -95,7 +99,9 @@ Val run(string program) {
 
         throw_debug("init", "initial env Γ := " + env->toString());
 
-        Val val = exp->evaluate(env);
+        Val val = configuration.engine == ENGINE_VM
+                ? vm_run(exp, env)
+                : exp->evaluate(env);
         delete exp;
         env->rem_ref();
         //if (!val) throw_err("runtime", "could not evaluate expression");
@@ -105,12 +111,81 @@ Val run(string program) {
     }
 }
 
+Imm Expression::evaluate_imm(Env env) {
+    return Imm(evaluate(env));
+}
+
+// Calls with at most this many arguments do not allocate an argument array
+static const int INLINE_ARGS = 8;
+
+// The call most recently deferred by an expression in tail position. Its
+// arguments are held inline, unless there are too many of them.
+static LambdaVal *pending_fn = NULL;
+static int pending_argc = 0;
+static Val pending_args[INLINE_ARGS + 1];
+static Val *pending_argv = NULL;
+
+Imm resolve_tail(Imm x) {
+    while (x.kind == Imm::TAIL) {
+        LambdaVal *F = pending_fn;
+        int argc = pending_argc;
+        pending_fn = NULL;
+
+        // The call may defer calls of its own, so the arguments are moved
+        // out of the pending state first.
+        Val buf[INLINE_ARGS + 1];
+        Val *xs = pending_argv;
+        if (xs == pending_args) {
+            for (int i = 0; i <= argc; i++) buf[i] = xs[i];
+            xs = buf;
+        }
+
+        // The arity was checked when the call was deferred
+        x = F->enter(xs);
+
+        // Garbage collection on the arguments and the function
+        for (int i = 0; i < argc; i++) xs[i]->rem_ref();
+        if (xs != buf) delete[] xs;
+        F->rem_ref();
+    }
+
+    return x;
+}
+
+bool stack_exceeded() {
+    // The stack grows down, and is measured from the shallowest call made
+    // so far. A quarter of it is kept in reserve for whatever the deepest
+    // call goes on to do.
+    static char *base = NULL;
+    static size_t limit = 0;
+
+    char here;
+    if (!limit) {
+        struct rlimit rl;
+        size_t size = 8 << 20;
+        if (!getrlimit(RLIMIT_STACK, &rl) && rl.rlim_cur != RLIM_INFINITY)
+            size = rl.rlim_cur;
+        limit = size / 4 * 3;
+    }
+
+    if (!base || &here > base)
+        base = &here;
+    if ((size_t) (base - &here) <= limit)
+        return false;
+
+    throw_err("runtime", "maximum call depth exceeded by calls nested in the native stack");
+    return true;
+}
+
 Val UnaryOperatorExp::evaluate(Env env) {
-    Val x = exp->evaluate(env);
-    if (!x) return NULL;
+    // Nothing else is evaluated, so the operand may be borrowed
+    Imm a = exp->evaluate_ref(env);
+    if (a.kind == Imm::FAIL) return NULL;
 
+    Val x = a.kind == Imm::BOXED ? a.v : box(a);
     Val y = op(x);
-    x->rem_ref();
+    if (a.kind == Imm::BOXED) release(a);
+    else x->rem_ref();
 
     return y;
 }
@@ -145,7 +220,7 @@ Val AdtDeclarationExp::evaluate(Env env) {
         for (j = 0; argss[i][j]; j++);
         
         // Generate a list of arguments for the constructor.
-        auto xs = new string[j+1];
+        auto xs = new Symbol[j+1];
 
         // Generate a list of arguments for the backend factory.
         auto zs = new Exp[j+1];
@@ -153,7 +228,7 @@ Val AdtDeclarationExp::evaluate(Env env) {
         xs[j] = "";
         zs[j] = NULL;
         while (j--) {
-            xs[j] = "arg" + to_string(j);
+            xs[j] = Symbol("arg" + to_string(j));
             zs[j] = new VarExp(xs[j]);
         }
         
@@ -162,25 +237,28 @@ Val AdtDeclarationExp::evaluate(Env env) {
     }
     
     // Store the dictionary. This holds all of the constructors.
-    env->set(name, adt);
+    env->bind(slot, name, adt);
     adt->rem_ref();
 
     // Now, we can evaluate.
     Val res = body->evaluate(env);
     
     // Now, we remove the item.
-    env->rem(name);
+    env->unbind(slot, name);
 
     return res;
 }
 Val SwitchExp::evaluate(Env env) {
+    return box(evaluate_imm(env));
+}
+Imm SwitchExp::evaluate_scoped(Env env, bool tail) {
     
     Val val = adt->evaluate(env);
-    if (!val) return NULL;
+    if (!val) return Imm();
     else if (!isVal<AdtVal>(val)) {
         throw_type_err(adt, "ADT");
         val->rem_ref();
-        return NULL;
+        return Imm();
     }
 
     auto A = (AdtVal*) val;
@@ -190,8 +268,8 @@ Val SwitchExp::evaluate(Env env) {
     for (xs = 0; A->getArgs()[xs]; xs++);
     
     // Find the right argument set
-    string name = A->getKind();
-    string *ids = NULL;
+    Symbol name = A->getKind();
+    Symbol *ids = NULL;
     int i;
     for (i = 0; !ids && idss[i]; i++) {
         if (names[i] == name) {
@@ -211,49 +289,59 @@ Val SwitchExp::evaluate(Env env) {
     if (!ids) {
         throw_err("type", "adt " + A->toString() + " is incompatible with the switch statement; see:\n\t" + toString());
         val->rem_ref();
-        return NULL;
+        return Imm();
     }
     
     // Grab the correct body
     Exp body = bodies[i];
 
     // Now, we will extend the environment
-    for (i = 0; i < xs; i++)
-        env->set(ids[i], A->getArgs()[i]);
+    int k = slots ? slots[i] : -1;
+    for (int j = 0; j < xs; j++)
+        env->bind(k < 0 ? k : k + j, ids[j], A->getArgs()[j]);
 
-    Val res = body->evaluate(env);
+    Imm res = tail ? body->evaluate_tail(env) : body->evaluate_imm(env);
     
-    // Perform garbage collection
-    for (i = 0; i < xs; i++)
-        env->rem(ids[i]);
+    // Perform garbage collection. A deferred call may still need the
+    // arguments, and they are discarded along with the frame after it.
+    if (res.kind != Imm::TAIL)
+        for (int j = 0; j < xs; j++)
+            env->unbind(k < 0 ? k : k + j, ids[j]);
     val->rem_ref();
 
     return res;
 }
 
 Val ApplyExp::evaluate(Env env) {
+    return box(resolve_tail(evaluate_tail(env)));
+}
+Imm ApplyExp::evaluate_tail(Env env) {
     Val f = op->evaluate(env);
 
     // Null check the function
     if (!f)
-        return NULL;
+        return Imm();
     else
         f = unpack_thunk(f);
     
     // Type check the function
     if (!isVal<LambdaVal>(f)) {
         throw_type_err(op, "lambda");
-        return NULL;
+        return Imm();
     }
     LambdaVal *F = (LambdaVal*) f;
 
-    int argc = 0;
-    while (args[argc]) argc++;
+    // The number of arguments must match the number of parameters
+    if (F->arity() != argc) {
+        F->rem_ref();
+        return Imm();
+    }
 
-    // Operate on each argument under the given environment
-    Val *xs = new Val[argc+1];
-    int i;
-    for (i = 0; i < argc; i++) {
+    // Operate on each argument under the given environment. Most calls
+    // have few enough arguments to hold them on the stack.
+    Val buf[INLINE_ARGS + 1];
+    Val *xs = argc > INLINE_ARGS ? new Val[argc+1] : buf;
+    for (int i = 0; i < argc; i++) {
         // Evanuate the argument
         xs[i] = args[i]->evaluate(env);
 
@@ -261,27 +349,29 @@ Val ApplyExp::evaluate(Env env) {
         if (xs[i] == NULL) {
             // Garbage collect the list
             while (i--) xs[i]->rem_ref();
-            delete xs;
+            if (xs != buf) delete[] xs;
             
             // And the function
             F->rem_ref();
 
             // An argument failed to parse, so clean up
-            return NULL;
+            return Imm();
         }
     }
     xs[argc] = NULL;
 
-    // Now, compute the answer under the lambda's environment
-    Val y = F->apply(xs);
-    
-    // Garbage collection on the array
-    while (i--) xs[i]->rem_ref();
-    delete[] xs;
-
-    // And the function
-    F->rem_ref();
+    // The call is left to the caller, which will make it once this
+    // frame is no longer needed.
+    pending_fn = F;
+    pending_argc = argc;
+    if (xs == buf) {
+        for (int i = 0; i <= argc; i++) pending_args[i] = buf[i];
+        pending_argv = pending_args;
+    } else
+        pending_argv = xs;
 
+    Imm y;
+    y.kind = Imm::TAIL;
     return y;
 }
 
@@ -307,8 +397,8 @@ Val CastExp::evaluate(Env env) {
             string s = ((StringVal*) val)->get();
 
             string::size_type Zlen = -1;
-            int Z;
-            try { Z = stoi(s, &Zlen, 10); }
+            integer_t Z;
+            try { Z = sizeof(integer_t) > sizeof(int) ? stoll(s, &Zlen, 10) : stoi(s, &Zlen, 10); }
             catch (std::out_of_range &oor) { Zlen = -1; }
             catch (std::invalid_argument &ia) { Zlen = -1; }
             
@@ -347,9 +437,9 @@ Val CastExp::evaluate(Env env) {
     } else if (isType<BoolType>(type)) {
         // Type conversion to a boolean
         if (isVal<IntVal>(val))
-            res = new BoolVal(((IntVal*) val)->get());
+            res = BoolVal::of(((IntVal*) val)->get());
         else if (isVal<RealVal>(val))
-            res = new BoolVal(((RealVal*) val)->get());
+            res = BoolVal::of(((RealVal*) val)->get());
         else if (isVal<BoolVal>(val))
             return val;
         else if (isVal<StringVal>(val)) {
@@ -361,10 +451,10 @@ Val CastExp::evaluate(Env env) {
 
             if (s.substr(i, 4) == "true"
                     && s[4] != '_' && !(s[4] >= 'a' && s[4] <= 'z') && !(s[4] >= 'A' && s[4] <= 'Z')) {
-                res = new BoolVal(true);
+                res = BoolVal::of(true);
             } else if (s.substr(i, 5) == "false"
                     && s[5] != '_' && !(s[5] >= 'a' && s[5] <= 'z') && !(s[5] >= 'A' && s[5] <= 'Z')) {
-                res = new BoolVal(false);
+                res = BoolVal::of(false);
             } else {
                 throw_err("cast", "cannot parse bool from " + s);
                 return NULL;
@@ -411,7 +501,7 @@ Val DerivativeExp::evaluate(Env env) {
             for (argc = 0; f->getArgs()[argc] != ""; argc++);
 
             // Argument list
-            string *ids = new string[argc+1];
+            Symbol *ids = new Symbol[argc+1];
             ids[argc] = "";
             while (argc--) ids[argc] = f->getArgs()[argc];
             
@@ -436,13 +526,14 @@ Val DerivativeExp::evaluate(Env env) {
     for (auto x_v : env->get_store()) {
         string id = x_v.first;
         Val v = x_v.second;
+        if (!v) continue;
         
         if (isVal<LambdaVal>(v)) {
             LambdaVal *lv = (LambdaVal*) v;
             int i;
             for (i = 0; lv->getArgs()[i] != ""; i++);
 
-            string *ids = new string[i+1];
+            Symbol *ids = new Symbol[i+1];
             ids[i] = "";
             while (i--) ids[i] = lv->getArgs()[i];
             
@@ -529,7 +620,7 @@ Val DictExp::evaluate(Env env) {
 
 }
 
-Val FalseExp::evaluate(Env) { return new BoolVal(false); }
+Val FalseExp::evaluate(Env) { return BoolVal::of(false); }
 
 Val FoldExp::evaluate(Env env) {
     Val lst = list->evaluate(env);
@@ -598,22 +689,14 @@ Val ForExp::evaluate(Env env) {
         // Get the next item from the list
         Val x = list->get(i);
         
-        // Temporarily store the old value
-        Val tmp = env->apply(id);
-        if (tmp) tmp->add_ref();
-
         // We are going to modify the environment temporarily
-        env->set(id, x);
+        env->bind(slot, id, x);
         
         // Under our modified context, we compute the value
         Val v = body->evaluate(env);  
 
-        // Now, we reset. We either replace the value or remove it.
-        if (tmp) {
-            env->set(id, tmp);
-            tmp->rem_ref();
-        } else
-            env->rem(id);
+        // Now, we reset.
+        env->unbind(slot, id);
 
 
         if (!v) {
@@ -621,11 +704,16 @@ Val ForExp::evaluate(Env env) {
             return NULL;
         } else
             v->rem_ref();
+
+        if (!gc_safepoint()) {
+            listExp->rem_ref();
+            return NULL;
+        }
     }
 
     listExp->rem_ref();
 
-    return new VoidVal;
+    return VoidVal::of();
 
 }
 
@@ -652,9 +740,9 @@ Val HasExp::evaluate(Env env) {
                 delete xs;
                 return NULL;
             } else if (((BoolVal*) b)->get())
-                res = new BoolVal(true);
+                res = BoolVal::of(true);
         }
-        if (!res) res = new BoolVal(false);
+        if (!res) res = BoolVal::of(false);
 
     } else if (val_is_dict(xs)) {
 
@@ -665,9 +753,9 @@ Val HasExp::evaluate(Env env) {
 
             while (!res && it->hasNext())
                 if (it->next() == key)
-                    res = new BoolVal(true);
+                    res = BoolVal::of(true);
 
-            if (!res) res = new BoolVal(false);
+            if (!res) res = BoolVal::of(false);
 
             delete it;
         } else
@@ -682,25 +770,25 @@ Val HasExp::evaluate(Env env) {
 }
 
 Val IfExp::evaluate(Env env) {
-    Val b = cond->evaluate(env);
-    b = unpack_thunk(b);
+    return box(evaluate_imm(env));
+}
+Imm IfExp::evaluate_imm(Env env) {
+    return resolve_tail(evaluate_tail(env));
+}
+Imm IfExp::evaluate_tail(Env env) {
+    Imm b = unbox(cond->evaluate_imm(env));
     
-    if (!b) return NULL;
-    else if (!isVal<BoolVal>(b)) {
+    if (b.kind == Imm::FAIL) return b;
+    else if (b.kind != Imm::BOOL) {
         throw_type_err(cond, "boolean");
-        return NULL;
+        release(b);
+        return Imm();
     }
 
-    BoolVal *B = (BoolVal*) b;
-    bool bRes = B->get();
-
-    // Conditional garbage collection
-    b->rem_ref();
-
-    if (bRes)
-        return tExp->evaluate(env);
+    if (b.b)
+        return tExp->evaluate_tail(env);
     else
-        return fExp->evaluate(env);
+        return fExp->evaluate_tail(env);
 }
 
 Val ImportExp::evaluate(Env env) {
@@ -754,13 +842,13 @@ Val ImportExp::evaluate(Env env) {
         Val tmp = env->apply(name);
         if (tmp) tmp->add_ref();
 
-        env->set(name, mod);
+        env->bind(slot, name, mod);
         
         // Evaluate the subexpression.
         Val v = exp->evaluate(env);
 
         // Garbage collection
-        env->rem(name);
+        env->unbind(slot, name);
         if (tmp) {
             env->set(name, tmp);
             tmp->rem_ref();
@@ -781,7 +869,6 @@ Val InputExp::evaluate(Env) {
     return new StringVal(s);
 }
 
-Val IntExp::evaluate(Env) { return new IntVal(val); }
 
 bool static_typecheck(Val val, Type *type) {
     if (isVal<IntVal>(val))
@@ -818,7 +905,7 @@ Val IsaExp::evaluate(Env env) {
     if (!val) return NULL;
     
     // Compare the object type with the sought type
-    auto res = new BoolVal(static_typecheck(val, type));
+    auto res = BoolVal::of(static_typecheck(val, type));
     
     // GC
     val->rem_ref();
@@ -830,15 +917,24 @@ Val LambdaExp::evaluate(Env env) {
     int argc;
     for (argc = 0; xs[argc] != ""; argc++);
 
-    string *ids = new string[argc+1];
+    Symbol *ids = new Symbol[argc+1];
     ids[argc] = "";
     while (argc--) ids[argc] = xs[argc];
     
-    env->add_ref();
-    return new LambdaVal(ids, exp->clone(), env);
+    // The closure holds only the free variables of the body, unless the
+    // postprocessor found that it must see the entire environment.
+    Env E = LambdaVal::capture(env, flat ? &captures : NULL);
+    LambdaVal *res = new LambdaVal(ids, exp->clone(), E);
+    res->setMemo(memo);
+    res->setFrame(frame);
+    if (flat) res->setCaptures(captures);
+    return res;
 }
 
 Val LetExp::evaluate(Env env) {
+    return box(evaluate_imm(env));
+}
+Imm LetExp::evaluate_scoped(Env env, bool tail) {
     int argc = 0;
     for (; exps[argc]; argc++);
 
@@ -849,21 +945,22 @@ Val LetExp::evaluate(Env env) {
     // Extend the environment
     for (int i = 0; i < argc; i++) {
         // Compute the expression
-        Val v = exps[i]->evaluate(env);
+        Imm v = exps[i]->evaluate_imm(env);
 
-        if (!v) {
+        if (v.kind == Imm::FAIL) {
             // Garbage collect and escape
             while (i--)
-                env->rem(ids[i]);
-            return NULL;
+                env->unbind(slots ? slots[i] : -1, ids[i]);
+            return Imm();
         }
 
-        // Add it to the environment
-        Val x = v->clone();
-        env->set(ids[i], x);
+        // Add a copy of it to the environment. Immediates are copied by
+        // placing them on the heap.
+        Val x = v.kind == Imm::BOXED ? v.v->clone() : box(v);
+        env->bind(slots ? slots[i] : -1, ids[i], x);
         
         // Drop references
-        v->rem_ref();
+        release(v);
         x->rem_ref();
 
         // We permit lambdas that request recursion to have it.
@@ -878,11 +975,12 @@ Val LetExp::evaluate(Env env) {
     }
 
     // Compute the result
-    Val y = body->evaluate(env);
+    Imm y = tail ? body->evaluate_tail(env) : body->evaluate_imm(env);
 
-    // Garbage collection
-    while (argc--) {
-        env->rem(ids[argc]);
+    // Garbage collection. A deferred call may still need the variables,
+    // and they are discarded along with the frame after it.
+    while (y.kind != Imm::TAIL && argc--) {
+        env->unbind(slots ? slots[argc] : -1, ids[argc]);
     }
         
     // Return the result
@@ -912,38 +1010,40 @@ Val ListExp::evaluate(Env env) {
 }
 
 Val ListAccessExp::evaluate(Env env) {
-    // Get the list
-    Val f = list->evaluate(env);
-    f = unpack_thunk(f);
+    // Get the list, which is borrowed if the index has no side effects
+    Imm f = unbox(borrow ? list->evaluate_ref(env) : list->evaluate_imm(env));
 
-    if (!f)
+    if (f.kind == Imm::FAIL)
         return NULL;
-    else if (!isVal<ListVal>(f)) {
+    else if (f.kind != Imm::BOXED || !isVal<ListVal>(f.v)) {
         throw_type_err(list, "list");
+        release(f);
         return NULL;
     }
     
     // Get the index
-    Val index = idx->evaluate(env);
-    index = unpack_thunk(index);
+    Imm index = unbox(idx->evaluate_imm(env), f);
 
-    if (!index) return NULL;  
+    if (index.kind == Imm::FAIL) {
+        release(f);
+        return NULL;
+    }
 
     // The list
-    auto vals = (ListVal*) f;
+    auto vals = (ListVal*) f.v;
 
-    if (!isVal<IntVal>(index)) {
+    if (index.kind != Imm::INT) {
             throw_type_err(idx, "integer");
-            f->rem_ref();
+            release(index);
+            release(f);
             return NULL;
     }
-    int i = ((IntVal*) index)->get();
-    index->rem_ref();
+    int i = index.i;
     
     // Bound check
     if (i < 0 || i >= vals->size()) {
         throw_err("runtime", "index " + to_string(i) + " is out of bounds (len: " + to_string(vals->size()) + ")");
-        f->rem_ref();
+        release(f);
         return NULL;
     }
 
@@ -951,33 +1051,33 @@ Val ListAccessExp::evaluate(Env env) {
     Val v = vals->get(i);
 
     v->add_ref();
-    f->rem_ref();
+    release(f);
 
     return v;
 
 }
 
 Val DictAccessExp::evaluate(Env env) {
-    Val f = list->evaluate(env);
-    f = unpack_thunk(f);
+    // Nothing else is evaluated, so the dictionary may be borrowed
+    Imm f = unbox(list->evaluate_ref(env));
 
-    if (!f)
+    if (f.kind == Imm::FAIL)
         return NULL;
-    else if (!isVal<DictVal>(f)) {
+    else if (f.kind != Imm::BOXED || !isVal<DictVal>(f.v)) {
         throw_type_err(list, "dict, list, or string");
-        f->rem_ref();
+        release(f);
         return NULL;
     } else {
-        DictVal *d = (DictVal*) f;
+        DictVal *d = (DictVal*) f.v;
         Val v;
 
         if (d->hasKey(idx)) {
             v = d->get(idx);
             v->add_ref();
         } else
-            v = new VoidVal;
+            v = VoidVal::of();
 
-        d->rem_ref();
+        release(f);
         
         return v;
     }
@@ -992,6 +1092,7 @@ Val ListAddExp::evaluate(Env env) {
         return NULL;
     else if (!isVal<ListVal>(f)) {
         throw_type_err(list, "list");
+        f->rem_ref();
         return NULL;
     }
     auto vals = (ListVal*) f;
@@ -1000,22 +1101,30 @@ Val ListAddExp::evaluate(Env env) {
     Val index = idx->evaluate(env);
     index = unpack_thunk(index);
 
-    if (!index) return NULL;
-    else if (!isVal<IntVal>(index)) {
+    if (!index) {
+        f->rem_ref();
+        return NULL;
+    } else if (!isVal<IntVal>(index)) {
         throw_type_err(idx, "integer");
+        f->rem_ref();
+        index->rem_ref();
         return NULL;
     }
     int i = ((IntVal*) index)->get();
+    index->rem_ref();
 
     // Compute the value
     Val val = elem->evaluate(env);
-    if (!index)
+    if (!val) {
+        f->rem_ref();
         return NULL;
+    }
     
-    // Remove and return the item
+    // Insert the item, which the list takes over
     vals->add(i, val);
+    f->rem_ref();
 
-    return new VoidVal;
+    return VoidVal::of();
 }
 
 Val ListRemExp::evaluate(Env env) {
@@ -1027,6 +1136,7 @@ Val ListRemExp::evaluate(Env env) {
         return NULL;
     else if (!isVal<ListVal>(f)) {
         throw_type_err(list, "list");
+        f->rem_ref();
         return NULL;
     }
     auto vals = (ListVal*) f;
@@ -1035,46 +1145,56 @@ Val ListRemExp::evaluate(Env env) {
     Val index = idx->evaluate(env);
     index = unpack_thunk(index);
 
-    if (!index) return NULL;
-    else if (!isVal<IntVal>(index)) {
+    if (!index) {
+        f->rem_ref();
+        return NULL;
+    } else if (!isVal<IntVal>(index)) {
         throw_type_err(idx, "integer");
+        f->rem_ref();
+        index->rem_ref();
         return NULL;
     }
     int i = ((IntVal*) index)->get();
+    index->rem_ref();
     
     // Remove and return the item
-    return vals->remove(i);
+    Val v = vals->remove(i);
+    f->rem_ref();
+
+    return v;
 }
 
 Val ListSliceExp::evaluate(Env env) {
-    // Get the list
-    Val lst = list->evaluate(env);
-    lst = unpack_thunk(lst);
+    // Get the list, which is borrowed if the bounds have no side effects
+    Imm lst = unbox(borrow ? list->evaluate_ref(env) : list->evaluate_imm(env));
 
-    if (!lst)
+    if (lst.kind == Imm::FAIL)
         return NULL;
-    else if (!isVal<ListVal>(lst)) {
+    else if (lst.kind != Imm::BOXED || !isVal<ListVal>(lst.v)) {
         throw_type_err(list, "list");
-        lst->rem_ref(); // Garbage collection
+        release(lst); // Garbage collection
         return NULL;
     }
     
+    // The list
+    auto vals = (ListVal*) lst.v;
+
     // Get the index
     int i;
     if (from) {
-        Val f = from->evaluate(env);
-        f = unpack_thunk(f);
+        Imm f = unbox(from->evaluate_imm(env), lst);
 
-        if (!f) return NULL;
-        else if (!isVal<IntVal>(f)) {
+        if (f.kind == Imm::FAIL) {
+            release(lst);
+            return NULL;
+        } else if (f.kind != Imm::INT) {
             throw_type_err(from, "integer");
-            lst->rem_ref(); // Garbage collection
-            f->rem_ref();
+            release(lst); // Garbage collection
+            release(f);
             return NULL;
         }
 
-        i = ((IntVal*) f)->get();
-        f->rem_ref();
+        i = f.i;
     } else
         i = 0;
 
@@ -1082,57 +1202,45 @@ Val ListSliceExp::evaluate(Env env) {
     
     if (to) {
         // Get the index
-        Val t = to->evaluate(env);
-        t = unpack_thunk(t);
+        Imm t = unbox(to->evaluate_imm(env), lst);
 
-        if (!t) return NULL;
-        else if (!isVal<IntVal>(t)) {
+        if (t.kind == Imm::FAIL) {
+            release(lst);
+            return NULL;
+        } else if (t.kind != Imm::INT) {
             throw_type_err(to, "integer");
-            lst->rem_ref(); // Garbage collection
-            t->rem_ref();
+            release(lst); // Garbage collection
+            release(t);
             return NULL;
         }
 
-        j = ((IntVal*) t)->get();
-        t->rem_ref();
-    } else if (isVal<ListVal>(lst))
-        j = ((ListVal*) lst)->size();
-    else
-        j = lst->toString().length();
-    
-    // The list
-    auto vals = (ListVal*) lst;
+        j = t.i;
+    } else
+        j = vals->size();
 
     if (i < 0 || j < 0 || i >= vals->size() || j > vals->size()) {
         throw_err("runtime", "index " + to_string(i) + " is out of bounds (len: " + to_string(vals->size()) + ")");
-        lst->rem_ref();
+        release(lst);
         return NULL;
     }
 
-    // Get the item
-    Val *vs = new Val[j - i];
-    
-    for (int x = i; x < j; x++) {
-        // Add the value and a reference to it
-        vs[x-i] = vals->get(x);
-        vs[x-i]->add_ref();
-    }
+    // The slice shares the elements of the list
+    ListVal *res = vals->slice(i, j);
     
     // Garbage collection
-    lst->rem_ref();
+    release(lst);
     
-    // Generate and return the list.
-    return new ListVal(vs, j-i);
+    return res;
 }
 
 Val MagnitudeExp::op(Val v) {
     if (isVal<IntVal>(v)) {
         // Magnitude of number is its absolute value
-        int val = ((IntVal*) v)->get();
+        integer_t val = ((IntVal*) v)->get();
         return new IntVal(val > 0 ? val : -val);
     } else if (isVal<RealVal>(v)) {
         // Magnitude of number is its absolute value
-        float val = ((RealVal*) v)->get();
+        real_t val = ((RealVal*) v)->get();
         return new RealVal(val > 0 ? val : -val);
     } else if (isVal<ListVal>(v)) {
         // Magnitude of list is its length
@@ -1224,20 +1332,48 @@ Val MapExp::evaluate(Env env) {
     }
 }
 
+/**
+ * Computes the square norm of a tensor, summing over each row in turn as
+ * sqnorm does.
+ * @param t The tensor.
+ * @param i The index of the first number of the row.
+ * @param d The depth of the row.
+ */
+static real_t sqnorm(Tensor *t, int i, int d) {
+    int n = 1;
+    for (int k = d+1; k < t->rank(); k++)
+        n *= t->shape[k];
+
+    real_t sum = 0;
+    for (int k = 0; k < t->shape[d]; k++) {
+        int j = i + k*n;
+        if (d+1 < t->rank())
+            sum += sqnorm(t, j, d+1);
+        else if (t->real)
+            sum += t->reals[j] * t->reals[j];
+        else
+            sum += t->ints[j] * t->ints[j];
+    }
+
+    return sum;
+}
 Val sqnorm(Val v) {
     if (isVal<IntVal>(v)) {
         // Magnitude of number is its absolute value
-        int val = ((IntVal*) v)->get();
+        integer_t val = ((IntVal*) v)->get();
         return new IntVal(val * val);
     } else if (isVal<RealVal>(v)) {
         // Magnitude of number is its absolute value
-        int val = ((RealVal*) v)->get();
+        real_t val = ((RealVal*) v)->get();
         return new RealVal(val * val);
     } else if (isVal<ListVal>(v)) {
         // Magnitude of list is its length
         auto lst = (ListVal*) v;
 
-        float sum = 0;
+        if (Tensor *t = lst->tensor())
+            return new RealVal(sqnorm(t, 0, 0));
+
+        real_t sum = 0;
         
         for (int i = 0; i < lst->size(); i++) {
             Val v = sqnorm(lst->get(i));
@@ -1281,26 +1417,29 @@ Val NotExp::op(Val v) {
     } else {
         BoolVal *B = (BoolVal*) v;
         bool b = B->get();
-        return new BoolVal(!b);
+        return BoolVal::of(!b);
     }
 }
 
 Val OperatorExp::evaluate(Env env) {
-    Val a = left->evaluate(env);
-    a = unpack_thunk(a);
+    return box(evaluate_imm(env));
+}
+Imm OperatorExp::evaluate_imm(Env env) {
+    // The left operand is borrowed if the right one has no side effects,
+    // and the right one always is, as nothing is evaluated after it
+    Imm a = unbox(borrow ? left->evaluate_ref(env) : left->evaluate_imm(env));
 
-    if (!a) return NULL;
+    if (a.kind == Imm::FAIL) return a;
 
-    Val b = right->evaluate(env);
-    b = unpack_thunk(b);
+    Imm b = unbox(right->evaluate_ref(env), a);
 
-    if (!b) {
-        a->rem_ref();
-        return NULL;
+    if (b.kind == Imm::FAIL) {
+        release(a);
+        return b;
     } else {
-        Val res = op(a, b);
-        a->rem_ref();
-        b->rem_ref();
+        Imm res = apply(a, b);
+        release(a);
+        release(b);
         return res;
     }
 }
@@ -1321,23 +1460,29 @@ Val PrintExp::evaluate(Env env) {
 
     std::cout << s << "\n";
 
-    return new VoidVal;
+    return VoidVal::of();
 }
 
-Val RealExp::evaluate(Env) { return new RealVal(val); }
 
 Val SequenceExp::evaluate(Env env) {
-    Val v = NULL;
+    return box(evaluate_imm(env));
+}
+Imm SequenceExp::evaluate_imm(Env env) {
+    return resolve_tail(evaluate_tail(env));
+}
+Imm SequenceExp::evaluate_tail(Env env) {
+    Imm v;
     
     // For each expression in the sequence...
     auto it = seq->iterator();
     do {
-        // Compute it and store it.
-        if (v) v->rem_ref();
-        v = it->next()->evaluate(env);
-    } while (it->hasNext() && v); // End the loop early if an error occurs.
+        // Compute it and store it. Only the last is in tail position.
+        release(v);
+        Exp e = it->next();
+        v = it->hasNext() ? e->evaluate_imm(env) : e->evaluate_tail(env);
+    } while (it->hasNext() && v.kind != Imm::FAIL); // End the loop early if an error occurs.
     
-    // Return the final outcome, or NULL if one of
+    // Return the final outcome, or a failure if one of
     // the executions fails.
     delete it;
     return v;
@@ -1382,8 +1527,11 @@ Val SetExp::evaluate(Env env) {
             } else {
                 v->add_ref();
 
-                lst->remove(idx)->rem_ref();
-                lst->add(idx, v);
+                // The element is replaced in place, which keeps a dense
+                // list dense if the value is a number of the same kind
+                Val old = lst->get(idx);
+                lst->set(idx, v);
+                old->rem_ref();
                 lst->rem_ref();
             }
         
@@ -1440,12 +1588,7 @@ Val SetExp::evaluate(Env env) {
     
     } else if (isExp<VarExp>(tgt)) {
         // We are attempting to perform direct assignment to a variable
-        VarExp *var = (VarExp*) tgt;
-        
-        v = exp->evaluate(env);
-        if (!v) return NULL;
-        
-        env->set(var->toString(), v);
+        return box(evaluate_imm(env));
 
     } else if (configuration.werror) {
         throw_err("runtime", "assigning to right-handish expression '" + tgt->toString() + "' is unsafe");
@@ -1477,6 +1620,34 @@ Val SetExp::evaluate(Env env) {
     return v;
 }
 
+Imm SetExp::evaluate_imm(Env env) {
+    if (!isExp<VarExp>(tgt))
+        return Expression::evaluate_imm(env);
+    
+    VarExp *var = (VarExp*) tgt;
+
+    Imm x = exp->evaluate_imm(env);
+    if (x.kind == Imm::FAIL) return x;
+
+    // A number that only this frame can see is overwritten in place
+    if (var->getDepth() == 0) {
+        Val v = env->lookup(var->getSlot(), var->getId());
+        if (v && v->is_unique() && assign(v, x))
+            return x;
+    }
+
+    Val v = x.kind == Imm::BOXED ? x.v : box(x);
+    
+    // Variables of enclosing frames are shadowed rather than modified
+    if (var->getDepth() == 0)
+        env->bind(var->getSlot(), var->getId(), v);
+    else
+        env->set(var->getId(), v);
+    
+    if (x.kind != Imm::BOXED) v->rem_ref();
+    return x;
+}
+
 Val StdMathExp::evaluate(Env env) {
     Val v = e->evaluate(env);
     if (!v) return NULL;
@@ -1654,7 +1825,7 @@ Val StdMathExp::evaluate(Env env) {
 
 }
 
-Val TrueExp::evaluate(Env) { return new BoolVal(true); }
+Val TrueExp::evaluate(Env) { return BoolVal::of(true); }
 
 Val TupleExp::evaluate(Env env) {
     Val l = left->evaluate(env);
@@ -1667,28 +1838,29 @@ Val TupleExp::evaluate(Env env) {
 }
 
 Val TupleAccessExp::evaluate(Env env) {
-    Val val = exp->evaluate(env);
+    // Nothing else is evaluated, so the tuple may be borrowed
+    Imm val = exp->evaluate_ref(env);
 
-    if (!val) return NULL;
-    else if (!isVal<TupleVal>(val)) {
+    if (val.kind == Imm::FAIL) return NULL;
+    else if (val.kind != Imm::BOXED || !isVal<TupleVal>(val.v)) {
         throw_type_err(exp, "tuple");
-        val->rem_ref();
+        release(val);
         return NULL;
     }
     
-    TupleVal *tup = (TupleVal*) val;
+    TupleVal *tup = (TupleVal*) val.v;
 
     Val Y = idx ? tup->getRight() : tup->getLeft();
     
     // Memory mgt
     Y->add_ref();
-    tup->rem_ref();
+    release(val);
 
     return Y;
 }
 
 Val VarExp::evaluate(Env env) {
-    Val res = env->apply(id);
+    Val res = env->apply(id, depth, slot);
     if (!res) {
         throw_err("runtime", "variable '" + id + "' was not recognized");
         return NULL;
@@ -1697,36 +1869,79 @@ Val VarExp::evaluate(Env env) {
         return res;
     }
 }
+Imm VarExp::evaluate_imm(Env env) {
+    Val res = env->apply(id, depth, slot);
+    if (!res) {
+        throw_err("runtime", "variable '" + id + "' was not recognized");
+        return Imm();
+    } 
+    
+    // Numbers are copied out rather than referenced
+    switch (res->kind) {
+        case VAL_INT: return Imm(((IntVal*) res)->get());
+        case VAL_REAL: return Imm(((RealVal*) res)->get());
+        case VAL_BOOL: return Imm(((BoolVal*) res)->get());
+        default:
+            res->add_ref();
+            return Imm(res);
+    }
+}
+Imm VarExp::evaluate_ref(Env env) {
+    Val res = env->apply(id, depth, slot);
+    if (!res) {
+        throw_err("runtime", "variable '" + id + "' was not recognized");
+        return Imm();
+    }
+
+    switch (res->kind) {
+        case VAL_INT: return Imm(((IntVal*) res)->get());
+        case VAL_REAL: return Imm(((RealVal*) res)->get());
+        case VAL_BOOL: return Imm(((BoolVal*) res)->get());
+        case VAL_THUNK:
+            // Thunks are consumed as they are unpacked
+            res->add_ref();
+            return Imm(res);
+        default: {
+            Imm x(res);
+            x.borrowed = true;
+            return x;
+        }
+    }
+}
 
 Val WhileExp::evaluate(Env env) {
+    return box(evaluate_imm(env));
+}
+Imm WhileExp::evaluate_imm(Env env) {
     bool skip = alwaysEnter;
 
     while (true) {
-        Val c = skip ? new BoolVal(true) : cond->evaluate(env);
-        c = unpack_thunk(c);
+        Imm c = skip ? Imm(true) : unbox(cond->evaluate_imm(env));
 
         skip = false; // Do not do do-while from now on.
 
-        if (!isVal<BoolVal>(c)) {
+        if (c.kind == Imm::FAIL)
+            return c;
+        else if (c.kind != Imm::BOOL) {
             throw_type_err(cond, "boolean");
-            return NULL;
+            release(c);
+            return Imm();
         }
         
-        bool cond = ((BoolVal*) c)->get();
-        c->rem_ref();
-        
-        if (cond) {
-            // Compute the new outcome. If it is
-            // NULL, computation failed, so NULL
-            // should be returned.
-            Val v = body->evaluate(env);
-            if (!v)
-                return NULL;
+        if (c.b) {
+            // Compute the new outcome. If it fails,
+            // then so does the loop.
+            Imm v = body->evaluate_imm(env);
+            if (v.kind == Imm::FAIL)
+                return v;
             else
-                v->rem_ref();
+                release(v);
+
+            if (!gc_safepoint())
+                return Imm();
         } else
             // On success, the return type is void
-            return new VoidVal;
+            return Imm((Val) VoidVal::of());
     }
 }
 
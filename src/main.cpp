@@ -19,6 +19,9 @@ using namespace std;
 #include <readline/history.h>
 
 void execute(string program) {
+    // The memory of the evaluation is reclaimed once its result is shown
+    PoolArena *arena = configuration.arenas ? new PoolArena : NULL;
+
     Val v = run(program);
     v = unpack_thunk(v);
 
@@ -27,6 +30,10 @@ void execute(string program) {
         cout << *v << "\n";
         v->rem_ref();
     }
+
+    // Recursive functions, among others, leave cycles behind
+    collect_cycles();
+    delete arena;
 }
 
 void print_version() {
@@ -35,12 +42,22 @@ void print_version() {
 
     // Compilation time
     cout << "Compiled " << __DATE__ << " @ " << __TIME__ << "\n";
+
+    // Numeric mode
+    cout << "Numbers are " << 8*sizeof(integer_t) << "-bit integers and "
+         << 8*sizeof(real_t) << "-bit reals\n";
 }
 
 void display_config() {
     std::cout << "The following configuration is in use:\n";
+    std::cout << "arenas:    " << configuration.arenas << " (default: 0)\n";
+    std::cout << "engine:    " << (configuration.engine == ENGINE_VM ? "vm" : "ast") << " (default: ast)\n";
+    std::cout << "max depth: " << configuration.max_depth << " (default: 1000000)\n";
+    std::cout << "max heap:  " << configuration.max_heap << " (default: 0)\n";
+    std::cout << "memo size: " << configuration.memo_size << " (default: 4096)\n";
     std::cout << "mod cache: " << configuration.optimization << " (default: 0)\n";
     std::cout << "optimize:  " << configuration.optimization << " (default: 0)\n";
+    std::cout << "threads:   " << configuration.threads << " (default: 1)\n";
     std::cout << "use_types: " << configuration.types << " (default: 0)\n";
     std::cout << "verbosity: " << configuration.verbosity << " (default: 0)\n";
     std::cout << "werror:    " << configuration.werror << " (default: 0)\n";
@@ -129,6 +146,12 @@ int main(int, char *argv[]) {
         execute(program);
     }
     
+    throw_debug("memo", to_string(LambdaVal::memo_hits) + " hits, "
+                      + to_string(LambdaVal::memo_misses) + " misses");
+    throw_debug("pool", pool_stats());
+    throw_debug("gc", gc_stats());
+    throw_debug("heap", heap_stats());
+
     // Clear the cache
     ImportExp::clear_cache();
     
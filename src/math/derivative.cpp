@@ -24,6 +24,23 @@ void print_size(Val v) {
     }
 }
 
+/**
+ * Determines whether or not a number lies on the diagonal of an identity,
+ * which is the case when its indices are symmetric.
+ */
+static bool on_diagonal(List<int> *idx) {
+    if (idx->size() % 2) return false;
+
+    int i, j;
+    for (
+        i = 0, j = idx->size()/2;
+        i < idx->size()/2 && idx->get(i) == idx->get(j);
+        ++i, ++j
+    );
+
+    return j == idx->size();
+}
+
 void resolveIdentity(Val val, List<int> *idx = NULL) {
     if (!val) return;
 
@@ -34,7 +51,16 @@ void resolveIdentity(Val val, List<int> *idx = NULL) {
         
         for (int i = 0; i < lst->size(); i++) {
             idx->add(0, i);
-            resolveIdentity(lst->get(i), idx);
+
+            // Numbers are replaced through the list, which may hold them
+            // in a tensor
+            Val v = lst->get(i);
+            if (val_is_number(v) && on_diagonal(idx)) {
+                lst->set(i, isVal<IntVal>(v) ? (Val) new IntVal(1) : (Val) new RealVal(1));
+                v->rem_ref();
+            } else
+                resolveIdentity(v, idx);
+
             idx->remove(0);
         }
 
@@ -65,23 +91,10 @@ void resolveIdentity(Val val, List<int> *idx = NULL) {
         idx->remove(0);
 
         if (idx->size() == 0) delete idx;
-    } else if (idx->size() % 2 == 0) {
-        
-        // Iterate to check that the indices are symmetric
-        int i, j;
-        for (
-            i = 0, j = idx->size()/2;
-            i < idx->size()/2 && idx->get(i) == idx->get(j);
-            ++i, ++j
-        );
-        
-        // If the indices are symmetric, then apply to the diagonal
-        if (j == idx->size()) {
-            Val one = isVal<IntVal>(val) ? (Val) new IntVal(1) : (Val) new RealVal(1);
-            val->set(one);
-            one->rem_ref();
-        }
-
+    } else if (on_diagonal(idx)) {
+        Val one = isVal<IntVal>(val) ? (Val) new IntVal(1) : (Val) new RealVal(1);
+        val->set(one);
+        one->rem_ref();
     }
 }
 
@@ -145,7 +158,7 @@ Val deriveConstVal(string id, Val v, int c) {
         int i;
         for (i = 0; xs[i] != ""; i++);
 
-        auto ids = new string[i+1];
+        auto ids = new Symbol[i+1];
         ids[i] = "";
         while (i--) ids[i] = xs[i];
 
@@ -438,8 +451,8 @@ Val SwitchExp::derivativeOf(string x, Env env, Env denv) {
     for (xs = 0; A->getArgs()[xs]; xs++);
     
     // Find the right argument set
-    string name = A->getKind();
-    string *ids = NULL;
+    Symbol name = A->getKind();
+    Symbol *ids = NULL;
     int i;
     for (i = 0; !ids && idss[i]; i++) {
         if (names[i] == name) {
@@ -488,7 +501,7 @@ LambdaVal* derive(LambdaVal *func, string x) {
     for (argc = 0; func->getArgs()[argc] != ""; argc++);
     
     // Generate the parameter set.
-    string *inputs = new string[argc+1];
+    Symbol *inputs = new Symbol[argc+1];
     for (int j = 0; j < argc; j++)
         inputs[j] = func->getArgs()[j];
     inputs[argc] = "";
@@ -825,7 +838,7 @@ Val ForExp::derivativeOf(string x, Env env, Env denv) {
     auto dlist = (ListVal*) dlistExp;
     
     // Value to be return
-    Val v = new VoidVal;
+    Val v = VoidVal::of();
     
     for (int i = 0; i < list->size(); i++) {
         // Get the next item from the list
@@ -884,7 +897,7 @@ Val LambdaExp::derivativeOf(string x, Env env, Env) {
     for (argc = 0; xs[argc] != ""; argc++);
     
     // Copy the argument names into new memory
-    string *ids = new string[argc+1];
+    Symbol *ids = new Symbol[argc+1];
     ids[argc] = "";
     while (argc--)
         ids[argc] = xs[argc];
@@ -1784,7 +1797,7 @@ Val VarExp::derivativeOf(string, Env, Env denv) {
 
 Val WhileExp::derivativeOf(string x, Env env, Env denv) {
     bool skip = alwaysEnter;
-    Val v = new VoidVal;
+    Val v = VoidVal::of();
 
     while (true) {
         Val c = cond->evaluate(env);
@@ -0,0 +1,166 @@
+#include "math.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+// The columns and depth of the blocks of the right hand matrix, chosen so
+// that a block (128 KB of 32-bit numbers) stays in the L2 cache while every
+// row of the left hand matrix is multiplied with it
+#define GEMM_COLS 256
+#define GEMM_DEPTH 128
+
+// The rows of a tile, whose sums are held in registers
+#define GEMM_ROWS 4
+
+// The fewest products that are worth giving to a thread
+#define GEMM_GRAIN (1 << 16)
+
+#define INLINE inline __attribute__((always_inline))
+
+/**
+ * Adds the products over depths [p, q) to a tile of R rows and 2W columns
+ * of the result, where W is the number of values in a vector register. The
+ * sums of the tile are loaded once, and each is added to in order of depth.
+ */
+template<typename T, int W, int R>
+static INLINE void tile(const T *a, const T *b, T *c, int k, int n, int p, int q) {
+    typedef T vec __attribute__((vector_size(W * sizeof(T))));
+
+    vec acc[R][2];
+    for (int r = 0; r < R; r++) {
+        memcpy(&acc[r][0], c + r*n, sizeof(vec));
+        memcpy(&acc[r][1], c + r*n + W, sizeof(vec));
+    }
+
+    for (; p < q; p++) {
+        vec u, v;
+        memcpy(&u, b + p*n, sizeof(vec));
+        memcpy(&v, b + p*n + W, sizeof(vec));
+
+        for (int r = 0; r < R; r++) {
+            T x = a[r*k + p];
+            acc[r][0] += x * u;
+            acc[r][1] += x * v;
+        }
+    }
+
+    for (int r = 0; r < R; r++) {
+        memcpy(c + r*n, &acc[r][0], sizeof(vec));
+        memcpy(c + r*n + W, &acc[r][1], sizeof(vec));
+    }
+}
+
+/**
+ * Multiplies in blocks of the right hand matrix and tiles of the result.
+ * The blocks of depth are visited in order, so each entry sums its
+ * products in the same order as the naive product does.
+ */
+template<typename T, int W>
+static INLINE void blocked(const T *a, const T *b, T *c, int m, int k, int n, bool zero) {
+    int start = zero ? 0 : 1;
+
+    for (int i = 0; i < m; i++)
+        for (int j = 0; j < n; j++)
+            c[i*n + j] = zero ? 0 : a[i*k] * b[j];
+
+    for (int jb = 0; jb < n; jb += GEMM_COLS) {
+        int je = min(n, jb + GEMM_COLS);
+
+        for (int pb = start; pb < k; pb += GEMM_DEPTH) {
+            int pe = min(k, pb + GEMM_DEPTH);
+
+            for (int i = 0; i < m; i += GEMM_ROWS) {
+                int rows = min(GEMM_ROWS, m - i);
+                const T *ai = a + i*k;
+                T *ci = c + i*n;
+
+                int j = jb;
+                for (; j + 2*W <= je; j += 2*W) {
+                    if (rows == GEMM_ROWS)
+                        tile<T, W, GEMM_ROWS>(ai, b + j, ci + j, k, n, pb, pe);
+                    else for (int r = 0; r < rows; r++)
+                        tile<T, W, 1>(ai + r*k, b + j, ci + r*n + j, k, n, pb, pe);
+                }
+
+                // The columns that do not fill a tile
+                for (int r = 0; r < rows; r++)
+                    for (int jj = j; jj < je; jj++) {
+                        T v = ci[r*n + jj];
+                        for (int p = pb; p < pe; p++)
+                            v += ai[r*k + p] * b[p*n + jj];
+                        ci[r*n + jj] = v;
+                    }
+            }
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// Variants for extensions of the instruction set, chosen by CPUID. None of
+// them fuse multiplications with additions, which would round differently.
+__attribute__((target("avx2")))
+static void gemm_avx2(const integer_t *a, const integer_t *b, integer_t *c, int m, int k, int n, bool zero) {
+    blocked<integer_t, 32 / sizeof(integer_t)>(a, b, c, m, k, n, zero);
+}
+
+__attribute__((target("sse4.1")))
+static void gemm_sse41(const integer_t *a, const integer_t *b, integer_t *c, int m, int k, int n, bool zero) {
+    blocked<integer_t, 16 / sizeof(integer_t)>(a, b, c, m, k, n, zero);
+}
+
+__attribute__((target("avx")))
+static void gemm_avx(const real_t *a, const real_t *b, real_t *c, int m, int k, int n, bool zero) {
+    blocked<real_t, 32 / sizeof(real_t)>(a, b, c, m, k, n, zero);
+}
+
+#endif
+
+static void gemm_base(const integer_t *a, const integer_t *b, integer_t *c, int m, int k, int n, bool zero) {
+    blocked<integer_t, 16 / sizeof(integer_t)>(a, b, c, m, k, n, zero);
+}
+
+static void gemm_base(const real_t *a, const real_t *b, real_t *c, int m, int k, int n, bool zero) {
+    blocked<real_t, 16 / sizeof(real_t)>(a, b, c, m, k, n, zero);
+}
+
+typedef void (*gemm_int_t)(const integer_t*, const integer_t*, integer_t*, int, int, int, bool);
+typedef void (*gemm_real_t)(const real_t*, const real_t*, real_t*, int, int, int, bool);
+
+static gemm_int_t select_int() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return gemm_avx2;
+    else if (__builtin_cpu_supports("sse4.1"))
+        return gemm_sse41;
+#endif
+    return gemm_base;
+}
+
+static gemm_real_t select_real() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx"))
+        return gemm_avx;
+#endif
+    return gemm_base;
+}
+
+// The rows of the result are divided among threads (see parallel_for)
+void gemm(const integer_t *a, const integer_t *b, integer_t *c, int m, int k, int n, bool zero) {
+    static gemm_int_t f = select_int();
+    parallel_for(m, GEMM_GRAIN / (k*n + 1) + 1, [&](int i, int j) {
+        f(a + i*k, b, c + i*n, j - i, k, n, zero);
+    });
+}
+
+void gemm(const real_t *a, const real_t *b, real_t *c, int m, int k, int n, bool zero) {
+    static gemm_real_t f = select_real();
+    parallel_for(m, GEMM_GRAIN / (k*n + 1) + 1, [&](int i, int j) {
+        f(a + i*k, b, c + i*n, j - i, k, n, zero);
+    });
+}
@@ -1,90 +1,46 @@
 #include "math.hpp"
 #include "expression.hpp"
+#include "parallel.hpp"
 
 #include <cmath>
 #include <string>
+#include <type_traits>
 
 using namespace std;
 
+// The fewest numbers that are worth giving to a thread (see parallel_for)
+#define GRAIN (1 << 14)
+
 int is_vector(Val v) {
     if (!isVal<ListVal>(v))
         return 0;
-    ListVal *list = (ListVal*) v;
 
-    auto it = list->iterator();
-    int i;
-    for (i = 0; it->hasNext(); i++) {
-        auto v = it->next();
-        if (!isVal<RealVal>(v) && !isVal<IntVal>(v)) {
-            delete it;
-            return 0;
-        }
-    }
-
-    delete it;
-    return i;
+    const ListShape &s = ((ListVal*) v)->shape();
+    return s.rank == 1 ? s.rows : 0;
 }
 
-int* is_matrix(Val v) {
+bool is_matrix(Val v, int &rows, int &cols) {
     if (!isVal<ListVal>(v))
-        return 0;
-    ListVal *list = (ListVal*) v;
-
-    int cols = 0;
-
-    // Empty lists are not matrices
-    int i;
-    for (i = 0; i < list->size(); i++) {
-        auto v = list->get(i);
-
-        if (isVal<ListVal>(v)) {
-            int c = is_vector((ListVal*) v);
-            if (i == 0) {
-                if (c) {
-                    cols = c;
-                } else {
-                    return NULL;
-                }
-            } else if (!c || c != cols) {
-                return NULL;
-            }
-        } else {
-            return NULL;
-        }
-    }
-
-    int *size = new int[2];
-    size[0] = i;
-    size[1] = cols;
+        return false;
 
-    return size;
+    // An empty list is a matrix without rows
+    ListVal *list = (ListVal*) v;
+    const ListShape &s = list->shape();
+    rows = s.rows;
+    cols = s.cols;
+    return s.rank == 2 || list->isEmpty();
 }
 
 int is_square_matrix(Val v) {
     if (!isVal<ListVal>(v))
         return 0;
-    ListVal *list = (ListVal*) v;
-
-    // Empty lists are not matrices
-    int i;
-    for (i = 0; i < list->size(); i++) {
-        Val row =list->get(i);
-
-        if (isVal<ListVal>(row)) {
-            int c = is_vector((ListVal*) row);
-            if (!c || c != list->size()) {
-                return 0;
-            }
-        } else {
-            return 0;
-        }
-    }
 
-    return list->size();
+    const ListShape &s = ((ListVal*) v)->shape();
+    return s.rank == 2 && s.rows == s.cols ? s.rows : 0;
 }
 
 // Perform Gaussian elimination on an n x n matrix
-bool mtrx_inv(float** mtrx, int n) {
+bool mtrx_inv(real_t** mtrx, int n) {
     // First, we aim to make the initial matrix upper triangular.
     // This is the only stage in which we will discover whether or
     // not our matrix is singular.
@@ -126,22 +82,226 @@ bool mtrx_inv(float** mtrx, int n) {
 }
 
 // For building representations of vectors and matrices
-float* extract_vector(ListVal *list) {
-    float *vec = new float[list->size()];
+real_t* extract_vector(ListVal *list, int cols) {
+    real_t *vec = new real_t[cols]();
     for (int i = 0; i < list->size(); i++) {
         Val v = list->get(i);
         vec[i] = isVal<RealVal>(v) ? ((RealVal*) v)->get() : ((IntVal*) v)->get();
     }
     return vec;
 }
-float** extract_matrix(ListVal *list) {
-    float **vec = new float*[list->size()];
+real_t** extract_matrix(ListVal *list, int cols) {
+    real_t **vec = new real_t*[list->size()];
+
+    // The numbers of a tensor are copied directly
+    if (Tensor *t = list->tensor()) {
+        int n = t->shape[1];
+        for (int i = 0; i < t->shape[0]; i++) {
+            vec[i] = new real_t[cols]();
+            for (int j = 0; j < n; j++)
+                vec[i][j] = t->at(i*n + j);
+        }
+        return vec;
+    }
+
     for (int i = 0; i < list->size(); i++) {
-        vec[i] = extract_vector((ListVal*) list->get(i));
+        vec[i] = extract_vector((ListVal*) list->get(i), cols);
     }
     return vec;
 }
 
+/**
+ * Finds the numbers of a tensor as reals, converting integers as
+ * arithmetic between an integer and a real would.
+ * @param t The tensor.
+ * @param tmp Holds the converted numbers of a tensor of integers.
+ */
+static const real_t* reals(Tensor *t, vector<real_t> &tmp) {
+    if (t->real) return t->reals.data();
+    tmp.assign(t->ints.begin(), t->ints.end());
+    return tmp.data();
+}
+
+/**
+ * Combines two tensors of the same shape number by number.
+ * @return The result, or NULL if either list is not a tensor of numbers
+ *         or their shapes differ.
+ */
+template<typename F>
+static Val tensor_elementwise(ListVal *A, ListVal *B, F f) {
+    Tensor ta, tb;
+    Tensor *a = Tensor::of(A, ta);
+    Tensor *b = a ? Tensor::of(B, tb) : NULL;
+    if (!b || a->shape != b->shape) return NULL;
+
+    Tensor *c = new Tensor;
+    c->shape = a->shape;
+
+    int n = a->length();
+    if (!a->real && !b->real) {
+        const integer_t *x = a->ints.data();
+        const integer_t *y = b->ints.data();
+        integer_t *z = (c->ints.resize(n), c->ints.data());
+        parallel_for(n, GRAIN, [&](int i, int j) {
+            for (; i < j; i++)
+                z[i] = f(x[i], y[i]);
+        });
+    } else {
+        vector<real_t> ua, ub;
+        const real_t *x = reals(a, ua);
+        const real_t *y = reals(b, ub);
+
+        c->real = true;
+        real_t *z = (c->reals.resize(n), c->reals.data());
+        parallel_for(n, GRAIN, [&](int i, int j) {
+            for (; i < j; i++)
+                z[i] = f(x[i], y[i]);
+        });
+    }
+
+    return new ListVal(c);
+}
+
+/**
+ * Applies an operation between each number of a tensor and a number.
+ * @return The result, or NULL if the list is not a tensor of numbers.
+ */
+template<typename F>
+static Val tensor_scalar(ListVal *A, Val y, F f) {
+    Tensor ta;
+    Tensor *a = Tensor::of(A, ta);
+    if (!a) return NULL;
+
+    Tensor *c = new Tensor;
+    c->shape = a->shape;
+
+    int n = a->length();
+    if (!a->real && isVal<IntVal>(y)) {
+        integer_t v = ((IntVal*) y)->get();
+        const integer_t *x = a->ints.data();
+        integer_t *z = (c->ints.resize(n), c->ints.data());
+        parallel_for(n, GRAIN, [&](int i, int j) {
+            for (; i < j; i++)
+                z[i] = f(x[i], v);
+        });
+    } else {
+        real_t v = isVal<IntVal>(y) ? ((IntVal*) y)->get() : ((RealVal*) y)->get();
+        vector<real_t> ua;
+        const real_t *x = reals(a, ua);
+
+        c->real = true;
+        real_t *z = (c->reals.resize(n), c->reals.data());
+        parallel_for(n, GRAIN, [&](int i, int j) {
+            for (; i < j; i++)
+                z[i] = f(x[i], v);
+        });
+    }
+
+    return new ListVal(c);
+}
+
+/**
+ * Multiplies two tensors of rank at most two as vectors and matrices.
+ * @return The product, or NULL if either list is not such a tensor of
+ *         numbers or their dimensions do not match.
+ */
+static Val tensor_mult(ListVal *A, ListVal *B) {
+    Tensor ta, tb;
+    Tensor *a = Tensor::of(A, ta);
+    Tensor *b = a ? Tensor::of(B, tb) : NULL;
+    if (!b || a->rank() > 2 || b->rank() > 2)
+        return NULL;
+
+    // A vector on the left is a row, and one on the right is a column
+    int m = a->rank() == 2 ? a->shape[0] : 1;
+    int k = a->shape.back();
+    int n = b->rank() == 2 ? b->shape[1] : 1;
+    if (k != b->shape[0])
+        return NULL;
+
+    Tensor *c = new Tensor;
+    if (a->rank() == 2) c->shape.push_back(m);
+    if (b->rank() == 2) c->shape.push_back(n);
+
+    // Products with a vector on the right are dot products
+    bool zero = b->rank() == 1;
+    if (!a->real && !b->real) {
+        c->ints.resize(m*n);
+        gemm(a->ints.data(), b->ints.data(), c->ints.data(), m, k, n, zero);
+    } else {
+        vector<real_t> ua, ub;
+        c->real = true;
+        c->reals.resize(m*n);
+        gemm(reals(a, ua), reals(b, ub), c->reals.data(), m, k, n, zero);
+    }
+
+    if (c->rank())
+        return new ListVal(c);
+
+    // The dot product of two vectors is a number
+    Val res = c->real ? (Val) new RealVal(c->reals[0]) : (Val) new IntVal(c->ints[0]);
+    delete c;
+    return res;
+}
+
+/**
+ * Computes the deep dot product of two tensors of the same shape, summing
+ * over each row in turn, as dot does.
+ */
+template<typename T>
+static T tensor_dot(const T *a, const T *b, const int *shape, int rank) {
+    if (rank == 1) {
+        T v = a[0] * b[0];
+        for (int i = 1; i < shape[0]; i++)
+            v += a[i] * b[i];
+        return v;
+    }
+
+    int n = 1;
+    for (int i = 1; i < rank; i++)
+        n *= shape[i];
+
+    // The rows are summed apart, and their sums added in order
+    vector<T> sums(shape[0]);
+    parallel_for(shape[0], GRAIN / n + 1, [&](int i, int j) {
+        for (; i < j; i++)
+            sums[i] = tensor_dot(a + i*n, b + i*n, shape+1, rank-1);
+    });
+
+    T v = sums[0];
+    for (int i = 1; i < shape[0]; i++)
+        v += sums[i];
+    return v;
+}
+
+/**
+ * Computes the deep dot product of two tensors of integers. Their sums
+ * wrap around, so a vector may also be split among threads without
+ * changing its sum.
+ */
+static integer_t int_dot(const integer_t *a, const integer_t *b, const int *shape, int rank) {
+    typedef make_unsigned<integer_t>::type word;
+
+    if (rank > 1 || shape[0] < 2*GRAIN)
+        return tensor_dot(a, b, shape, rank);
+
+    vector<word> sums(shape[0] / GRAIN);
+    parallel_for(sums.size(), 1, [&](int i, int j) {
+        for (; i < j; i++) {
+            int k = i * GRAIN;
+            int e = i + 1 < (int) sums.size() ? k + GRAIN : shape[0];
+            word v = 0;
+            for (; k < e; k++)
+                v += (word) a[k] * (word) b[k];
+            sums[i] = v;
+        }
+    });
+
+    word v = 0;
+    for (word x : sums) v += x;
+    return v;
+}
+
 bool is_negligible_mtrx(ListVal *mtrx, double eps = 1e-4) {
     auto it = mtrx->iterator();
     while (it->hasNext()) {
@@ -152,7 +312,7 @@ bool is_negligible_mtrx(ListVal *mtrx, double eps = 1e-4) {
             if (isVal<IntVal>(v)) {
                 return 0 == ((IntVal*) v)->get();
             } else {
-                float f = ((RealVal*) v)->get();
+                real_t f = ((RealVal*) v)->get();
                 return f*f <= eps*eps;
             }
         }
@@ -168,6 +328,19 @@ Val dot(Val A, Val B) {
     } else if (isVal<ListVal>(A) && isVal<ListVal>(B)) {
         ListVal *lA = (ListVal*) A;
         ListVal *lB = (ListVal*) B;
+
+        // Tensors of the same shape are multiplied on their numbers
+        Tensor ta, tb;
+        Tensor *a = Tensor::of(lA, ta);
+        Tensor *b = a ? Tensor::of(lB, tb) : NULL;
+        if (b && a->shape == b->shape) {
+            if (!a->real && !b->real)
+                return new IntVal(int_dot(a->ints.data(), b->ints.data(), a->shape.data(), a->rank()));
+
+            vector<real_t> ua, ub;
+            return new RealVal(tensor_dot(reals(a, ua), reals(b, ub), a->shape.data(), a->rank()));
+        }
+
         if (lA->size() != lB->size()) {
             throw_err("runtime", "cannot compute arbitrary dot product of " + A->toString() + " and " + B->toString() + " because size mismatch");
             return NULL;
@@ -210,12 +383,11 @@ Val exp(Val v) {
         return new RealVal(exp(((IntVal*) v)->get()));
     else if (isVal<ListVal>(v)) {
         // Perhaps a matrix
-        int *dim = is_matrix((ListVal*) v);
-        if (!dim) {
+        int dim[2];
+        if (!is_matrix(v, dim[0], dim[1])) {
             throw_err("runtime", "exponentiation is not defined on " + v->toString());
             return NULL;
         } else if (dim[0] != dim[1]) {
-            delete[] dim;
             throw_err("runtime", "exponentiation is not defined on non-square matrix " + v->toString());
             return NULL;
         }
@@ -283,27 +455,26 @@ Val log(Val v) {
         return new RealVal(log(((IntVal*) v)->get()));
     else {
         // Perhaps a matrix
-        int *dim = is_matrix((ListVal*) v);
-        if (!dim) {
+        int dim[2];
+        if (!is_matrix(v, dim[0], dim[1])) {
             throw_err("runtime", "logarithm is not defined on " + v->toString());
             return NULL;
         } else if (dim[0] != dim[1]) {
             throw_err("runtime", "logarithm is not defined on non-square matrix " + v->toString());
-            delete[] dim;
             return NULL;
         }
 
         // Initialize Xn = I
         auto I = new ListVal;
         // We will also compute the norm
-        float norm = 0;
+        real_t norm = 0;
         for (int i = 0; i < dim[0]; i++) {
             auto row = new ListVal;
             I->add(i, row);
             for (int j = 0; j < dim[0]; j++) {
                 // Update the norm
                 Val x = ((ListVal*) ((ListVal*) v)->get(i))->get(j);
-                float f = isVal<RealVal>(x) ? ((RealVal*) x)->get() : ((IntVal*) x)->get();
+                real_t f = isVal<RealVal>(x) ? ((RealVal*) x)->get() : ((IntVal*) x)->get();
                 norm += f*f;
 
                 row->add(j, new IntVal(i == j ? 1 : 0));
@@ -318,7 +489,7 @@ Val log(Val v) {
             // within the bounds of natural log taylor poly (|x| < 1)
             //std::cout << "sqnorm is " << norm << "\n";
 
-            float a = norm;
+            real_t a = norm;
 
             //std::cout << "let a = " << a << "\n";
 
@@ -329,7 +500,7 @@ Val log(Val v) {
                 for (int j = 0; j < dim[0]; j++) {
                     // Update the norm
                     Val x = ((ListVal*) ((ListVal*) v)->get(i))->get(j);
-                    float f = isVal<RealVal>(x) ? ((RealVal*) x)->get() : ((IntVal*) x)->get();
+                    real_t f = isVal<RealVal>(x) ? ((RealVal*) x)->get() : ((IntVal*) x)->get();
                     row->add(j, new RealVal(f / a));
                 }
             }
@@ -338,7 +509,6 @@ Val log(Val v) {
             A->rem_ref();
 
             if (!logA) {
-                delete[] dim;
                 I->rem_ref();
                 return NULL;
             }
@@ -346,15 +516,13 @@ Val log(Val v) {
             //std::cout << "log(A/a) = " << *logA << "\n";
 
             // Scale I
-            float loga = log(a);
+            real_t loga = log(a);
             //std::cout << "log a = " << loga << "\n";
             for (int i = 0; i < dim[0]; i++) {
                 ((ListVal*) ((ListVal*) I)->get(i))->get(i)->rem_ref();
                 ((ListVal*) ((ListVal*) I)->get(i))->set(i, new RealVal(loga));
             }
 
-            delete[] dim;
-
             //std::cout << "log(aI) = I log a = " << *I << "\n";
 
             auto Y = add(I, logA);
@@ -364,8 +532,6 @@ Val log(Val v) {
              
             return Y;
         }
-
-        delete[] dim;
         
         // 1-x
         Val Xn = sub(v, I);
@@ -425,14 +591,12 @@ Val log(Val v) {
 }
 
 Val identity_matrix(int n) {
-    auto B = new ListVal;
-    for (int i = 0; i < n; i++) {
-        auto L = new ListVal;
-        B->add(i, L);
-        for (int j = 0; j < n; j++)
-            L->add(j, new IntVal(i == j ? 1 : 0));
-    }
-    return B;
+    Tensor *I = new Tensor;
+    I->shape = {n, n};
+    I->ints.resize(n*n);
+    for (int i = 0; i < n; i++)
+        I->ints[i*n + i] = 1;
+    return new ListVal(I);
 }
 
 Val pow(Val b, Val p) {
@@ -447,20 +611,16 @@ Val pow(Val b, Val p) {
             if (isVal<RealVal>(b) || isVal<IntVal>(b))
                 return new IntVal(1);
 
-            auto dim = is_matrix(b);
-            if (!dim) {
+            int dim[2];
+            if (!is_matrix(b, dim[0], dim[1])) {
                 throw_err("runtime", "logarithm is not defined on " + b->toString());
                 return NULL;
             } else if (dim[0] != dim[1]) {
                 throw_err("runtime", "logarithm is not defined on non-square matrix " + b->toString());
-                delete[] dim;
                 return NULL;
             }
 
-            auto I = identity_matrix(dim[0]);
-            delete[] dim;
-
-            return I;
+            return identity_matrix(dim[0]);
 
         } else if (n == 1) {
             // Identity
@@ -470,15 +630,11 @@ Val pow(Val b, Val p) {
             
             // We may need to generate an identity matrix
             if (isVal<ListVal>(b)) {
-                auto dta = is_matrix((ListVal*) b);
-                if (dta && dta[0] == dta[1]) {
-                    v = identity_matrix(dta[0]);
-                    delete dta;
-
-                } else {
-                    delete dta;
+                int rows, cols;
+                if (is_matrix(b, rows, cols) && rows == cols)
+                    v = identity_matrix(rows);
+                else
                     return NULL;
-                }
             } else if (isVal<IntVal>(b) || isVal<RealVal>(b))
                 v = new IntVal(1);
             
@@ -554,38 +710,85 @@ Val pow(Val b, Val p) {
     }
 }
 
+struct Plus {
+    template<typename T>
+    T operator()(T x, T y) { return x + y; }
+};
+struct Minus {
+    template<typename T>
+    T operator()(T x, T y) { return x - y; }
+};
+struct Times {
+    template<typename T>
+    T operator()(T x, T y) { return x * y; }
+};
+struct Divides {
+    template<typename T>
+    T operator()(T x, T y) { return x / y; }
+};
+
+/**
+ * Combines two lists of the same length element by element. Pairs of
+ * numbers, as make up vectors and the rows of matrices, are combined
+ * directly, while any other pair is handed back to the operation.
+ * @param A The left hand list.
+ * @param B The right hand list.
+ * @param op The operation on values.
+ * @param f The same operation on numbers.
+ * @return The resulting list, or NULL if a pair could not be combined.
+ */
+template<typename F>
+static Val elementwise(ListVal *A, ListVal *B, Val (*op)(Val, Val), F f) {
+    int n = A->size();
+
+    ListVal *C = new ListVal;
+    C->reserve(n);
+
+    for (int i = 0; i < n; i++) {
+        Val x = A->get(i);
+        Val y = B->get(i);
+
+        Val z;
+        if (isVal<IntVal>(x) && isVal<IntVal>(y))
+            z = new IntVal(f(((IntVal*) x)->get(), ((IntVal*) y)->get()));
+        else if (val_is_number(x) && val_is_number(y))
+            z = new RealVal(f(
+                    isVal<IntVal>(x) ? ((IntVal*) x)->get() : ((RealVal*) x)->get(),
+                    isVal<IntVal>(y) ? ((IntVal*) y)->get() : ((RealVal*) y)->get()));
+        else if (!(z = op(x, y))) {
+            C->rem_ref();
+            return NULL;
+        }
+
+        C->add(i, z);
+    }
+
+    return C;
+}
+
+Val tensor_add(ListVal *a, ListVal *b) { return tensor_elementwise(a, b, Plus()); }
+Val tensor_sub(ListVal *a, ListVal *b) { return tensor_elementwise(a, b, Minus()); }
+
 Val add(Val a, Val b) {
     if (val_is_list(a)) {
         if (val_is_list(b)) {
             // We will do an element-wise addition
-            List<Val> *A = ((ListVal*) a);
-            List<Val> *B = ((ListVal*) b);
-            if (A->size() != B->size()) {
+            if (Val c = tensor_elementwise((ListVal*) a, (ListVal*) b, Plus()))
+                return c;
+            else if (((ListVal*) a)->size() != ((ListVal*) b)->size()) {
                 throw_err("runtime", "cannot add lists " + a->toString() + " and " + b->toString() + " of differing lengths");
                 return NULL;
             }
 
-            auto C = new ListVal;
-            
-            auto ait = A->iterator();
-            auto bit = B->iterator();
-            for (int i = 0; ait->hasNext(); i++) {
-                Val c = add(ait->next(), bit->next());
-                if (!c) {
-                    while (!C->isEmpty()) C->remove(0)->rem_ref();
-                    return NULL;
-                }
-                C->add(i, c);
-            }
-            delete ait;
-            delete bit;
-            
-            return C;
+            return elementwise((ListVal*) a, (ListVal*) b, add, Plus());
 
         } else  {
             throw_err("runtime", "addition is not defined between " + a->toString() + " and " + b->toString());
             return NULL;
         }
+    } else if (val_is_integer(a) && val_is_integer(b)) {
+        // Integers are computed exactly
+        return new IntVal(((IntVal*) a)->get() + ((IntVal*) b)->get());
     } else if (val_is_number(a) && val_is_number(b)) {
 
         auto x = val_is_integer(a) ? ((IntVal*) a)->get() : ((RealVal*) a)->get();
@@ -608,34 +811,22 @@ Val sub(Val a, Val b) {
     if (val_is_list(a)) {
         if (val_is_list(b)) {
             // We will do an element-wise subtraction
-            List<Val> *A = ((ListVal*) a);
-            List<Val> *B = ((ListVal*) b);
-            if (A->size() != B->size()) {
+            if (Val c = tensor_elementwise((ListVal*) a, (ListVal*) b, Minus()))
+                return c;
+            else if (((ListVal*) a)->size() != ((ListVal*) b)->size()) {
                 throw_err("runtime", "cannot subtract lists " + a->toString() + " and " + b->toString() + " of differing lengths");
                 return NULL;
             }
 
-            auto C = new ListVal;
-            
-            auto ait = A->iterator();
-            auto bit = B->iterator();
-            for (int i = 0; ait->hasNext(); i++) {
-                Val c = sub(ait->next(), bit->next());
-                if (!c) {
-                    while (!C->isEmpty()) C->remove(0)->rem_ref();
-                    return NULL;
-                }
-                C->add(i, c);
-            }
-            delete ait;
-            delete bit;
-            
-            return C;
+            return elementwise((ListVal*) a, (ListVal*) b, sub, Minus());
 
         } else  {
             throw_err("runtime", "subtraction is not defined between " + a->toString() + " and " + b->toString());
             return NULL;
         }
+    } else if (val_is_integer(a) && val_is_integer(b)) {
+        // Integers are computed exactly
+        return new IntVal(((IntVal*) a)->get() - ((IntVal*) b)->get());
     } else if (val_is_number(a) && val_is_number(b)) {
 
         auto x = val_is_integer(a) ? ((IntVal*) a)->get() : ((RealVal*) a)->get();
@@ -667,12 +858,12 @@ Val mult(Val a, Val b) {
                 return NULL;
             }
 
-            int ordA = 0, ordB = 0;
-            for (Val A = a; isVal<ListVal>(A); ordA++)
-                A = ((ListVal*) A)->get(0);
+            // Vectors and matrices of numbers are multiplied directly
+            if (Val c = tensor_mult((ListVal*) a, (ListVal*) b))
+                return c;
 
-            for (Val B = b; isVal<ListVal>(B); ordB++)
-                B = ((ListVal*) B)->get(0);
+            int ordA = ((ListVal*) a)->shape().depth;
+            int ordB = ((ListVal*) b)->shape().depth;
             
             // The restriction imposed is that multiplication restricts the
             // domain such that at least one of the arguments must be bounded
@@ -779,6 +970,10 @@ Val mult(Val a, Val b) {
 
             return res;
         } else {
+            if (val_is_number(b))
+                if (Val c = tensor_scalar((ListVal*) a, b, Times()))
+                    return c;
+
             ListVal *res = new ListVal;
 
             auto it = ((ListVal*) a)->iterator();
@@ -823,6 +1018,9 @@ Val mult(Val a, Val b) {
 
     } else if (isVal<AdtVal>(b)) {
         return mult(b, a);
+    } else if (val_is_integer(a) && val_is_integer(b)) {
+        // Integers are computed exactly
+        return new IntVal(((IntVal*) a)->get() * ((IntVal*) b)->get());
     } else if (val_is_number(a) && val_is_number(b)) {
 
         // The lhs is numerical
@@ -859,50 +1057,51 @@ Val inv(Val b) {
     if (isVal<IntVal>(b)) return new IntVal(1 / ((IntVal*) b)->get());
     if (isVal<RealVal>(b)) return new RealVal(1 / ((RealVal*) b)->get());
 
-    int *dta = isVal<ListVal>(b) ? is_matrix(((ListVal*) b)) : NULL;
-    if (!dta || dta[0] != dta[1]) {
+    int n, cols;
+    if (!is_matrix(b, n, cols) || n != cols) {
         throw_err("runtime", "value " + b->toString() + " is not an square matrix");
         return NULL;
     }
 
     // Thus, b is a matrix. We can now see if we can invert it via Gaussian reduction.
-    int n = dta[0];
-    delete dta;
 
-    float **mtrx = new float*[n];
-    for (int i = 0; i < n; i++) {
-        mtrx[i] = new float[2*n];
-        for (int j = 0; j < n; j++) {
-            auto ij = (((ListVal*) ((ListVal*) b)->get(i)))->get(j);
-            mtrx[i][j] = isVal<IntVal>(ij) ? ((IntVal*) ij)->get() : ((RealVal*) ij)->get();
-            mtrx[i][j+n] = i == j;
-        }
-    }
+    real_t **mtrx = extract_matrix((ListVal*) b, 2*n);
+    for (int i = 0; i < n; i++)
+        mtrx[i][i+n] = 1;
 
     bool nsing = mtrx_inv(mtrx, n);
 
     if (!nsing) {
-        delete mtrx;
+        for (int i = 0; i < n; i++)
+            delete[] mtrx[i];
+        delete[] mtrx;
         throw_err("runtime", "matrix defined by " +  b->toString() + " is singular!");
         return NULL;
     }
 
-    auto L = new ListVal;
+    Tensor *L = new Tensor;
+    L->shape = {n, n};
+    L->real = true;
     for (int i = 0; i < n; i++) {
-        auto R = new ListVal;
-        L->add(i, R);
-        for (int j = 0; j < n; j++)
-            R->add(j, new RealVal(mtrx[i][j+n]));
+        L->reals.insert(L->reals.end(), mtrx[i] + n, mtrx[i] + 2*n);
         delete[] mtrx[i];
     }
     delete[] mtrx;
 
-    return L;
+    return new ListVal(L);
 }
 
 Val div(Val a, Val b) {
 
-    if (val_is_number(b)) {
+    if (val_is_integer(a) && val_is_integer(b)) {
+        // Integer division truncates, and cannot be done by zero
+        integer_t y = ((IntVal*) b)->get();
+        if (!y) {
+            throw_err("runtime", "division by zero (see: " + a->toString() + " / " + b->toString() + ")");
+            return NULL;
+        }
+        return new IntVal(((IntVal*) a)->get() / y);
+    } else if (val_is_number(b)) {
         auto y = val_is_integer(b) ? ((IntVal*) b)->get() : ((RealVal*) b)->get();
 
         if (val_is_number(a)) {
@@ -915,6 +1114,11 @@ Val div(Val a, Val b) {
             else
                 return new IntVal(z);
         } else if (val_is_list(a)) {
+            // Division of integers by zero is left to be reported below
+            if (!val_is_integer(b) || ((IntVal*) b)->get())
+                if (Val c = tensor_scalar((ListVal*) a, b, Divides()))
+                    return c;
+
             ListVal *c = new ListVal;
             auto it = ((ListVal*) a)->iterator();
 
@@ -332,7 +332,7 @@ Exp NotExp::optimize() {
         delete this;
         
         // Compute the negation
-        return new ValExp(new BoolVal(!v->get()));
+        return new ValExp(BoolVal::of(!v->get()));
     } else {
         return this;
     }
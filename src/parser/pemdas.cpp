@@ -162,7 +162,7 @@ result<Expression> parse_pemdas(string str, int order) {
             
             // Build argument sets
             list<string> names;
-            list<string*> idss;
+            list<Symbol*> idss;
             list<Exp> bodies;
 
             while (states.size()) {
@@ -190,7 +190,7 @@ result<Expression> parse_pemdas(string str, int order) {
                 if (!is_all_whitespace(argstr)) {
                     // Parse through the arguments; they should all be identifiers.
                     list<string> args = extract_statements(argstr, ',', false);
-                    string *ids = new string[args.size()+1];
+                    Symbol *ids = new Symbol[args.size()+1];
                     ids[args.size()] = "";
                     for (i = 0; args.size(); i++) {
                         // Pull out and scrape the string down
@@ -210,7 +210,7 @@ result<Expression> parse_pemdas(string str, int order) {
                     if (args.size()) break;
                 } else {
                     // Establish the empty case
-                    string *ids = new string[1];
+                    Symbol *ids = new Symbol[1];
                     ids[0] = "";
                     idss.push_back(ids);
                 }
@@ -242,8 +242,8 @@ result<Expression> parse_pemdas(string str, int order) {
 
             base.value = new SwitchExp(
                     adt.value,
-                    store_in_list<string>(names, ""),
-                    store_in_list<string*>(idss, NULL),
+                    store_in_symbols(names),
+                    store_in_list<Symbol*>(idss, NULL),
                     store_in_list<Exp>(bodies, NULL)
             );
             base.strlen = i;
@@ -332,7 +332,7 @@ result<Expression> parse_pemdas(string str, int order) {
                 }
 
                 // Store the elements into a list
-                string *args = store_in_list<string>(argv, "");
+                Symbol *args = store_in_symbols(argv);
 
                 // Thus, we parse for a body.
                 result<Expression> body = parse_body(str);
@@ -719,7 +719,7 @@ result<Expression> parse_pemdas(string str, int order) {
                     }
 
                     // Store the elements into a list
-                    string *args = store_in_list<string>(argv, "");
+                    Symbol *args = store_in_symbols(argv);
 
                     // Thus, we parse for the body.
                     result<Expression> body = parse_body(str);
@@ -757,16 +757,16 @@ result<Expression> parse_pemdas(string str, int order) {
                 // Scratch space for parsing numbers
                 string::size_type Zlen = -1;
                 string::size_type Rlen = -1;
-                int Z = 0;
-                float R = 0;
+                integer_t Z = 0;
+                real_t R = 0;
 
                 // Attempt to extract a real
-                try { R = stof(str, &Rlen); }
+                try { R = sizeof(real_t) > sizeof(float) ? stod(str, &Rlen) : stof(str, &Rlen); }
                 catch (std::out_of_range &oor) { Rlen = -1; }
                 catch (std::invalid_argument &ia) { Rlen = -1; }
 
                 // Attempt to extract an integer
-                try { Z = stoi(str, &Zlen, 10); }
+                try { Z = sizeof(integer_t) > sizeof(int) ? stoll(str, &Zlen, 10) : stoi(str, &Zlen, 10); }
                 catch (std::out_of_range &oor) { Zlen = -1; }
                 catch (std::invalid_argument &ia) { Zlen = -1; }
 
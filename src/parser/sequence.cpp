@@ -100,7 +100,7 @@ Exp parse_sequence(string str, list<string> future) {
                 }
 
                 // Store the elements into a list
-                string *args = store_in_list<string>(argv, "");
+                Symbol *args = store_in_symbols(argv);
 
                 ids.push_back(id);
                 vals.push_back(new LambdaExp(args, exp.value));
@@ -143,7 +143,7 @@ Exp parse_sequence(string str, list<string> future) {
         }
         
         // Now, we can build a let-exp to represent our outcome
-        string *vs = store_in_list<string>(ids, "");
+        Symbol *vs = store_in_symbols(ids);
         Exp *xs = store_in_list<Exp>(vals, NULL);
         bool *rs = new bool[ids.size()];
         for (i = ids.size()-1; i >= 0; i--) {
@@ -212,7 +212,7 @@ Exp parse_sequence(string str, list<string> future) {
             return NULL;
 
         // Now, we build a final result.
-        string *xs = store_in_list<string>(ids, "");
+        Symbol *xs = store_in_symbols(ids);
 
         Exp *ys = new Exp[ids.size()+1];
 
@@ -417,7 +417,7 @@ Exp parse_sequence(string str, list<string> future) {
         
         // Build the end result.
         return new AdtDeclarationExp(name,
-            store_in_list<string>(ids, ""),
+            store_in_symbols(ids),
             store_in_list<Type**>(argss, NULL),
             body);
     }
@@ -1,7 +1,7 @@
 #include "expression.hpp"
 
-bool AdtExp::postprocessor(HashMap<std::string,bool>*) { return true; }
-bool AdtDeclarationExp::postprocessor(HashMap<std::string,bool> *vars) {
+bool AdtExp::postprocessor(Scope*) { return true; }
+bool AdtDeclarationExp::postprocessor(Scope *vars) {
     // We forbid repetition of kind names.
     for (int i = 0; argss[i]; i++)
         for (int j = i+1; argss[j]; j++)
@@ -15,7 +15,7 @@ bool AdtDeclarationExp::postprocessor(HashMap<std::string,bool> *vars) {
         throw_err("", "definition of ADT " + name + " conflicts with variable using that name");
         return false;
     } else
-        vars->add(name, true);
+        slot = vars->add(name);
 
     bool res = body->postprocessor(vars);
 
@@ -23,12 +23,20 @@ bool AdtDeclarationExp::postprocessor(HashMap<std::string,bool> *vars) {
 
     return res;
 }
-bool SwitchExp::postprocessor(HashMap<std::string,bool> *vars) {
+bool SwitchExp::postprocessor(Scope *vars) {
     // Process the ADT
     if (!adt->postprocessor(vars)) return false;
+
+    // The arguments of each case occupy consecutive slots
+    int n;
+    for (n = 0; bodies[n]; n++);
+    delete[] slots;
+    slots = new int[n];
     
     // Process each of the branches
     for (int i = 0; bodies[i]; i++) {
+        slots[i] = -1;
+
         // Verify that there are no repeats
         for (int j = i+1; bodies[j]; j++)
             if (names[i] == names[j]) {
@@ -42,8 +50,10 @@ bool SwitchExp::postprocessor(HashMap<std::string,bool> *vars) {
                 throw_err("", "redefinition of variable " + idss[i][j] + " is not permitted");
                 while (j--) vars->remove(idss[i][j]);
                 return false;
-            } else
-                vars->add(idss[i][j], true);
+            } else if (!j)
+                slots[i] = vars->add(idss[i][j]);
+            else
+                vars->add(idss[i][j]);
         
         // In this scope, we can check the body.
         auto res = bodies[i]->postprocessor(vars);
@@ -58,9 +68,16 @@ bool SwitchExp::postprocessor(HashMap<std::string,bool> *vars) {
     return true;
 }
 
-bool ApplyExp::postprocessor(HashMap<std::string,bool> *vars) {
+bool ApplyExp::postprocessor(Scope *vars) {
     if (!op->postprocessor(vars)) return false;
 
+    // Only calls that a lambda makes to itself preserve its purity
+    if (isExp<VarExp>(op)) {
+        VarExp *f = (VarExp*) op;
+        vars->call(f->toString());
+    } else
+        vars->effect();
+
     auto res = true;
     for (int i = 0; res && args[i]; i++)
         res = args[i]->postprocessor(vars);
@@ -68,35 +85,38 @@ bool ApplyExp::postprocessor(HashMap<std::string,bool> *vars) {
     return res;
 }
 
-bool FoldExp::postprocessor(HashMap<std::string,bool> *vars) {
+bool FoldExp::postprocessor(Scope *vars) {
+    // The function is not known, so neither are its effects
+    vars->effect();
     return list->postprocessor(vars)
         && func->postprocessor(vars)
         && base->postprocessor(vars);}
 
-bool LambdaExp::postprocessor(HashMap<std::string,bool> *vars) {
-
-    auto trie = new HashMap<std::string,bool>;
+bool LambdaExp::postprocessor(Scope *vars) {
+    // The arguments occupy the first slots of a new frame
+    vars->push(name, &flat);
     for (int i = 0; xs[i] != ""; i++)
-        trie->add(xs[i], true);
+        vars->add(xs[i]);
     
-    auto it = vars->iterator();
+    bool res = exp->postprocessor(vars);
 
-    while (it->hasNext()) {
-        auto k = it->next();
-        if (!trie->hasKey(k))
-            trie->add(k, true);
-    }
-    delete it;
-    
-    bool res = exp->postprocessor(trie);
+    // Pure functions that recurse more than once are worth memoizing,
+    // since they would otherwise recompute the same calls repeatedly.
+    memo = res && vars->isPure() && vars->selfCalls() > 1;
 
-    delete trie;
+    captures = vars->captures();
+    frame = vars->pop();
     return res;
 }
 
-bool LetExp::postprocessor(HashMap<std::string,bool> *vars) {
+bool LetExp::postprocessor(Scope *vars) {
     bool res = true;
 
+    int argc;
+    for (argc = 0; exps[argc]; argc++);
+    delete[] slots;
+    slots = new int[argc];
+
     // Evaluate the processing of the non-recursive variables
     for (int i = 0; res && exps[i]; i++)
         if (!rec[i] && !exps[i]->postprocessor(vars)) {
@@ -116,10 +136,14 @@ bool LetExp::postprocessor(HashMap<std::string,bool> *vars) {
             while (i--) vars->remove(ids[i]);
             return NULL;
         } else {
-            vars->add(ids[i], true);
+            slots[i] = vars->add(ids[i]);
         }
     
-    // Evaluate the processing of the recursive variables
+    // Evaluate the processing of the recursive variables. Lambdas are
+    // told their names, so that they recognize calls to themselves.
+    for (int i = 0; res && exps[i]; i++)
+        if (rec[i] && isExp<LambdaExp>(exps[i]))
+            ((LambdaExp*) exps[i])->setName(ids[i]);
     for (int i = 0; res && exps[i]; i++)
         if (rec[i] && !exps[i]->postprocessor(vars)) {
             std::cout << "in recursive definition " + ids[i] + " = " + exps[i]->toString() << "\n";
@@ -141,7 +165,7 @@ bool LetExp::postprocessor(HashMap<std::string,bool> *vars) {
     return res;
 }
 
-bool SequenceExp::postprocessor(HashMap<std::string,bool> *vars) {
+bool SequenceExp::postprocessor(Scope *vars) {
     auto it = seq->iterator();
     auto res = true;
     while (res && it->hasNext())
@@ -151,21 +175,81 @@ bool SequenceExp::postprocessor(HashMap<std::string,bool> *vars) {
     return res;
 }
 
-bool ForExp::postprocessor(HashMap<std::string,bool> *vars) {
+bool ForExp::postprocessor(Scope *vars) {
     if(!set->postprocessor(vars)) return false;
     if (vars->hasKey(id)) {
         throw_err("", "redefinition of variable " + id + " is not permitted");
         return false;
     }
-    vars->add(id, true);
+    slot = vars->add(id);
     bool res = body->postprocessor(vars); 
     vars->remove(id);
 
     return res;
 }
-bool HasExp::postprocessor(HashMap<std::string,bool> *vars) { return item->postprocessor(vars) && set->postprocessor(vars); }
-bool IsaExp::postprocessor(HashMap<std::string,bool> *vars) { return exp->postprocessor(vars); }
-bool UnaryOperatorExp::postprocessor(HashMap<std::string,bool> *vars) { return exp->postprocessor(vars); }
-bool SetExp::postprocessor(HashMap<std::string,bool> *vars) { return tgt->postprocessor(vars) && exp->postprocessor(vars); }
-bool ThunkExp::postprocessor(HashMap<std::string,bool> *vars) { return exp->postprocessor(vars); }
-bool WhileExp::postprocessor(HashMap<std::string,bool> *vars) { return cond->postprocessor(vars) && body->postprocessor(vars); }
+bool HasExp::postprocessor(Scope *vars) { return item->postprocessor(vars) && set->postprocessor(vars); }
+bool IsaExp::postprocessor(Scope *vars) { return exp->postprocessor(vars); }
+bool UnaryOperatorExp::postprocessor(Scope *vars) { return exp->postprocessor(vars); }
+bool OperatorExp::postprocessor(Scope *vars) {
+    if (!left->postprocessor(vars)) return false;
+
+    // The left operand is held while the right one is evaluated
+    int n = vars->effects();
+    if (!right->postprocessor(vars)) return false;
+    borrow = vars->effects() == n;
+
+    return true;
+}
+bool ListAccessExp::postprocessor(Scope *vars) {
+    if (!list->postprocessor(vars)) return false;
+
+    int n = vars->effects();
+    if (!idx->postprocessor(vars)) return false;
+    borrow = vars->effects() == n;
+
+    return true;
+}
+bool ListAddExp::postprocessor(Scope *vars) {
+    vars->effect();
+    return list->postprocessor(vars)
+        && idx->postprocessor(vars)
+        && elem->postprocessor(vars);
+}
+bool ListRemExp::postprocessor(Scope *vars) {
+    vars->effect();
+    return list->postprocessor(vars) && idx->postprocessor(vars);
+}
+bool ListSliceExp::postprocessor(Scope *vars) {
+    if (!list->postprocessor(vars)) return false;
+
+    int n = vars->effects();
+    if (from && !from->postprocessor(vars)) return false;
+    if (to && !to->postprocessor(vars)) return false;
+    borrow = vars->effects() == n;
+
+    return true;
+}
+bool IfExp::postprocessor(Scope *vars) {
+    return cond->postprocessor(vars)
+        && tExp->postprocessor(vars)
+        && fExp->postprocessor(vars);
+}
+bool SetExp::postprocessor(Scope *vars) {
+    vars->effect();
+    if (!tgt->postprocessor(vars)) return false;
+
+    // Closures that captured the variable must see the new value
+    if (isExp<VarExp>(tgt))
+        vars->assign(tgt->toString());
+
+    return exp->postprocessor(vars);
+}
+bool PrintExp::postprocessor(Scope *vars) {
+    vars->effect();
+    for (int i = 0; args[i]; i++)
+        if (!args[i]->postprocessor(vars))
+            return false;
+    return true;
+}
+bool ThunkExp::postprocessor(Scope *vars) { return exp->postprocessor(vars); }
+bool WhileExp::postprocessor(Scope *vars) { return cond->postprocessor(vars) && body->postprocessor(vars); }
@@ -123,19 +123,19 @@ Val load_stdlib_fs() {
     return new DictVal {
         {
             "close",
-            new LambdaVal(new std::string[3]{"fd", ""},
+            new LambdaVal(new Symbol[3]{"fd", ""},
                 new ImplementExp(std_fclose, NULL))
         }, {
             "open",
-            new LambdaVal(new std::string[3]{"path", "flags", ""},
+            new LambdaVal(new Symbol[3]{"path", "flags", ""},
                 new ImplementExp(std_fopen, NULL))
         }, {
             "read",
-            new LambdaVal(new std::string[3]{"fd", "n", ""},
+            new LambdaVal(new Symbol[3]{"fd", "n", ""},
                 new ImplementExp(std_fread, NULL))
         }, {
             "write",
-            new LambdaVal(new std::string[3]{"fd", "buff", ""},
+            new LambdaVal(new Symbol[3]{"fd", "buff", ""},
                 new ImplementExp(std_fwrite, NULL))
         }
         , { "RDONLY", new IntVal(O_RDONLY) }
@@ -4,15 +4,19 @@
 #include "expression.hpp"
 
 #include "math.hpp"
+#include "parallel.hpp"
 #include <cmath>
 
+// The fewest numbers that are worth giving to a thread (see parallel_for)
+#define GRAIN (1 << 14)
+
 /**
  * Divide a polynomial by a first order polynomial; P(x) / (x - c)
  */
-inline float* synthetic_division(float *P, float c, int n) {
-    float *Q = new float[n];
+inline real_t* synthetic_division(real_t *P, real_t c, int n) {
+    real_t *Q = new real_t[n];
 
-    float d = 0;
+    real_t d = 0;
 
     for (int i = n; i > 0; i--) {
         d = P[i] + d*c;
@@ -22,25 +26,25 @@ inline float* synthetic_division(float *P, float c, int n) {
     return Q;
 }
 
-inline float* derivative(float *F, int n) {
-    float *G = new float[n];
+inline real_t* derivative(real_t *F, int n) {
+    real_t *G = new real_t[n];
     for (int i = 0; i < n; i++)
         G[i] = F[i+1] / (i+1);
     return G;
 }
 
-inline float apply(float *F, int n, float x) {
-    float y = 0;
+inline real_t apply(real_t *F, int n, real_t x) {
+    real_t y = 0;
     for (int i = n; i >= 0; i--)
         y = x*y + F[i];
 
     return y;
 }
 
-float* factorize(float *F, int n) {
-    float *xs = new float[n];
+real_t* factorize(real_t *F, int n) {
+    real_t *xs = new real_t[n];
 
-    float R = 0;
+    real_t R = 0;
     for (int i = 0; i < n; i++)
         R += F[i] > 0 ? F[i] : -F[i];
     if (R < 1) R = 1;
@@ -48,9 +52,9 @@ float* factorize(float *F, int n) {
     for (int i = 0; n > 0; i++) {
         // Perform a Newton-Raphson estimation. We wil use a random
         // initial point to estimate.
-        float x = fmod(rand(), 2*R) - R;
-        float y;
-        float *dF = derivative(F, n);
+        real_t x = fmod(rand(), 2*R) - R;
+        real_t y;
+        real_t *dF = derivative(F, n);
 
         bool complete = false;
         while (true) {
@@ -62,7 +66,7 @@ float* factorize(float *F, int n) {
             } else if (std::isinf(y))
                 break;
 
-            float dy = apply(dF, n-1, x);
+            real_t dy = apply(dF, n-1, x);
             if (dy == 0) {
                 break;
             }
@@ -86,7 +90,7 @@ float* factorize(float *F, int n) {
             delete[] F;
 
             if (i < n-1) {
-                float *G = synthetic_division(F, x, n);
+                real_t *G = synthetic_division(F, x, n);
                 F = G;
             }
         } else
@@ -98,12 +102,12 @@ float* factorize(float *F, int n) {
     return xs;
 }
 
-float* characteristic_poly(ListVal *A) {
+real_t* characteristic_poly(ListVal *A) {
     int n = A->size();
 
     // We will need to generate a characteristic polynomial.
     // Start with the coefficients.
-    float *c = new float[n+1];
+    real_t *c = new real_t[n+1];
     c[n] = 1;
 
     auto AM = new ListVal;
@@ -134,7 +138,7 @@ float* characteristic_poly(ListVal *A) {
         M->rem_ref();
 
         // Then, we will calculate the trace.
-        float tr = 0;
+        real_t tr = 0;
         for (int i = 0; i < n; i++)
             tr += ((RealVal*) ((ListVal*) AM->get(i))->get(i))->get();
 
@@ -157,10 +161,40 @@ auto std_transpose = [](Env env) {
 
     ListVal *xss = (ListVal*) x;
 
+    // A matrix of numbers of one kind is transposed directly
+    Tensor tmp;
+    Tensor *t = Tensor::of(xss, tmp);
+    if (t && t->rank() == 2) {
+        int rows = t->shape[0], cols = t->shape[1];
+
+        Tensor *T = new Tensor;
+        T->shape = {cols, rows};
+        T->real = t->real;
+        if (t->real) T->reals.resize(rows*cols);
+        else T->ints.resize(rows*cols);
+
+        // Each thread fills rows of the transpose
+        parallel_for(cols, GRAIN / rows + 1, [&](int j, int e) {
+            for (; j < e; j++)
+            for (int i = 0; i < rows; i++)
+                if (t->real)
+                    T->reals[j*rows + i] = t->reals[i*cols + j];
+                else
+                    T->ints[j*rows + i] = t->ints[i*cols + j];
+        });
+
+        return (Val) new ListVal(T);
+    }
+
     int rows = 0, cols = 0;
-    
+
+    // A matrix of numbers needs no checking
+    const ListShape &shape = xss->shape();
     auto it = xss->iterator();
-    while (it->hasNext()) {
+    if (shape.rank == 2) {
+        rows = shape.rows;
+        cols = shape.cols;
+    } else while (it->hasNext()) {
         Val xs = it->next();
         if (!isVal<ListVal>(xs)) {
             throw_err("type", "linalg.transpose : [[R]] -> [[R]] cannot be applied to argument " + x->toString());
@@ -219,16 +253,12 @@ auto std_d_transpose = [](std::string x, Env env, Env denv) {
     }
 
     // Verify that the input was a transposable matrix
-    int *dims = is_matrix((ListVal*) z);
-    if (!dims) {
+    int rs, cs;
+    if (!is_matrix(z, rs, cs)) {
         throw_err("type", "linalg.transpose : [[R]] -> [[R]] cannot be applied to argument " + z->toString());
         return (Val) NULL;
     }
 
-    int rs = dims[0];
-    int cs = dims[1];
-    delete[] dims;
-
     // Compute the derivative.
     ListVal *dx = (ListVal*) denv->apply(x);
 
@@ -307,7 +337,7 @@ auto std_qr = [](Env env) {
         }
 
         // Compute the sqnorm of our vector u
-        float norm = 0;
+        real_t norm = 0;
         jt = u->iterator();
         while (jt->hasNext()) {
             auto y = jt->next();
@@ -402,7 +432,16 @@ auto std_trace = [](Env env) {
 
     ListVal *xss = (ListVal*) x;
 
-    float tr = 0;
+    real_t tr = 0;
+
+    // The diagonal of a tensor is read directly, if it is a matrix that
+    // is no taller than it is wide
+    Tensor *t = xss->tensor();
+    if (t && t->rank() == 2 && t->shape[0] <= t->shape[1]) {
+        for (int n = 0; n < t->shape[0]; n++)
+            tr += t->at(n*t->shape[1] + n);
+        return (Val) new RealVal(tr);
+    }
     
     for (int n = 0; n < xss->size(); n++) {
         // Check that the item is a list
@@ -497,51 +536,15 @@ auto std_gaussian = [](Env env) {
     }
 
     // We will ensure that M is rectangular and consisting exclusively of numbers.
-    int cols;
-    for (int i = 0; i < rows; i++) {
-        Val row = M->get(i);
-        if (!isVal<ListVal>(row)) {
-            throw_err("type", "linalg.gaussian : [[R]] -> [[R]] cannot be applied to argument " + x->toString());
-            return (Val) NULL;
-        }
-        
-        auto it = ((ListVal*) row)->iterator();
-        int j = 0;
-        while (it->hasNext()) {
-            auto v = it->next();
-            if (!isVal<RealVal>(v) && !isVal<IntVal>(v)) {
-                delete it;
-                throw_err("type", "linalg.gaussian : [[R]] -> [[R]] cannot be applied to argument " + x->toString());
-                return (Val) NULL;
-            }
-            j++;
-        }
-        delete it;
-
-        if (!i) {
-            if (!j) {
-                throw_err("type", "linalg.gaussian : [[R]] -> [[R]] cannot be applied to argument " + x->toString());
-                return (Val) NULL;
-            } else
-                cols = j;
-        } else if (cols != j) {
-            throw_err("type", "linalg.gaussian : [[R]] -> [[R]] cannot be applied to argument " + x->toString());
-            return (Val) NULL;
-        }
+    const ListShape &shape = M->shape();
+    if (shape.rank != 2) {
+        throw_err("type", "linalg.gaussian : [[R]] -> [[R]] cannot be applied to argument " + x->toString());
+        return (Val) NULL;
     }
+    int cols = shape.cols;
 
     // We will build a 2D array
-    float **mtrx = new float*[rows];
-    for (int i = 0; i < rows; i++) {
-        mtrx[i] = new float[cols];
-        for (int j = 0; j < cols; j++) {
-            Val v = ((ListVal*) M->get(i))->get(j);
-            if (isVal<IntVal>(v))
-                mtrx[i][j] = ((IntVal*) v)->get();
-            else
-                mtrx[i][j] = ((RealVal*) v)->get();
-        }
-    }
+    real_t **mtrx = extract_matrix(M, cols);
 
     int n = rows > cols ? cols : rows;
     
@@ -566,12 +569,14 @@ auto std_gaussian = [](Env env) {
             mtrx[i][j] /= mtrx[i][i];
         mtrx[i][i] = 1;
         
-        // Perform row subtractions
-        for (int j = i+1; j < rows; j++) {
-            for (int k = i+1; k < cols; k++)
-                mtrx[j][k] -= mtrx[j][i] * mtrx[i][k];
-            mtrx[j][i] = 0;
-        }
+        // Perform row subtractions, which are independent of each other
+        parallel_for(rows - i - 1, GRAIN / cols + 1, [&](int j, int e) {
+            for (j += i+1, e += i+1; j < e; j++) {
+                for (int k = i+1; k < cols; k++)
+                    mtrx[j][k] -= mtrx[j][i] * mtrx[i][k];
+                mtrx[j][i] = 0;
+            }
+        });
     }
     
     // Reduce the upper triangle
@@ -579,27 +584,26 @@ auto std_gaussian = [](Env env) {
         for (int j = i+1; j < cols; j++)
             mtrx[i][j] /= mtrx[i][i];
         mtrx[i][i] = 1;
-        for (int j = 0; j < i; j++) {
-            for (int k = i+1; k < cols; k++)
-                mtrx[j][k] -= mtrx[j][i] * mtrx[i][k];
-            mtrx[j][i] = 0;
-        }
+        parallel_for(i, GRAIN / cols + 1, [&](int j, int e) {
+            for (; j < e; j++) {
+                for (int k = i+1; k < cols; k++)
+                    mtrx[j][k] -= mtrx[j][i] * mtrx[i][k];
+                mtrx[j][i] = 0;
+            }
+        });
     }
     
     // Finalize the answer
-    M = new ListVal;
+    Tensor *R = new Tensor;
+    R->shape = {rows, cols};
+    R->real = true;
     for (int i = 0; i < rows; i++) {
-        auto row = new ListVal;
-        M->add(i, row);
-
-        for (int j = 0; j < cols; j++)
-            row->add(j, new RealVal(mtrx[i][j]));
-        
+        R->reals.insert(R->reals.end(), mtrx[i], mtrx[i] + cols);
         delete[] mtrx[i];
     }
     delete[] mtrx;
 
-    return (Val) M;
+    return (Val) new ListVal(R);
 };
 
 
@@ -617,20 +621,10 @@ auto std_determinant = [](Env env) {
     ListVal *M = (ListVal*) x;
 
     // We will build a 2D array
-    float **mtrx = new float*[n];
-    for (int i = 0; i < n; i++) {
-        mtrx[i] = new float[n];
-        for (int j = 0; j < n; j++) {
-            Val v = ((ListVal*) M->get(i))->get(j);
-            if (isVal<IntVal>(v))
-                mtrx[i][j] = ((IntVal*) v)->get();
-            else
-                mtrx[i][j] = ((RealVal*) v)->get();
-        }
-    }
+    real_t **mtrx = extract_matrix(M, n);
     
     // Initial condition: the determinant is 1
-    float det = 1;
+    real_t det = 1;
     
     int i;
     for (i = 0; i < n; i++) {
@@ -659,12 +653,14 @@ auto std_determinant = [](Env env) {
         det *= mtrx[i][i];
         mtrx[i][i] = 1;
         
-        // Perform row subtractions
-        for (int j = i+1; j < n; j++) {
-            for (int k = i+1; k < n; k++)
-                mtrx[j][k] -= mtrx[j][i] * mtrx[i][k];
-            mtrx[j][i] = 0;
-        }
+        // Perform row subtractions, which are independent of each other
+        parallel_for(n - i - 1, GRAIN / n + 1, [&](int j, int e) {
+            for (j += i+1, e += i+1; j < e; j++) {
+                for (int k = i+1; k < n; k++)
+                    mtrx[j][k] -= mtrx[j][i] * mtrx[i][k];
+                mtrx[j][i] = 0;
+            }
+        });
     }
     
     // Garbage collection
@@ -687,20 +683,20 @@ auto std_eig = [](Env env) {
     // Acquire the matrix in list form.
     ListVal *A = (ListVal*) x; 
 
-    float *c = characteristic_poly(A);
+    real_t *c = characteristic_poly(A);
 
     // Then, we will find the solutions to the polynomial.
-    float *eigs = factorize(c, n);
+    real_t *eigs = factorize(c, n);
 
-    auto res = new ListVal;
-    for (int i = 0; i < n; i++) {
-        res->add(i, new RealVal(eigs[i]));
-    }
+    Tensor *res = new Tensor;
+    res->shape = {n};
+    res->real = true;
+    res->reals.assign(eigs, eigs + n);
     
     delete[] c;
     delete[] eigs;
     
-    return (Val) res;
+    return (Val) new ListVal(res);
 };
 
 auto std_characteristic_polynomial = [](Env env) {
@@ -715,7 +711,7 @@ auto std_characteristic_polynomial = [](Env env) {
     // Acquire the matrix in list form.
     ListVal *A = (ListVal*) x; 
 
-    float *c = characteristic_poly(A);
+    real_t *c = characteristic_poly(A);
     
     // Construct the polynomial
     Exp poly = NULL;
@@ -742,7 +738,7 @@ auto std_characteristic_polynomial = [](Env env) {
     }
     
     // Generate the function.
-    return (Val) new LambdaVal(new std::string[2]{"x", ""}, poly);
+    return (Val) new LambdaVal(new Symbol[2]{"x", ""}, poly);
 };
 
 Type* type_stdlib_linalg() {
@@ -790,38 +786,38 @@ Val load_stdlib_linalg() {
     return new DictVal {
         {
             "characteristic_polynomial",
-            new LambdaVal(new std::string[2]{"x", ""},
+            new LambdaVal(new Symbol[2]{"x", ""},
                 (new ImplementExp(std_characteristic_polynomial, NULL))
                     ->setName("characteristic_polynomial"))
         },{
             "det",
-            new LambdaVal(new std::string[2]{"x", ""},
+            new LambdaVal(new Symbol[2]{"x", ""},
                 (new ImplementExp(std_determinant, NULL))
                     ->setName("det(x)"))
         }, {
             "eig",
-            new LambdaVal(new std::string[2]{"x", ""},
+            new LambdaVal(new Symbol[2]{"x", ""},
                 (new ImplementExp(std_eig, NULL))
                     ->setName("eig(x)"))
         }, {
             "gaussian",
-            new LambdaVal(new std::string[2]{"x", ""},
+            new LambdaVal(new Symbol[2]{"x", ""},
                 (new ImplementExp(std_gaussian, NULL))
                     ->setName("gaussian(x)"))
         }, {
             "qr",
-            new LambdaVal(new std::string[2]{"x", ""},
+            new LambdaVal(new Symbol[2]{"x", ""},
                 (new ImplementExp(std_qr, NULL))
                     ->setName("qr(x)"))
         }, {
             "trace",
-            new LambdaVal(new std::string[2]{"x", ""},
+            new LambdaVal(new Symbol[2]{"x", ""},
                 (new ImplementExp(std_trace, NULL))
                     ->setDerivative(std_d_trace)
                     ->setName("tr(x)"))
         }, {
             "transpose",
-            new LambdaVal(new std::string[2]{"x", ""},
+            new LambdaVal(new Symbol[2]{"x", ""},
                 (new ImplementExp(std_transpose, NULL))
                     ->setDerivative(std_d_transpose)
                     ->setName("transpose(x)"))
@@ -23,8 +23,27 @@ auto std_range = [](Env env) {
     return (Val) range;
 };
 
+auto std_concat = [](Env env) {
+    Val a = env->apply("a");
+    Val b = env->apply("b");
+
+    if (!isVal<ListVal>(a) || !isVal<ListVal>(b)) {
+        throw_err("type", "list.concat : [R] -> [R] -> [R] cannot be applied to arguments " + a->toString() + " and " + b->toString());
+        return (Val) NULL;
+    }
+
+    return (Val) ListVal::concat((ListVal*) a, (ListVal*) b);
+};
+
 Type* type_stdlib_list() {
     return new DictType {
+        {"concat",
+            new LambdaType("a",
+                new ListType(new RealType),
+                new LambdaType("b",
+                    new ListType(new RealType),
+                    new ListType(new RealType)))
+        },
         {"range",
             new LambdaType("a",
                 new IntType,
@@ -37,8 +56,13 @@ Type* type_stdlib_list() {
 
 Val load_stdlib_list() {
     return new DictVal {
+        {"concat",
+            new LambdaVal(new Symbol[3]{"a", "b", ""},
+                (new ImplementExp(std_concat, NULL))
+                    ->setName("concat(a, b)"))
+        },
         {"range",
-            new LambdaVal(new std::string[3]{"a", "b", ""},
+            new LambdaVal(new Symbol[3]{"a", "b", ""},
                 (new ImplementExp(std_range, NULL))
                     ->setName("range(a, b)"))
         }
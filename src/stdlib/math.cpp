@@ -3,14 +3,14 @@
 #include "expression.hpp"
 #include <cmath>
 
-auto std_mathfn = [](Env env, bool (*fn)(float)) {
+auto std_mathfn = [](Env env, bool (*fn)(real_t)) {
     Val v = env->apply("x");
     
     if (isVal<RealVal>(v)) {
-        float f = ((RealVal*) v)->get();
-        return (Val) new BoolVal(fn(f));
+        real_t f = ((RealVal*) v)->get();
+        return (Val) BoolVal::of(fn(f));
     } else
-        return (Val) new BoolVal(false);
+        return (Val) BoolVal::of(false);
 };
 
 auto std_isinfinite = [](Env env) {
@@ -43,15 +43,15 @@ Val load_stdlib_math() {
     return new DictVal {
         {
             "isinfinite",
-            new LambdaVal(new std::string[2]{"x", ""},
+            new LambdaVal(new Symbol[2]{"x", ""},
                 new ImplementExp(std_isinfinite, NULL))
         }, {
             "isfinite",
-            new LambdaVal(new std::string[2]{"x", ""},
+            new LambdaVal(new Symbol[2]{"x", ""},
                 new ImplementExp(std_isfinite, NULL))
         }, {
             "isnan",
-            new LambdaVal(new std::string[2]{"x", ""},
+            new LambdaVal(new Symbol[2]{"x", ""},
                 new ImplementExp(std_isnan, NULL))
         }
     };
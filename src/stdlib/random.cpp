@@ -21,7 +21,7 @@ auto std_rand_uniform = [](Env env) {
         return (Val) NULL;
     }
 
-    float x = (1.0 * rand()) / RAND_MAX;
+    real_t x = (1.0 * rand()) / RAND_MAX;
 
     x *=
         (isVal<IntVal>(B)
@@ -53,11 +53,11 @@ auto std_rand_normal = [](Env env) {
     }
 
     // Two uniform variables.
-    float a = (1.0 * rand()) / RAND_MAX;
-    float b = (1.0 * rand()) / RAND_MAX;
+    real_t a = (1.0 * rand()) / RAND_MAX;
+    real_t b = (1.0 * rand()) / RAND_MAX;
 
     // Thus, we can generate a normal variable.
-    float x = sqrt(-2 * log(a)) * sin(2 * M_PI * b);
+    real_t x = sqrt(-2 * log(a)) * sin(2 * M_PI * b);
     
     // Standard deviation
     x *=
@@ -96,11 +96,11 @@ Val load_stdlib_random() {
     return new DictVal {
         {
             "uniform",
-            new LambdaVal(new std::string[3]{"a", "b", ""},
+            new LambdaVal(new Symbol[3]{"a", "b", ""},
                 new ImplementExp(std_rand_uniform,NULL))
         }, {
             "normal",
-            new LambdaVal(new std::string[3]{"a", "b", ""},
+            new LambdaVal(new Symbol[3]{"a", "b", ""},
                 new ImplementExp(std_rand_normal,NULL))
         }
     };
@@ -154,7 +154,7 @@ auto std_sort = [](Env env, bool (*sort)(Val*, int, int)) {
 
     delete[] vs;
 
-    return (Val) (res ? new VoidVal : NULL);
+    return (Val) (res ? VoidVal::of() : NULL);
 };
 
 auto std_mergesort = [](Env env) { return std_sort(env, mergesort); };
@@ -170,7 +170,7 @@ auto std_is_sorted = [](Env env) {
     CompareExp comp(NULL, NULL, CompOp::GT);
 
     ListVal *list = (ListVal*) L;
-    if (list->size() < 2) return (Val) new BoolVal(true);
+    if (list->size() < 2) return (Val) BoolVal::of(true);
 
     auto it = list->iterator();
     Val v = it->next();
@@ -184,14 +184,14 @@ auto std_is_sorted = [](Env env) {
         } else if (!b->get()) {
             b->rem_ref();
             delete it;
-            return (Val) new BoolVal(false);
+            return (Val) BoolVal::of(false);
         } else {
             b->rem_ref();
         }
     }
 
     delete it;
-    return (Val) new BoolVal(true);
+    return (Val) BoolVal::of(true);
 };
 
 Type* type_stdlib_sort() {
@@ -217,17 +217,17 @@ Val load_stdlib_sort() {
     return new DictVal {
         {
             "is_sorted",
-            new LambdaVal(new std::string[2]{"L", ""},
+            new LambdaVal(new Symbol[2]{"L", ""},
                 new ImplementExp(std_is_sorted, NULL))
         },
         {
             "mergesort",
-            new LambdaVal(new std::string[2]{"L", ""},
+            new LambdaVal(new Symbol[2]{"L", ""},
                 new ImplementExp(std_mergesort, NULL))
         },
         {
             "quicksort",
-            new LambdaVal(new std::string[2]{"L", ""},
+            new LambdaVal(new Symbol[2]{"L", ""},
                 new ImplementExp(std_quicksort, NULL))
         }
     };
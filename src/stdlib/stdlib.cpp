@@ -3,14 +3,14 @@
 
 using namespace std;
 
-LambdaVal* make_fn(string *xs, std::string name, Val (*f)(Env), Type *t, Val (*df)(string, Env, Env) = NULL) {
+LambdaVal* make_fn(Symbol *xs, std::string name, Val (*f)(Env), Type *t, Val (*df)(string, Env, Env) = NULL) {
     auto I = (new ImplementExp(f, t))->setDerivative(df);
     I->setName(name);
     return new LambdaVal(xs, I);
 }
 
 LambdaVal* make_mono_fn(string x, std::string name, Val (*f)(Env), Type *t, Val (*df)(string, Env, Env) = NULL) {
-    string *xs = new string[2];
+    Symbol *xs = new Symbol[2];
     xs[0] = x;
     xs[1] = "";
     return make_fn(xs, name, f, t, df);
@@ -65,17 +65,17 @@ Val load_stdlib_string() {
     return new DictVal {
         { // strcat(a,b) = a | b
             "strcat",
-            new LambdaVal(new std::string[3]{"a", "b", ""},
+            new LambdaVal(new Symbol[3]{"a", "b", ""},
                 new ImplementExp(std_strcat, NULL)
             )
         }, { // substring(str, i, j) = substring
             "substring",
-            new LambdaVal(new std::string[4]{"str", "i", "j", ""},
+            new LambdaVal(new Symbol[4]{"str", "i", "j", ""},
                 new ImplementExp(std_substring, NULL)
             )
         }, {
             "strstr",
-            new LambdaVal(new std::string[3]{"a", "b", ""},
+            new LambdaVal(new Symbol[3]{"a", "b", ""},
                 new ImplementExp(std_strstr, NULL)
             )
         }
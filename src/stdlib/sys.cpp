@@ -2,6 +2,17 @@
 #include "expressions/stdlib.hpp"
 
 #include "expression.hpp"
+#include "heap.hpp"
+
+#include <algorithm>
+#include <limits>
+
+/**
+ * Boxes a number of bytes, which is clamped to the largest integer.
+ */
+static Val bytes(long n) {
+    return new IntVal(std::min(n, (long) std::numeric_limits<integer_t>::max()));
+}
 
 auto stdlib_exit = [](Env env) {
     Val v = env->apply("x");
@@ -14,9 +25,23 @@ auto stdlib_exit = [](Env env) {
     }
 };
 
+auto stdlib_heap = [](Env env) {
+    (void) env;
+
+    // The sizes are given in bytes
+    return (Val) new DictVal {
+        { "live", bytes(heap_bytes) },
+        { "peak", bytes(heap_peak) }
+    };
+};
+
 Type* type_stdlib_sys() {
     return new DictType {
         { "exit", new LambdaType("x", new IntType, new VoidType) },
+        { "heap", new LambdaType(new VoidType, new DictType {
+            { "live", new IntType },
+            { "peak", new IntType }
+        }) },
         { "argv", new ListType(new StringType) },
         { "stdin", new IntType },
         { "stdout", new IntType },
@@ -39,8 +64,12 @@ Val load_stdlib_sys() {
     return new DictVal {
         { 
             "exit",
-            new LambdaVal(new std::string[2]{"x", ""},
+            new LambdaVal(new Symbol[2]{"x", ""},
                 new ImplementExp(stdlib_exit, NULL))
+        }, {
+            "heap",
+            new LambdaVal(new Symbol[1]{""},
+                new ImplementExp(stdlib_heap, NULL))
         }, { "argv", argv },
         { "stdin", new IntVal(0) },
         { "stdout", new IntVal(1) },
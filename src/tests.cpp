@@ -3,7 +3,9 @@
 #include "parser.hpp"
 
 #include "baselang/environment.hpp"
+#include "heap.hpp"
 #include "interp.hpp"
+#include "vm.hpp"
 
 #include <iostream>
 #include <fstream>
@@ -49,7 +51,7 @@ std::map<Exp,string> load_test_cases(string fname) {
 
         if (exp) {
             // Verify the legality of the case
-            HashMap<std::string,bool> *vardta = new HashMap<std::string,bool>;
+            Scope *vardta = new Scope;
             bool valid = exp->postprocessor(vardta);
             delete vardta;
 
@@ -92,6 +94,33 @@ string run_interp(Exp x) {
     return res;
 }
 
+string run_vm(Exp x) {
+    Env env = new Environment;
+
+    Val v = vm_run(x, env);
+    env->rem_ref();
+
+    if (!v) return "NULL";
+    
+    string res = v->toString();
+    v->rem_ref();
+
+    return res;
+}
+
+/**
+ * Evaluates a program with a megabyte of heap to spare beyond what is live.
+ */
+string run_heap(Exp x) {
+    long max_heap = configuration.max_heap;
+    configuration.max_heap = heap_bytes + (1 << 20);
+
+    string res = run_interp(x);
+    configuration.max_heap = max_heap;
+
+    return res;
+}
+
 string run_types(Exp x) {
     Tenv tenv = new TypeEnv;
     Type *t = x->typeOf(tenv);
@@ -105,7 +134,7 @@ string run_types(Exp x) {
     return res;
 }
 
-int test_cases(string title, string (*run)(Exp)) {
+int test_cases(string title, string (*run)(Exp), string mode = "") {
     int n = 0;
     int i = 1;
     auto interp_cases = load_test_cases("./tests/" + title + ".cases");
@@ -126,7 +155,8 @@ int test_cases(string title, string (*run)(Exp)) {
         delete exp;
 
         if (res != it.second) {
-            std::cout << "Failed test case " << title << ":" << to_string(i) << "\n";
+            std::cout << "Failed test case " << title << ":" << to_string(i)
+                      << (mode == "" ? "" : " (" + mode + ")") << "\n";
             std::cout << "\tExpected " << it.second << ", got " << res << "\n";
             n++;
         }
@@ -142,6 +172,9 @@ int test() {
     int n = 0;
 
     n += test_cases("interp", run_interp);
+    n += test_cases("interp", run_vm, "vm");
+    n += test_cases("vm", run_vm);
+    n += test_cases("heap", run_heap);
     n += test_cases("types", run_types);
 
     // Display end results
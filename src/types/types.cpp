@@ -70,7 +70,7 @@ Type* AlgebraicDataType::simplify(Tenv tenv) {
     return clone();
 }
 
-DictType::DictType(initializer_list<pair<string, Type*>> ts) {
+DictType::DictType(initializer_list<pair<string, Type*>> ts) : Type(KIND) {
     types = new HashMap<std::string, Type*>;
 
     // Add each of the items
@@ -1,10 +1,40 @@
 #include "value.hpp"
 #include "baselang/environment.hpp"
+#include "vm.hpp"
+#include "interp.hpp"
 
 using namespace std;
 
+#include <algorithm>
+#include <cstring>
 #include <string>
 
+// Integers in [SMALL_INT_MIN, SMALL_INT_MAX] are shared constants
+#define SMALL_INT_MIN -128
+#define SMALL_INT_MAX 1023
+
+// Lists of at least this many elements are moved into a tree once they are
+// sliced, joined or modified in the middle
+#define ROPE_MIN 64
+
+/**
+ * Freezes a value that is held by a cache for the rest of the program, so
+ * that it is never freed.
+ */
+template<typename T>
+static T* constant(T *v) {
+    v->freeze();
+    return v;
+}
+
+static_assert((int) HEAP_VOID == (int) VAL_VOID, "heap kinds must match value kinds");
+
+const size_t value_sizes[] = {
+    sizeof(AdtVal), sizeof(BoolVal), sizeof(DictVal), sizeof(IntVal),
+    sizeof(LambdaVal), sizeof(ListVal), sizeof(RealVal), sizeof(StringVal),
+    sizeof(Thunk), sizeof(TupleVal), sizeof(VoidVal)
+};
+
 bool is_zero_val(Val e) {
     if (!e) return false;
     else if (isVal<IntVal>(e))
@@ -28,6 +58,15 @@ AdtVal::~AdtVal() {
         args[i]->rem_ref();
     delete[] args;
 }
+void AdtVal::trace(ref_visitor f) {
+    for (int i = 0; args[i]; i++)
+        f(args[i], true);
+}
+void AdtVal::clear_refs() {
+    for (int i = 0; args[i]; i++)
+        args[i]->rem_ref();
+    args[0] = NULL;
+}
 AdtVal* AdtVal::clone() {
     int i;
     for (i = 0; args[i]; i++);
@@ -74,66 +113,122 @@ int AdtVal::set(Val v) {
 }
 
 // Booleans
-BoolVal::BoolVal(bool n) { val = n; }
+BoolVal::BoolVal(bool n) : Value(KIND) { val = n; }
 bool BoolVal::get() { return val; }
+BoolVal* BoolVal::of(bool b) {
+    static BoolVal *consts[2] = { constant(new BoolVal(false)), constant(new BoolVal(true)) };
+    BoolVal *res = consts[b];
+    res->add_ref();
+    return res;
+}
 int BoolVal::set(Val v) {
-    if (isVal<BoolVal>(v)) {
+    if (isVal<BoolVal>(v) && !is_frozen()) {
         val = ((BoolVal*) v)->val;
         return 0;
     } else return 1;
 }
 
-DictVal::DictVal(std::initializer_list<std::pair<std::string, Val>> elems) {
+DictStore::~DictStore() {
+    auto it = map.iterator();
+    while (it->hasNext()) map.get(it->next())->rem_ref();
+    delete it;
+
+    heap_resize(HEAP_DICT, -charged);
+}
+void DictStore::account() {
+    long n = map.bytes();
+    heap_resize(HEAP_DICT, n - charged);
+    charged = n;
+}
+void DictStore::trace(ref_visitor f) {
+    auto it = map.iterator();
+    while (it->hasNext()) f(map.get(it->next()), true);
+    delete it;
+}
+void DictStore::clear_refs() {
+    vector<string> keys;
+    auto it = map.iterator();
+    while (it->hasNext()) keys.push_back(it->next());
+    delete it;
+
+    for (auto &k : keys)
+        map.remove(k)->rem_ref();
+}
+
+DictVal::DictVal(std::initializer_list<std::pair<std::string, Val>> elems) : Value(KIND) {
+    store = new DictStore;
+
     // Add each of the elements.
     for (auto pair : elems) {
         add(pair.first, pair.second);
     }
 }
+void DictVal::detach() {
+    if (store->is_unique()) return;
 
-DictVal::~DictVal() {
-    auto it = iterator();
-    while (it->hasNext()) get(it->next())->rem_ref();
-    delete it;
-}
-DictVal* DictVal::clone() {
-    auto res = new DictVal;
-    
-    // Keys
-    auto kt = iterator();
+    // Copy each entry into a store of our own
+    DictStore *res = new DictStore;
+    auto kt = store->map.iterator();
     while (kt->hasNext()) {
         string k = kt->next();
-        Val v = get(k);
+        Val v = store->map.get(k);
 
         v->add_ref();
-        res->add(k, v);
+        res->map.add(k, v);
     }
     delete kt;
-    
-    // Build the result
-    return res;
+    res->account();
+
+    store->rem_ref();
+    store = res;
+}
+void DictVal::clear_refs() {
+    // The store is replaced, so that it may be freed.
+    DictStore *s = store;
+    store = new DictStore;
+    s->rem_ref();
+}
+DictVal* DictVal::clone() {
+    store->add_ref();
+    return new DictVal(store);
 }
 int DictVal::set(Val) { return 1; } // We will not allow setting of fields
 
 // Integers
-IntVal::IntVal(int n) { val = n; }
-int IntVal::get() { return val; }
+IntVal::IntVal(integer_t n) : Value(KIND) { val = n; }
+integer_t IntVal::get() { return val; }
+IntVal* IntVal::of(integer_t n) {
+    if (n < SMALL_INT_MIN || n > SMALL_INT_MAX)
+        return new IntVal(n);
+
+    static IntVal *consts[SMALL_INT_MAX - SMALL_INT_MIN + 1] = {};
+    IntVal *&res = consts[n - SMALL_INT_MIN];
+    if (!res) res = constant(new IntVal(n));
+    res->add_ref();
+    return res;
+}
 int IntVal::set(Val v) {
-    if (isVal<IntVal>(v)) {
+    if (isVal<IntVal>(v) && !is_frozen()) {
         val = ((IntVal*) v)->val;
         return 0;
     } else return 1;
 }
 
 // Decimals
-RealVal::RealVal(float n) { val = n; }
-float RealVal::get() { return val; }
+RealVal::RealVal(real_t n) : Value(KIND) { val = n; }
+real_t RealVal::get() { return val; }
 int RealVal::set(Val v) {
-    if (isVal<RealVal>(v)) {
+    if (isVal<RealVal>(v) && !is_frozen()) {
         val = ((RealVal*) v)->val;
         return 0;
     } else return 1;
 }
 
+void TupleVal::clear_refs() {
+    left->rem_ref();
+    right->rem_ref();
+    left = right = NULL;
+}
 int TupleVal::set(Val v) {
     if (isVal<TupleVal>(v)) {
         left->rem_ref();
@@ -149,15 +244,124 @@ int TupleVal::set(Val v) {
 }
 
 int StringVal::set(Val v) {
-    if (isVal<StringVal>(v)) {
+    if (isVal<StringVal>(v) && !is_frozen()) {
+        long n = val.capacity();
         val = ((StringVal*) v)->get();
+        heap_resize(HEAP_STRING, (long) val.capacity() - n);
         return 0;
     } else return 1;
 }
 
 // Lambdas
-LambdaVal::LambdaVal(string *ids, Exp exp, Env env) {
+unsigned long LambdaVal::memo_hits = 0;
+unsigned long LambdaVal::memo_misses = 0;
+
+// A function stops memoizing if fewer than one in MEMO_HIT_RATE of its
+// first MEMO_TRIAL lookups are found
+#define MEMO_TRIAL 1024
+#define MEMO_HIT_RATE 16
+
+// The number of slots that a cache begins with
+#define MEMO_SLOTS 64
+
+bool MemoKey::operator==(const MemoKey &k) const {
+    if (kinds != k.kinds) return false;
+    for (int i = 0; i < MEMO_ARGS && (kinds >> 2*i); i++)
+        if (bits[i] != k.bits[i])
+            return false;
+    return true;
+}
+size_t MemoKey::hash() const {
+    uint64_t h = kinds;
+    for (int i = 0; i < MEMO_ARGS && (kinds >> 2*i); i++) {
+        h = (h ^ bits[i]) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+MemoCache::MemoCache() {
+    size = MEMO_SLOTS < configuration.memo_size ? MEMO_SLOTS : configuration.memo_size;
+    slots = new Entry[size];
+}
+void MemoCache::grow() {
+    Entry *old = slots;
+    size_t n = size;
+
+    size *= 2;
+    slots = new Entry[size];
+    used = 0;
+    for (size_t i = 0; i < n; i++)
+        if (old[i].res.kind != Imm::FAIL)
+            insert(old[i].key, old[i].res);
+
+    delete[] old;
+}
+bool MemoCache::find(const MemoKey &key, Imm &res) {
+    lookups++;
+
+    Entry &e = slots[key.hash() % size];
+    if (e.res.kind == Imm::FAIL || !(e.key == key))
+        return false;
+
+    hits++;
+    res = e.res;
+    return true;
+}
+void MemoCache::insert(const MemoKey &key, Imm res) {
+    // The table grows once it is half full, as long as it may
+    if (2 * used >= size && 2 * size <= configuration.memo_size)
+        grow();
+
+    Entry &e = slots[key.hash() % size];
+    if (e.res.kind == Imm::FAIL) used++;
+    e.key = key;
+    e.res = res;
+}
+
+/**
+ * Adds an argument to the key under which an application is memoized.
+ * @param key The key.
+ * @param i The position of the argument.
+ * @param x The argument.
+ * @return Whether or not the argument can be used in a key.
+ */
+static bool memo_arg(MemoKey &key, int i, Imm x) {
+    if (i == MEMO_ARGS) return false;
+
+    if (x.kind == Imm::BOXED)
+        switch (x.v->kind) {
+            case VAL_INT: x = Imm(((IntVal*) x.v)->get()); break;
+            case VAL_REAL: x = Imm(((RealVal*) x.v)->get()); break;
+            case VAL_BOOL: x = Imm(((BoolVal*) x.v)->get()); break;
+            default: return false;
+        }
+
+    uint64_t bits = 0;
+    switch (x.kind) {
+        case Imm::INT:
+            key.kinds |= 1u << 2*i;
+            bits = x.i;
+            break;
+        case Imm::REAL:
+            // Reals are keyed on their exact representation
+            key.kinds |= 2u << 2*i;
+            memcpy(&bits, &x.r, sizeof x.r);
+            break;
+        case Imm::BOOL:
+            key.kinds |= 3u << 2*i;
+            bits = x.b;
+            break;
+        default:
+            return false;
+    }
+    key.bits[i] = bits;
+    return true;
+}
+
+LambdaVal::LambdaVal(Symbol *ids, Exp exp, Env env) : Value(KIND) {
     this->xs = ids;
+    for (argc = 0; xs[argc] != ""; argc++);
     this->exp = exp;
     this->env = env ? env : new Environment;
 }
@@ -171,13 +375,25 @@ int LambdaVal::set(Val v) {
         for (i = 0; lv->xs[i] != ""; i++);
         
         // Set a new input set
-        xs = new string[i+1];
+        xs = new Symbol[i+1];
         xs[i] = "";
+        argc = i;
         while (i--) xs[i] = lv->xs[i];
         
         // Set a new expression
         delete exp;
         exp = lv->exp->clone();
+
+        // Any compiled form of the old expression is now stale, as are
+        // any memoized results.
+        delete code;
+        code = NULL;
+        delete cache;
+        cache = NULL;
+        memo = lv->memo;
+        frame = lv->frame;
+        flat = lv->flat;
+        captures = lv->captures;
         
         // Set the environment
         Env e = env;
@@ -189,88 +405,682 @@ int LambdaVal::set(Val v) {
 }
 LambdaVal::~LambdaVal() {
     delete[] xs;
+    delete code;
+    delete cache;
     delete exp;
     if (env) env->rem_ref();
 }
+void LambdaVal::clear_refs() {
+    if (env) env->rem_ref();
+    env = NULL;
+}
 LambdaVal* LambdaVal::clone() {
     int argc;
     for (argc = 0; xs[argc] != ""; argc++);
 
-    string *ids = new string[argc+1];
+    Symbol *ids = new Symbol[argc+1];
     ids[argc] = "";
     while (argc--) ids[argc] = xs[argc];
     
     env->add_ref();
-    return new LambdaVal(ids, exp->clone(), env);
+    LambdaVal *res = new LambdaVal(ids, exp->clone(), env);
+    res->memo = memo;
+    res->frame = frame;
+    res->flat = flat;
+    res->captures = captures;
+    return res;
 }
 Val LambdaVal::apply(Val *argv, Env e) {
+    return box(resolve_tail(call(argv, e)));
+}
+Imm LambdaVal::call(Val *argv, Env e) {
+    // Verify that the correct number of arguments have been provided
+    for (int i = 0; i < argc; i++)
+        if (!argv[i]) return Imm();
+    if (argv[argc]) return Imm();
+
+    return enter(argv, e);
+}
+Imm LambdaVal::enter(Val *argv, Env e) {
+    // Recursion is bounded by the heap limit, as loops are, and by the
+    // native stack that it uses
+    if (heap_exceeded() || stack_exceeded()) return Imm();
+
+    // Pure functions may have already computed the result
+    MemoKey key;
+    bool memoize = !e && memoizes(argv, key);
+    if (memoize) {
+        Imm res;
+        if (recall(key, res))
+            return res;
+    }
+
     Env E = e ? e : env;
     
-    E = new Environment(E);
-
-    // Verify that the correct number of arguments have been provided
-    for (int i = 0; argv[i] || xs[i] != ""; i++)
-        if ((!argv[i]) != (xs[i] == "")) {
-            // If one of the lists ends before the other, the input is bad.
-            delete E;
-            return NULL;
-        }
+    E = new Environment(E, frame);
     
-    // Create an environment for handling the processing
-    for (int i = 0; argv[i]; i++)
-        E->set(xs[i], argv[i]);
+    // Create an environment for handling the processing. The arguments
+    // occupy the first slots of the frame.
+    for (int i = 0; i < argc; i++)
+        E->bind(i, xs[i], argv[i]);
 
     // Compute the result
-    Val res = exp->evaluate(E);
+    Imm res = exp->evaluate_tail(E);
     
     // Garbage collection
     E->rem_ref();
 
+    if (memoize) remember(key, res);
+
     // Return it
     return res;
 }
+bool LambdaVal::memoizes(Val *argv, MemoKey &key) {
+    if (!memo || !configuration.memo_size) return false;
+    for (int i = 0; argv[i]; i++)
+        if (!memo_arg(key, i, Imm(argv[i])))
+            return false;
+    return true;
+}
+bool LambdaVal::memoizes(Imm *argv, MemoKey &key) {
+    if (!memo || !configuration.memo_size) return false;
+    for (int i = 0; i < argc; i++)
+        if (!memo_arg(key, i, argv[i]))
+            return false;
+    return true;
+}
+bool LambdaVal::recall(const MemoKey &key, Imm &res) {
+    if (!cache) cache = new MemoCache;
+
+    if (cache->find(key, res)) {
+        memo_hits++;
+        return true;
+    }
+    memo_misses++;
+
+    // A function whose applications rarely repeat is not worth memoizing
+    if (cache->lookups == MEMO_TRIAL && cache->hits * MEMO_HIT_RATE < MEMO_TRIAL) {
+        memo = false;
+        delete cache;
+        cache = NULL;
+    }
+
+    return false;
+}
+void LambdaVal::remember(const MemoKey &key, Imm res) {
+    // Only immediate results are kept, since other values may be mutated
+    // by the caller
+    if (cache && (res.kind == Imm::INT || res.kind == Imm::REAL || res.kind == Imm::BOOL))
+        cache->insert(key, res);
+}
+Bytecode* LambdaVal::getCode() {
+    // The body is compiled on demand, since most lambdas are only ever
+    // applied by the tree walker.
+    if (!code) {
+        code = compile(exp, frame > argc ? frame : argc);
+        throw_debug("vm", "compiled '" + toString() + "' to\n" + code->toString());
+    }
+    return code;
+}
+void LambdaVal::setCaptures(const vector<Capture> &xs) {
+    flat = true;
+    captures = xs;
+}
+Env LambdaVal::capture(Env env, const vector<Capture> *xs) {
+    if (xs) {
+        Env E = new Environment(NULL, xs->size());
+        
+        // The variables are copied into the slots that the body expects
+        int i;
+        for (i = 0; i < (int) xs->size(); i++) {
+            auto &x = (*xs)[i];
+            Val v = env->apply(x.id, x.depth, x.slot);
+            if (!v) break;
+            E->bind(i, x.id, v);
+        }
+
+        if (i == (int) xs->size())
+            return E;
+
+        // A variable is not yet bound, as happens when a recursive
+        // definition refers to itself, so the environment is kept.
+        E->rem_ref();
+    }
+
+    env->add_ref();
+    return env;
+}
 void LambdaVal::setEnv(Env e) {
     Env tmp = env;
-    env = e;
     
-    if (env) env->add_ref();
+    if (!e)
+        env = e;
+    else if (flat)
+        env = capture(e, &captures);
+    else {
+        env = e;
+        env->add_ref();
+    }
+
     if (tmp) tmp->rem_ref();
 }
 
-ListVal::~ListVal() {
-    for (int i = 0; i < size(); i++)
-        get(i)->rem_ref();
+/**
+ * Boxes a number of a tensor.
+ */
+static Val number(const Tensor *t, int i) {
+    return t->real ? (Val) new RealVal(t->reals[i]) : (Val) IntVal::of(t->ints[i]);
 }
-ListVal* ListVal::clone() {
-    // Add a copy of each element of the list
-    ListVal *res = new ListVal;
-    
-    for (int i = 0; i < size(); i++) {
-        Val v = get(i);
-        res->add(i, v);
-        if (v) v->add_ref();
-    }
 
-    // Give it back
+/**
+ * Copies the rows [i, j) of a tensor.
+ */
+static Tensor* rows(const Tensor *t, int i, int j) {
+    int n = t->length() / t->shape[0];
+
+    Tensor *res = new Tensor;
+    res->shape = t->shape;
+    res->shape[0] = j - i;
+    res->real = t->real;
+    if (t->real)
+        res->reals.assign(t->reals.begin() + i*n, t->reals.begin() + j*n);
+    else
+        res->ints.assign(t->ints.begin() + i*n, t->ints.begin() + j*n);
+
     return res;
 }
+
+/**
+ * Packs values into a tensor, if they are numbers of one kind, or dense
+ * lists of the same shape that are held by nothing else.
+ * @return The tensor, or NULL if the values do not make up one.
+ */
+static Tensor* pack(Val *vs, int n) {
+    if (n == 0) return NULL;
+
+    if (isVal<IntVal>(vs[0]) || isVal<RealVal>(vs[0])) {
+        for (int i = 1; i < n; i++)
+            if (vs[i]->kind != vs[0]->kind)
+                return NULL;
+
+        Tensor *t = new Tensor;
+        t->shape.push_back(n);
+        t->real = isVal<RealVal>(vs[0]);
+        for (int i = 0; i < n; i++)
+            if (t->real)
+                t->reals.push_back(((RealVal*) vs[i])->get());
+            else
+                t->ints.push_back(((IntVal*) vs[i])->get());
+
+        return t;
+    } else if (!isVal<ListVal>(vs[0]) || !((ListVal*) vs[0])->tensor())
+        return NULL;
+
+    // The rows are copied, so no one else may modify them
+    Tensor *u = ((ListVal*) vs[0])->tensor();
+    for (int i = 0; i < n; i++) {
+        if (!isVal<ListVal>(vs[i]) || !vs[i]->is_unique())
+            return NULL;
+
+        Tensor *r = ((ListVal*) vs[i])->tensor();
+        if (!r || r->real != u->real || r->shape != u->shape)
+            return NULL;
+    }
+
+    Tensor *t = new Tensor;
+    t->shape.push_back(n);
+    t->shape.insert(t->shape.end(), u->shape.begin(), u->shape.end());
+    t->real = u->real;
+    for (int i = 0; i < n; i++) {
+        Tensor *r = ((ListVal*) vs[i])->tensor();
+        if (t->real)
+            t->reals.insert(t->reals.end(), r->reals.begin(), r->reals.end());
+        else
+            t->ints.insert(t->ints.end(), r->ints.begin(), r->ints.end());
+    }
+
+    return t;
+}
+
+/**
+ * Packs the numbers of a list into a tensor, row by row.
+ * @param v A value at the given depth of the list.
+ * @param t The tensor, whose shape and kind are already known.
+ * @param d The depth.
+ * @return Whether or not the value fits the shape and kind.
+ */
+static bool pack(Val v, Tensor &t, int d) {
+    if (d == t.rank()) {
+        if (t.real && isVal<RealVal>(v))
+            t.reals.push_back(((RealVal*) v)->get());
+        else if (!t.real && isVal<IntVal>(v))
+            t.ints.push_back(((IntVal*) v)->get());
+        else
+            return false;
+        return true;
+    } else if (!isVal<ListVal>(v) || ((ListVal*) v)->size() != t.shape[d])
+        return false;
+
+    ListVal *L = (ListVal*) v;
+    if (Tensor *u = L->tensor()) {
+        // Dense rows are copied whole
+        if (u->real != t.real || u->rank() != t.rank() - d
+                || !std::equal(u->shape.begin(), u->shape.end(), t.shape.begin() + d))
+            return false;
+        else if (t.real)
+            t.reals.insert(t.reals.end(), u->reals.begin(), u->reals.end());
+        else
+            t.ints.insert(t.ints.end(), u->ints.begin(), u->ints.end());
+        return true;
+    }
+
+    for (int i = 0; i < L->size(); i++)
+        if (!pack(L->get(i), t, d+1))
+            return false;
+    return true;
+}
+
+Tensor* Tensor::of(ListVal *L, Tensor &tmp) {
+    if (L->tensor())
+        return L->tensor();
+
+    // Vectors and matrices that are not of numbers of one kind are known
+    // not to be tensors without looking at them again
+    const ListShape &s = L->shape();
+    if (s.depth <= 2 && (!s.rank || (s.ints && s.reals)))
+        return NULL;
+
+    // The shape is that of the first element at each depth
+    tmp = Tensor();
+    Val v = L;
+    while (isVal<ListVal>(v)) {
+        ListVal *xs = (ListVal*) v;
+        if (Tensor *u = xs->tensor()) {
+            tmp.shape.insert(tmp.shape.end(), u->shape.begin(), u->shape.end());
+            v = NULL;
+            tmp.real = u->real;
+            break;
+        } else if (xs->isEmpty())
+            return NULL;
+
+        tmp.shape.push_back(xs->size());
+        v = xs->get(0);
+    }
+
+    if (v) {
+        if (isVal<RealVal>(v)) tmp.real = true;
+        else if (!isVal<IntVal>(v)) return NULL;
+    }
+
+    return pack(L, tmp, 0) ? &tmp : NULL;
+}
+
+ListStore::~ListStore() {
+    for (Val v : xs)
+        if (v) v->rem_ref();
+    if (tree) tree->rem_ref();
+    delete dense;
+
+    heap_resize(HEAP_LIST, -charged);
+}
+void ListStore::account() {
+    long n = xs.capacity() * sizeof(Val);
+    if (dense)
+        n += sizeof(Tensor) + dense->shape.capacity() * sizeof(int)
+           + dense->ints.capacity() * sizeof(integer_t)
+           + dense->reals.capacity() * sizeof(real_t);
+
+    heap_resize(HEAP_LIST, n - charged);
+    charged = n;
+}
+Val ListStore::element(int idx) {
+    if (dense->rank() > 1)
+        unpack();
+    else if (!xs[idx])
+        xs[idx] = number(dense, idx);
+    return xs[idx];
+}
+void ListStore::unpack() {
+    if (!dense) return;
+
+    for (int i = 0; i < (int) xs.size(); i++) {
+        if (xs[i]) continue;
+        else if (dense->rank() == 1)
+            xs[i] = number(dense, i);
+        else {
+            // Each row is dense in turn
+            Tensor *row = rows(dense, i, i+1);
+            row->shape.erase(row->shape.begin());
+            xs[i] = new ListVal(row);
+        }
+    }
+
+    delete dense;
+    dense = NULL;
+    account();
+}
+void ListStore::to_rope() {
+    if (tree || xs.empty()) return;
+
+    unpack();
+
+    tree = rope_build(xs.data(), xs.size());
+    for (Val v : xs) v->rem_ref();
+    vector<Val>().swap(xs);
+    account();
+}
+void ListStore::trace(ref_visitor f) {
+    for (Val v : xs)
+        if (v) f(v, true);
+    if (tree) f(tree, true);
+}
+void ListStore::clear_refs() {
+    while (!xs.empty()) {
+        Val v = xs.back();
+        xs.pop_back();
+        if (v) v->rem_ref();
+    }
+    if (tree) tree->rem_ref();
+    tree = NULL;
+    delete dense;
+    dense = NULL;
+    account();
+}
+
+// Counts the modifications of lists that the structure of other lists
+// depends on. A structure is remembered only as long as this is unchanged.
+static unsigned long shape_epoch = 1;
+
+void ListVal::modified() {
+    known_at = 0;
+    if (in_shape) shape_epoch++;
+}
+const ListShape& ListVal::shape() {
+    if (known_at == shape_epoch)
+        return known;
+
+    known = ListShape();
+
+    // The structure of a tensor is that of its numbers. It is not
+    // remembered, since the rows that the tensor unpacks into are not
+    // watched for modification.
+    if (Tensor *t = store->dense) {
+        known.rank = t->rank() <= 2 ? t->rank() : 0;
+        known.rows = t->shape[0];
+        known.cols = t->rank() == 2 ? t->shape[1] : 0;
+        known.ints = !t->real;
+        known.reals = t->real;
+        known.depth = t->rank();
+        return known;
+    }
+
+    int n = size();
+    Val v = n ? get(0) : NULL;
+    if (isVal<ListVal>(v)) {
+        // Each row must be a vector of the same length
+        ListShape s;
+        s.rank = 2;
+        s.rows = n;
+        for (int i = 0; i < n; i++) {
+            Val row = get(i);
+            if (!isVal<ListVal>(row)) {
+                s.rank = 0;
+                break;
+            }
+
+            ListVal *r = (ListVal*) row;
+            r->in_shape = true;
+
+            const ListShape &t = r->shape();
+            if (!i) {
+                s.cols = t.rows;
+                s.depth = 1 + t.depth;
+            }
+
+            if (t.rank != 1 || t.rows != s.cols) {
+                s.rank = 0;
+                break;
+            }
+            s.ints |= t.ints;
+            s.reals |= t.reals;
+        }
+
+        if (s.rank) known = s;
+        else known.depth = s.depth;
+    } else if (v) {
+        // Each element must be a number
+        known.rank = 1;
+        known.rows = n;
+        for (int i = 0; i < n; i++) {
+            Val x = get(i);
+            if (isVal<IntVal>(x))
+                known.ints = true;
+            else if (isVal<RealVal>(x))
+                known.reals = true;
+            else {
+                known = ListShape();
+                break;
+            }
+        }
+    }
+
+    // Numbers cannot change their kind, so only the modification of a
+    // list can change the structure
+    known_at = shape_epoch;
+    return known;
+}
+
+ListVal::ListVal(Val *vs, int n) : Value(KIND) {
+    store = new ListStore;
+    if ((store->dense = pack(vs, n))) {
+        for (int i = 0; i < n; i++) vs[i]->rem_ref();
+        store->xs.resize(n, NULL);
+    } else
+        store->xs.assign(vs, vs + n);
+    delete[] vs;
+    store->account();
+}
+ListVal::ListVal(Tensor *t) : Value(KIND) {
+    store = new ListStore;
+    store->dense = t;
+    store->xs.resize(t->shape[0], NULL);
+    store->account();
+}
+void ListVal::detach() {
+    if (store->is_unique()) return;
+
+    // Copy each element into a store of our own
+    ListStore *res = new ListStore;
+    if (store->tree) {
+        res->tree = store->tree;
+        res->tree->add_ref();
+    } else {
+        res->xs = store->xs;
+        for (Val v : res->xs)
+            if (v) v->add_ref();
+        if (store->dense)
+            res->dense = new Tensor(*store->dense);
+    }
+    res->account();
+
+    store->rem_ref();
+    store = res;
+}
+void ListVal::clear_refs() {
+    modified();
+
+    // The store is replaced, so that it may be freed.
+    ListStore *s = store;
+    store = new ListStore;
+    s->rem_ref();
+}
+Val ListVal::get(int idx) {
+    if (store->tree)
+        return rope_get(store->tree, idx);
+    else if (idx < 0 || idx >= size())
+        throw std::out_of_range(std::to_string(idx));
+
+    // Only the elements of a dense list are missing
+    Val v = store->xs[idx];
+    return v ? v : store->element(idx);
+}
+Val ListVal::remove(int idx) {
+    if (idx < 0 || idx >= size())
+        throw std::out_of_range(std::to_string(idx));
+
+    detach();
+    modified();
+    store->unpack();
+    if (idx != size()-1 && size() >= ROPE_MIN)
+        store->to_rope();
+
+    if (store->tree) {
+        // The reference held by the tree is handed to the caller
+        Val v = rope_get(store->tree, idx);
+        v->add_ref();
+
+        RopeNode *t = rope_remove(store->tree, idx);
+        store->tree->rem_ref();
+        store->tree = t;
+        return v;
+    }
+
+    Val v = store->xs[idx];
+    store->xs.erase(store->xs.begin() + idx);
+    store->account();
+    return v;
+}
+void ListVal::add(int idx, Val v) {
+    if (idx < 0 || idx > size())
+        throw std::out_of_range(std::to_string(idx));
+
+    detach();
+    modified();
+    store->unpack();
+    if (idx != size() && size() >= ROPE_MIN)
+        store->to_rope();
+
+    if (store->tree) {
+        // The tree takes over the reference that was given
+        RopeNode *t = rope_insert(store->tree, idx, v);
+        v->rem_ref();
+        store->tree->rem_ref();
+        store->tree = t;
+    } else {
+        store->xs.insert(store->xs.begin() + idx, v);
+        store->account();
+    }
+}
+void ListVal::set(int idx, Val v) {
+    if (idx < 0 || idx >= size())
+        throw std::out_of_range(std::to_string(idx));
+
+    detach();
+    modified();
+    if (Tensor *t = store->dense) {
+        // A number of the same kind is written into a vector, and anything
+        // else unpacks the tensor
+        store->xs[idx] = v;
+        if (t->rank() == 1 && isVal<RealVal>(v) && t->real)
+            t->reals[idx] = ((RealVal*) v)->get();
+        else if (t->rank() == 1 && isVal<IntVal>(v) && !t->real)
+            t->ints[idx] = ((IntVal*) v)->get();
+        else
+            store->unpack();
+    } else if (store->tree) {
+        // The reference to the old element is handed to the caller, as
+        // it would be by the array
+        rope_get(store->tree, idx)->add_ref();
+
+        RopeNode *t = rope_set(store->tree, idx, v);
+        v->rem_ref();
+        store->tree->rem_ref();
+        store->tree = t;
+    } else
+        store->xs[idx] = v;
+}
+void ListVal::reserve(int n) {
+    detach();
+    if (!store->tree && !store->dense)
+        store->xs.reserve(n);
+    store->account();
+}
+ListVal* ListVal::slice(int i, int j) {
+    if (i < 0 || j > size() || i > j)
+        throw std::out_of_range(std::to_string(i) + ":" + std::to_string(j));
+
+    if (store->dense && i < j)
+        return new ListVal(rows(store->dense, i, j));
+
+    ListStore *res = new ListStore;
+    if (j - i >= ROPE_MIN) {
+        store->to_rope();
+        res->tree = rope_slice(store->tree, i, j);
+    } else {
+        for (int k = i; k < j; k++) {
+            Val v = get(k);
+            v->add_ref();
+            res->xs.push_back(v);
+        }
+    }
+
+    return new ListVal(res);
+}
+ListVal* ListVal::concat(ListVal *a, ListVal *b) {
+    Tensor *s = a->tensor();
+    Tensor *t = b->tensor();
+    if (s && t && s->real == t->real && s->rank() == t->rank()
+            && std::equal(s->shape.begin() + 1, s->shape.end(), t->shape.begin() + 1)) {
+        // Tensors whose rows have the same shape are joined directly
+        Tensor *u = new Tensor(*s);
+        u->shape[0] += t->shape[0];
+        u->reals.insert(u->reals.end(), t->reals.begin(), t->reals.end());
+        u->ints.insert(u->ints.end(), t->ints.begin(), t->ints.end());
+        return new ListVal(u);
+    }
+
+    ListStore *res = new ListStore;
+    if (a->size() + b->size() >= ROPE_MIN) {
+        a->store->to_rope();
+        b->store->to_rope();
+        res->tree = rope_concat(a->store->tree, b->store->tree);
+    } else {
+        for (ListVal *L : {a, b})
+            for (int k = 0; k < L->size(); k++) {
+                Val v = L->get(k);
+                v->add_ref();
+                res->xs.push_back(v);
+            }
+    }
+
+    return new ListVal(res);
+}
+ListVal* ListVal::clone() {
+    store->add_ref();
+    return new ListVal(store);
+}
 int ListVal::set(Val v) {
     if (isVal<ListVal>(v)) {
-        // Clear the list
-        while (!isEmpty())
-            remove(size()-1)->rem_ref();
-        
-        // Add each value to the new list
         auto vs = (ListVal*) v;
-        while (!vs->isEmpty()) {
-            auto v = vs->remove(0);
-            add(size(), v);
-        }
+        if (vs == this) return 0;
+
+        // The elements are taken from the other list
+        store->rem_ref();
+        store = vs->store;
+        vs->store = new ListStore;
+        modified();
+        vs->modified();
         
         return 0;
     } else return 1;
 }
 
+void Thunk::clear_refs() {
+    if (val) val->rem_ref();
+    if (env) env->rem_ref();
+    val = NULL;
+    env = NULL;
+}
 int Thunk::set(Val v) {
     if (isVal<Thunk>(v)) {
         Thunk *t = (Thunk*) v;
@@ -308,3 +1118,9 @@ Val Thunk::get(Env e) {
     }
 }
 
+// Void
+VoidVal* VoidVal::of() {
+    static VoidVal *res = constant(new VoidVal);
+    res->add_ref();
+    return res;
+}
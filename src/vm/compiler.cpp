@@ -0,0 +1,334 @@
+#include "vm.hpp"
+
+#include "expression.hpp"
+#include "value.hpp"
+#include "interp.hpp"
+
+using namespace std;
+
+Bytecode::~Bytecode() {
+    for (auto x : consts)
+        release(x);
+}
+
+int Bytecode::emit(Opcode op, int a, int b, int c) {
+    // A frame on the operand stack holds the variables of the body by
+    // slot, and those of enclosing frames are found through the closure,
+    // which is one environment closer than it is to a frame of its own.
+    if (frame >= 0) switch (op) {
+        case OP_LOAD: case OP_STORE: case OP_BIND: case OP_UNBIND: {
+            Variable x = vars[a];
+            if (x.depth == 0 && x.slot >= 0 && x.slot < frame) {
+                op = op == OP_LOAD ? OP_LOCAL
+                   : op == OP_STORE ? OP_SET_LOCAL
+                   : op == OP_BIND ? OP_BIND_LOCAL : OP_UNBIND_LOCAL;
+                b = a;
+                a = x.slot;
+            } else if (x.depth > 0 && op == OP_LOAD)
+                a = variable(x.id, x.depth - 1, x.slot);
+            else
+                spilled = true;
+            break;
+        }
+        case OP_REC: case OP_EVAL:
+            spilled = true;
+            break;
+        default:
+            break;
+    }
+
+    // An assignment whose result is discarded pops it itself, unless a
+    // jump lands between the two
+    if (op == OP_POP && !code.empty() && label != (int) code.size()) {
+        Instruction &I = code.back();
+        if ((I.op == OP_STORE && !I.b) || I.op == OP_SET_LOCAL) {
+            if (I.op == OP_STORE) I.b = 1;
+            else I.op = OP_POP_LOCAL;
+            height--;
+            return code.size() - 1;
+        }
+    }
+
+    // Likewise, an operator takes a constant right operand directly
+    if (op == OP_BINARY && !code.empty() && label != (int) code.size()
+            && code.back().op == OP_CONST) {
+        code.back() = {OP_BINARY_CONST, a, b, code.back().a};
+        height--;
+        return code.size() - 1;
+    }
+
+    switch (op) {
+        case OP_CONST: case OP_LOAD: case OP_LOCAL: case OP_EVAL:
+            height++;
+            break;
+        case OP_BIND: case OP_BIND_LOCAL: case OP_POP_LOCAL: case OP_POP:
+        case OP_BINARY: case OP_BRANCH: case OP_RETURN:
+            height--;
+            break;
+        case OP_CALL: case OP_TAIL:
+            height -= a;
+            break;
+        default:
+            break;
+    }
+    if (height > max_height) max_height = height;
+
+    code.push_back({op, a, b, c});
+    return code.size() - 1;
+}
+
+/**
+ * Determines whether or not an instruction immediately leads to a return.
+ * @param scoped Whether or not the bindings that a let would remove
+ *               before returning are discarded along with the frame.
+ */
+static bool is_return(const Instruction *start, const Instruction *pc, bool scoped) {
+    while (pc->op == OP_JUMP
+            || (scoped && (pc->op == OP_UNBIND || pc->op == OP_UNBIND_LOCAL)))
+        pc = pc->op == OP_JUMP ? start + pc->a : pc + 1;
+    return pc->op == OP_RETURN;
+}
+
+void Bytecode::finish(bool scoped) {
+    emit(OP_RETURN);
+
+    // A call in tail position replaces the activation that makes it, and
+    // a jump to the return returns itself
+    for (auto &I : code)
+        if (I.op == OP_CALL && is_return(code.data(), &I + 1, scoped))
+            I.op = OP_TAIL;
+    for (auto &I : code)
+        if (I.op == OP_JUMP && is_return(code.data(), &I, scoped))
+            I = {OP_RETURN, 0, 0, 0};
+}
+
+int Bytecode::constant(Val v) {
+    // Numbers and booleans are held unboxed
+    consts.push_back(unbox(v));
+    return consts.size() - 1;
+}
+
+int Bytecode::variable(Symbol x, int depth, int slot) {
+    // Variables are frequently reused, so we avoid storing duplicates.
+    for (unsigned i = 0; i < vars.size(); i++)
+        if (vars[i].id == x && vars[i].depth == depth && vars[i].slot == slot)
+            return i;
+
+    vars.push_back({x, depth, slot});
+    return vars.size() - 1;
+}
+
+int Bytecode::node(Exp e) {
+    nodes.push_back(e);
+    return nodes.size() - 1;
+}
+
+string Bytecode::toString() {
+    static const char *opnames[] = {
+        "CONST", "LOAD", "STORE", "BIND", "UNBIND", "REC",
+        "LOCAL", "SET_LOCAL", "POP_LOCAL", "BIND_LOCAL", "UNBIND_LOCAL",
+        "POP", "UNARY", "BINARY", "BINARY_CONST", "JUMP", "BRANCH", "CALL", "TAIL", "EVAL", "RETURN"
+    };
+
+    string s = "";
+    for (unsigned i = 0; i < code.size(); i++) {
+        Instruction &I = code[i];
+        s += to_string(i) + "\t" + opnames[I.op];
+
+        switch (I.op) {
+            case OP_CONST: {
+                Val v = box(consts[I.a]);
+                s += "\t" + v->toString();
+                if (consts[I.a].kind != Imm::BOXED) v->rem_ref();
+                break;
+            }
+            case OP_LOAD:
+            case OP_STORE:
+            case OP_BIND:
+            case OP_UNBIND:
+            case OP_REC:
+                s += "\t" + vars[I.a].id;
+                if (vars[I.a].slot >= 0)
+                    s += " @" + to_string(vars[I.a].depth) + ":" + to_string(vars[I.a].slot);
+                if (I.op == OP_STORE && I.b)
+                    s += " (pop)";
+                break;
+            case OP_LOCAL:
+            case OP_SET_LOCAL:
+            case OP_POP_LOCAL:
+            case OP_BIND_LOCAL:
+            case OP_UNBIND_LOCAL:
+                s += "\t" + vars[I.b].id + " #" + to_string(I.a);
+                break;
+            case OP_UNARY:
+            case OP_BINARY:
+            case OP_EVAL:
+                s += "\t" + nodes[I.a]->toString();
+                break;
+            case OP_BINARY_CONST: {
+                Val v = box(consts[I.c]);
+                s += "\t" + nodes[I.a]->toString() + " (" + v->toString() + ")";
+                if (consts[I.c].kind != Imm::BOXED) v->rem_ref();
+                break;
+            }
+            case OP_JUMP:
+            case OP_BRANCH:
+            case OP_CALL:
+            case OP_TAIL:
+                s += "\t" + to_string(I.a);
+                break;
+            default:
+                break;
+        }
+
+        s += "\n";
+    }
+
+    return s;
+}
+
+Bytecode* compile(Exp exp) {
+    Bytecode *code = new Bytecode;
+    exp->compile(code);
+    code->finish(false);
+    return code;
+}
+
+Bytecode* compile(Exp exp, int frame) {
+    Bytecode *code = new Bytecode(frame);
+    exp->compile(code);
+
+    if (code->needs_env()) {
+        delete code;
+        code = new Bytecode;
+        exp->compile(code);
+    }
+
+    code->finish(true);
+    return code;
+}
+
+void Expression::compile(Bytecode *code) {
+    code->emit(OP_EVAL, code->node(this));
+}
+
+void PrimitiveExp::compile(Bytecode *code) {
+    // Primitives do not depend on the environment, so the value can be
+    // computed once and shared whenever it is needed.
+    code->emit(OP_CONST, code->constant(evaluate(NULL)));
+}
+
+void VarExp::compile(Bytecode *code) {
+    code->emit(OP_LOAD, code->variable(id, depth, slot));
+}
+
+void UnaryOperatorExp::compile(Bytecode *code) {
+    exp->compile(code);
+    code->emit(OP_UNARY, code->node(this));
+}
+
+/**
+ * Finds the operation that an operator performs on integers, if it is
+ * one that the interpreter applies directly.
+ */
+static Arith arith(OperatorExp *e) {
+    switch (e->kind) {
+        case EXP_SUM: return ARITH_ADD;
+        case EXP_DIFF: return ARITH_SUB;
+        case EXP_MULT: return ARITH_MUL;
+        case EXP_COMPARE:
+            switch (((CompareExp*) e)->getOperation()) {
+                case EQ: return ARITH_EQ;
+                case NEQ: return ARITH_NEQ;
+                case GT: return ARITH_GT;
+                case LT: return ARITH_LT;
+                case LEQ: return ARITH_LEQ;
+                case GEQ: return ARITH_GEQ;
+            }
+        default: return ARITH_NONE;
+    }
+}
+
+void OperatorExp::compile(Bytecode *code) {
+    left->compile(code);
+    right->compile(code);
+    code->emit(OP_BINARY, code->node(this), arith(this));
+}
+
+void ApplyExp::compile(Bytecode *code) {
+    op->compile(code);
+
+    int argc;
+    for (argc = 0; args[argc]; argc++)
+        args[argc]->compile(code);
+
+    code->emit(OP_CALL, argc, code->node(op));
+}
+
+void IfExp::compile(Bytecode *code) {
+    cond->compile(code);
+    int br = code->emit(OP_BRANCH, 0, code->node(cond));
+
+    tExp->compile(code);
+    int jmp = code->emit(OP_JUMP);
+
+    code->patch(br);
+    fExp->compile(code);
+    code->patch(jmp);
+}
+
+void LetExp::compile(Bytecode *code) {
+    int argc;
+    for (argc = 0; exps[argc]; argc++) {
+        exps[argc]->compile(code);
+        code->emit(OP_BIND, code->variable(ids[argc], 0, slots ? slots[argc] : -1));
+    }
+
+    // Recursive lambdas are closed over the extended environment
+    for (int i = 0; rec && i < argc; i++)
+        if (rec[i])
+            code->emit(OP_REC, code->variable(ids[i], 0, slots ? slots[i] : -1));
+
+    body->compile(code);
+
+    while (argc--)
+        code->emit(OP_UNBIND, code->variable(ids[argc], 0, slots ? slots[argc] : -1));
+}
+
+void SequenceExp::compile(Bytecode *code) {
+    auto it = seq->iterator();
+    for (int i = 0; it->hasNext(); i++) {
+        // Only the final outcome is kept
+        if (i) code->emit(OP_POP);
+        it->next()->compile(code);
+    }
+    delete it;
+}
+
+void SetExp::compile(Bytecode *code) {
+    if (isExp<VarExp>(tgt)) {
+        VarExp *var = (VarExp*) tgt;
+        exp->compile(code);
+        code->emit(OP_STORE, code->variable(var->getId(), var->getDepth(), var->getSlot()));
+    } else
+        // Assignment into data structures is left to the tree walker
+        Expression::compile(code);
+}
+
+void WhileExp::compile(Bytecode *code) {
+    // A do-while skips the first test of the condition
+    int skip = alwaysEnter ? code->emit(OP_JUMP) : -1;
+
+    int top = code->size();
+    cond->compile(code);
+    int br = code->emit(OP_BRANCH, 0, code->node(cond));
+
+    if (skip >= 0) code->patch(skip);
+    body->compile(code);
+    code->emit(OP_POP);
+    code->emit(OP_JUMP, top);
+
+    // On success, the return type is void
+    code->patch(br);
+    code->emit(OP_CONST, code->constant(VoidVal::of()));
+}
@@ -0,0 +1,533 @@
+#include "vm.hpp"
+
+#include "expression.hpp"
+#include "value.hpp"
+#include "interp.hpp"
+#include "config.hpp"
+
+using namespace std;
+
+/**
+ * The state of a suspended activation, which is resumed once the function
+ * that it called returns.
+ */
+struct Frame {
+    Bytecode *code;
+    const Instruction *pc;
+    Env env;
+    // The function being applied, if any. The activation owns both it
+    // and its environment, unless its frame is on the operand stack.
+    LambdaVal *callee;
+    // The height of the operand stack when the activation began, which
+    // is followed by its frame if the frame is on the stack
+    size_t base;
+    // Whether the result is memoized by the function, and its key
+    bool memoize;
+    MemoKey key;
+};
+
+// Calls are made without recursing in C++, so the depth of a computation
+// is limited by the memory available to this stack, not the native one.
+static vector<Frame> frames;
+
+/**
+ * Takes over a reference to a borrowed immediate, so that it can outlive
+ * the value that it was borrowed from.
+ */
+static inline Imm own(Imm x) {
+    if (x.kind == Imm::BOXED && x.borrowed) {
+        x.v->add_ref();
+        x.borrowed = false;
+    }
+    return x;
+}
+
+/**
+ * Makes room on an operand stack for an activation of a block of bytecode.
+ * @param operands The storage of the stack.
+ * @param sp The top of the stack.
+ * @return The top of the stack, which moves along with its storage.
+ */
+static Imm* reserve(vector<Imm> &operands, Imm *sp, Bytecode *code) {
+    size_t height = sp - operands.data();
+    if (height + code->stack_size() > operands.size()) {
+        operands.resize(2 * (height + code->stack_size()));
+        sp = operands.data() + height;
+    }
+    return sp;
+}
+
+/**
+ * Creates the environment under which a function is applied to arguments.
+ * @param F The function to apply.
+ * @param xs The arguments, of which there are as many as its parameters.
+ * @return The environment.
+ */
+static Env vm_frame(LambdaVal *F, Imm *xs) {
+    Symbol *ids = F->getArgs();
+    Env E = new Environment(F->getEnv(), F->getFrame());
+    for (int i = 0; i < F->arity(); i++)
+        E->bind(i, ids[i], xs[i].v);
+
+    return E;
+}
+
+/**
+ * Releases the function that an activation applies, if any, along with
+ * the environment of its frame.
+ */
+static inline void leave(Bytecode *code, LambdaVal *callee, Env env) {
+    if (callee) {
+        if (code->locals() < 0) env->rem_ref();
+        callee->rem_ref();
+    }
+}
+
+/**
+ * Applies an operation to integers.
+ * @param c Set to the result.
+ * @return Whether or not the operation is one that applies to integers.
+ */
+static inline bool arith(Arith op, integer_t a, integer_t b, Imm &c) {
+    switch (op) {
+        case ARITH_ADD: c = Imm(a + b); break;
+        case ARITH_SUB: c = Imm(a - b); break;
+        case ARITH_MUL: c = Imm(a * b); break;
+        case ARITH_EQ: c = Imm(a == b); break;
+        case ARITH_NEQ: c = Imm(a != b); break;
+        case ARITH_GT: c = Imm(a > b); break;
+        case ARITH_LT: c = Imm(a < b); break;
+        case ARITH_LEQ: c = Imm(a <= b); break;
+        case ARITH_GEQ: c = Imm(a >= b); break;
+        default: return false;
+    }
+    return true;
+}
+
+// Each instruction dispatches the next one itself where the compiler
+// supports it, which is easier to predict than one shared dispatch.
+// Otherwise, every instruction returns to the switch.
+#ifdef __GNUC__
+#define VM_CASE(op) case op: L_##op
+#define VM_DISPATCH() goto *targets[pc->op]
+#else
+#define VM_CASE(op) case op
+#define VM_DISPATCH() goto dispatch
+#endif
+#define VM_NEXT() do { pc++; VM_DISPATCH(); } while (0)
+
+Val vm_execute(Bytecode *code, Env env) {
+#ifdef __GNUC__
+    // The instructions, in the order of Opcode
+    static void *targets[] = {
+        &&L_OP_CONST, &&L_OP_LOAD, &&L_OP_STORE, &&L_OP_BIND, &&L_OP_UNBIND,
+        &&L_OP_REC, &&L_OP_LOCAL, &&L_OP_SET_LOCAL, &&L_OP_POP_LOCAL,
+        &&L_OP_BIND_LOCAL, &&L_OP_UNBIND_LOCAL, &&L_OP_POP, &&L_OP_UNARY,
+        &&L_OP_BINARY, &&L_OP_BINARY_CONST, &&L_OP_JUMP, &&L_OP_BRANCH,
+        &&L_OP_CALL, &&L_OP_TAIL, &&L_OP_EVAL, &&L_OP_RETURN
+    };
+#endif
+
+    // Executions may be nested through the tree walker, which uses the
+    // native stack to do so
+    if (stack_exceeded()) return NULL;
+
+    const Instruction *pc = code->instructions();
+    const Instruction *start = pc;
+
+    // Each execution has an operand stack of its own, since an execution
+    // may begin another one (through an import, for instance). Operands
+    // hold references of their own, and numbers and booleans are held
+    // unboxed, as the tree walker holds them.
+    vector<Imm> operands;
+    Imm *sp = reserve(operands, operands.data(), code);
+    size_t base = 0;
+
+    // The frame of the current activation, if it is on the stack
+    Imm *locals = sp + 1;
+
+    // Activations below this height belong to other executions
+    size_t floor = frames.size();
+
+    // The function being applied by the current activation. When it is
+    // present, the activation owns both it and the environment, unless
+    // its frame is on the stack.
+    LambdaVal *callee = NULL;
+
+    // Whether the result of the activation is memoized, and its key
+    bool memoize = false;
+    MemoKey key;
+
+    VM_DISPATCH();
+
+dispatch:
+    switch (pc->op) {
+        VM_CASE(OP_CONST): {
+            // Constants are frozen, so they are shared rather than copied
+            Imm x = code->get_const(pc->a);
+            if (x.kind == Imm::BOXED) x.v->add_ref();
+            *sp++ = x;
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_LOAD): {
+            auto &x = code->get_variable(pc->a);
+            Val v = env->apply(x.id, x.depth, x.slot);
+            if (!v) {
+                throw_err("runtime", "variable '" + x.id + "' was not recognized");
+                goto fail;
+            }
+
+            // Numbers are copied out rather than referenced
+            switch (v->kind) {
+                case VAL_INT: *sp++ = Imm(((IntVal*) v)->get()); break;
+                case VAL_REAL: *sp++ = Imm(((RealVal*) v)->get()); break;
+                case VAL_BOOL: *sp++ = Imm(((BoolVal*) v)->get()); break;
+                default:
+                    v->add_ref();
+                    *sp++ = Imm(v);
+            }
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_STORE): {
+            auto &x = code->get_variable(pc->a);
+            Imm y = sp[-1];
+
+            // A number that only this frame can see is overwritten in
+            // place. Otherwise, variables of enclosing frames are
+            // shadowed.
+            Val v = x.depth == 0 ? env->lookup(x.slot, x.id) : NULL;
+            if (!v || !v->is_unique() || !assign(v, y)) {
+                v = y.kind == Imm::BOXED ? y.v : box(y);
+
+                if (x.depth == 0)
+                    env->bind(x.slot, x.id, v);
+                else
+                    env->set(x.id, v);
+
+                if (y.kind != Imm::BOXED) v->rem_ref();
+            }
+
+            if (pc->b) release(*--sp);
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_BIND): {
+            // Bound values are copies, as they are in the tree walker
+            Imm v = *--sp;
+
+            auto &y = code->get_variable(pc->a);
+            Val x = v.kind == Imm::BOXED ? v.v->clone() : box(v);
+            env->bind(y.slot, y.id, x);
+
+            release(v);
+            x->rem_ref();
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_UNBIND): {
+            auto &x = code->get_variable(pc->a);
+            env->unbind(x.slot, x.id);
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_LOCAL): {
+            Imm x = locals[pc->a];
+            if (x.kind == Imm::FAIL) {
+                // A slot that is not yet bound defers to the closure,
+                // as an environment would
+                auto &y = code->get_variable(pc->b);
+                Val v = env->apply(y.id);
+                if (!v) {
+                    throw_err("runtime", "variable '" + y.id + "' was not recognized");
+                    goto fail;
+                }
+                v->add_ref();
+                x = unbox(v);
+            } else if (x.kind == Imm::BOXED)
+                x.v->add_ref();
+            *sp++ = x;
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_SET_LOCAL):
+        VM_CASE(OP_POP_LOCAL): {
+            // The local shares the value, as a binding would
+            Imm y = sp[-1];
+            if (pc->op == OP_POP_LOCAL) sp--;
+            else if (y.kind == Imm::BOXED) y.v->add_ref();
+            release(locals[pc->a]);
+            locals[pc->a] = y;
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_BIND_LOCAL): {
+            // Bound values are copies, as they are in the tree walker
+            Imm v = *--sp;
+            Imm x = v;
+            if (v.kind == Imm::BOXED) {
+                x = Imm(v.v->clone());
+                release(v);
+            }
+            release(locals[pc->a]);
+            locals[pc->a] = x;
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_UNBIND_LOCAL):
+            release(locals[pc->a]);
+            locals[pc->a] = Imm();
+            VM_NEXT();
+
+        VM_CASE(OP_REC): {
+            auto &x = code->get_variable(pc->a);
+            Val v = env->apply(x.id, x.depth, x.slot);
+            if (isVal<LambdaVal>(v))
+                ((LambdaVal*) v)->setEnv(env);
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_POP):
+            release(*--sp);
+            VM_NEXT();
+
+        VM_CASE(OP_UNARY): {
+            Imm a = sp[-1];
+            Val x = a.kind == Imm::BOXED ? a.v : box(a);
+            Val y = ((UnaryOperatorExp*) code->get_node(pc->a))->op(x);
+            x->rem_ref();
+
+            if (!y) {
+                sp--;
+                goto fail;
+            }
+            sp[-1] = Imm(y);
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_BINARY):
+        VM_CASE(OP_BINARY_CONST): {
+            Imm b = pc->op == OP_BINARY ? *--sp : code->get_const(pc->c);
+            Imm a = *--sp;
+            Imm c;
+
+            // Integers are operated on directly. Otherwise, the
+            // operator shares its type feedback with the tree.
+            if (a.kind != Imm::INT || b.kind != Imm::INT || !arith((Arith) pc->b, a.i, b.i, c)) {
+                // Constants are frozen, so they are shared
+                if (pc->op == OP_BINARY_CONST && b.kind == Imm::BOXED)
+                    b.v->add_ref();
+
+                Imm x = unbox(a);
+                if (x.kind == Imm::FAIL) {
+                    release(b);
+                    goto fail;
+                }
+
+                Imm y = unbox(b);
+                if (y.kind == Imm::FAIL) {
+                    release(x);
+                    goto fail;
+                }
+
+                c = own(((OperatorExp*) code->get_node(pc->a))->apply(x, y));
+                release(x);
+                release(y);
+
+                if (c.kind == Imm::FAIL) goto fail;
+            }
+
+            // A comparison decides the branch that follows directly
+            if (c.kind == Imm::BOOL && pc[1].op == OP_BRANCH) {
+                pc = c.b ? pc + 2 : start + pc[1].a;
+                VM_DISPATCH();
+            }
+            *sp++ = c;
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_JUMP):
+            // Loops are safe points for the cycle collector
+            if (start + pc->a < pc && !gc_safepoint()) goto fail;
+            pc = start + pc->a;
+            VM_DISPATCH();
+
+        VM_CASE(OP_BRANCH): {
+            Imm c = unbox(*--sp);
+
+            if (c.kind == Imm::FAIL) goto fail;
+            else if (c.kind != Imm::BOOL) {
+                throw_type_err(code->get_node(pc->b), "boolean");
+                release(c);
+                goto fail;
+            }
+
+            if (!c.b) {
+                pc = start + pc->a;
+                VM_DISPATCH();
+            }
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_CALL):
+        VM_CASE(OP_TAIL): {
+            int argc = pc->a;
+            Imm *argv = sp - argc;
+
+            // Null check and type check the function
+            if (argv[-1].kind != Imm::BOXED || !isVal<LambdaVal>(argv[-1].v)) {
+                argv[-1] = unbox(argv[-1]);
+                if (argv[-1].kind == Imm::FAIL) goto fail;
+                else if (argv[-1].kind != Imm::BOXED || !isVal<LambdaVal>(argv[-1].v)) {
+                    throw_type_err(code->get_node(pc->b), "lambda");
+                    goto fail;
+                }
+            }
+
+            LambdaVal *F = (LambdaVal*) argv[-1].v;
+            if (F->arity() != argc) goto fail;
+
+            // A call in tail position replaces the current activation,
+            // since it is no longer needed. Otherwise, it is suspended.
+            bool tail = pc->op == OP_TAIL;
+            if (!tail && frames.size() >= configuration.max_depth) {
+                throw_err("runtime", "maximum call depth of " + to_string(configuration.max_depth) + " exceeded");
+                goto fail;
+            } else if (heap_exceeded())
+                goto fail;
+
+            // Pure functions may have already computed the result
+            MemoKey k;
+            bool m = F->memoizes(argv, k);
+            if (m) {
+                Imm res;
+                if (F->recall(k, res)) {
+                    while (sp >= argv)
+                        release(*--sp);
+                    *sp++ = res;
+                    VM_NEXT();
+                }
+            }
+
+            Bytecode *next = F->getCode();
+            sp = reserve(operands, sp, next);
+            argv = sp - argc;
+
+            // The arguments begin the frame of the function. Unless the
+            // frame is kept on the stack, they are bound as values, as
+            // they are by the tree walker.
+            Env E = F->getEnv();
+            if (next->locals() < 0) {
+                for (int i = 0; i < argc; i++)
+                    if (argv[i].kind != Imm::BOXED) argv[i] = Imm(box(argv[i]));
+                E = vm_frame(F, argv);
+            }
+
+            // The activation takes over the reference to the function
+            argv[-1] = Imm();
+
+            if (tail) {
+                // Garbage collection on the rest of the activation,
+                // whose frame is replaced by the arguments
+                Imm *bottom = operands.data() + base;
+                if (next->locals() < 0) {
+                    while (sp > bottom)
+                        release(*--sp);
+                } else {
+                    for (Imm *x = bottom; x < argv; x++)
+                        release(*x);
+                    bottom[0] = Imm();
+                    for (int i = 0; i < argc; i++)
+                        bottom[i + 1] = argv[i];
+                    sp = bottom + argc + 1;
+                }
+                leave(code, callee, env);
+            } else {
+                frames.push_back({code, pc + 1, env, callee, base, memoize, key});
+                base = argv - 1 - operands.data();
+                if (next->locals() < 0)
+                    while (sp > argv - 1)
+                        release(*--sp);
+            }
+
+            // The rest of the frame is unbound
+            locals = operands.data() + base + 1;
+            if (next->locals() >= 0)
+                while (sp < locals + next->locals())
+                    *sp++ = Imm();
+
+            callee = F;
+            env = E;
+            memoize = m;
+            if (m) key = k;
+            code = next;
+            pc = start = code->instructions();
+            VM_DISPATCH();
+        }
+
+        VM_CASE(OP_EVAL): {
+            Imm v = own(code->get_node(pc->a)->evaluate_imm(env));
+            if (v.kind == Imm::FAIL) goto fail;
+            *sp++ = v;
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_RETURN): {
+            Imm v = *--sp;
+
+            if (memoize)
+                callee->remember(key, v);
+
+            // Garbage collection on the frame
+            while (sp > operands.data() + base)
+                release(*--sp);
+            leave(code, callee, env);
+
+            if (frames.size() == floor)
+                return box(v);
+
+            // Resume the caller with the result
+            Frame &F = frames.back();
+            code = F.code;
+            start = code->instructions();
+            pc = F.pc;
+            env = F.env;
+            callee = F.callee;
+            base = F.base;
+            memoize = F.memoize;
+            key = F.key;
+            frames.pop_back();
+            locals = operands.data() + base + 1;
+
+            *sp++ = v;
+            VM_DISPATCH();
+        }
+    }
+
+fail:
+    // Release everything that the activations of this execution left
+    // behind, including the operands of the suspended ones
+    while (sp > operands.data())
+        release(*--sp);
+
+    leave(code, callee, env);
+
+    while (frames.size() > floor) {
+        Frame &F = frames.back();
+        leave(F.code, F.callee, F.env);
+        frames.pop_back();
+    }
+
+    return NULL;
+}
+
+Val vm_run(Exp exp, Env env) {
+    Bytecode *code = compile(exp);
+    throw_debug("vm", "compiled '" + exp->toString() + "' to\n" + code->toString());
+
+    Val v = vm_execute(code, env);
+    delete code;
+
+    return v;
+}